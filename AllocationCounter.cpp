@@ -0,0 +1,69 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/* Plain integers only, anything with a constructor could allocate from inside operator new */
+static std::atomic<uint64_t> total_allocations(0);
+static thread_local uint64_t thread_allocations = 0;
+
+uint64_t allocation_count() {
+    return total_allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t thread_allocation_count() {
+    return thread_allocations;
+}
+
+static void *counted_malloc(std::size_t size) {
+    total_allocations.fetch_add(1, std::memory_order_relaxed);
+    ++thread_allocations;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(std::size_t size) {
+    void *memory = counted_malloc(size);
+    if (memory == NULL)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void *operator new[](std::size_t size) {
+    void *memory = counted_malloc(size);
+    if (memory == NULL)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return counted_malloc(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return counted_malloc(size);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
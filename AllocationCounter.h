@@ -0,0 +1,18 @@
+#ifndef CUSTOM_APP_ALLOCATIONCOUNTER_H
+#define CUSTOM_APP_ALLOCATIONCOUNTER_H
+
+#include <stdint.h>
+
+/*
+ * Counts the calls to the global operator new of the whole program, DICe and OpenCV's C++ code
+ * included. cv::Mat pixel buffers come from cv::fastMalloc and are not seen here, the FramePool
+ * counts those it had to allocate itself.
+ */
+
+/** Every allocation since the program started, all threads */
+uint64_t allocation_count();
+
+/** Allocations made by the calling thread */
+uint64_t thread_allocation_count();
+
+#endif //CUSTOM_APP_ALLOCATIONCOUNTER_H
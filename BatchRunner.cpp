@@ -0,0 +1,542 @@
+#include "BatchRunner.h"
+
+#include <DICe_Parser.h>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include <Teuchos_XMLParameterListHelpers.hpp>
+
+using namespace std;
+
+static bool is_directory(const string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static string absolute_path(const string &path) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == NULL)
+        return "";
+    return string(resolved);
+}
+
+static string base_name(const string &path) {
+    const size_t slash = path.find_last_of('/');
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+/* A relative file name of input.xml as seen from its own directory */
+static void resolve_against(const Teuchos::RCP<Teuchos::ParameterList> &params, const char *name,
+                            const string &directory, const Teuchos::RCP<Teuchos::ParameterList> &overrides) {
+    if (!params->isParameter(name))
+        return;
+    const string value = params->get<string>(name);
+    if (!value.empty() && value[0] != '/')
+        overrides->set(name, directory + "/" + value);
+}
+
+/* A masters_batch --lane process and the pipes to it */
+struct LaneProcess {
+    pid_t pid;
+    FILE *to;
+    FILE *from;
+
+    LaneProcess() : pid(-1), to(NULL), from(NULL) {}
+};
+
+static bool send_line(FILE *to, const string &line) {
+    return to != NULL && fputs((line + "\n").c_str(), to) >= 0 && fflush(to) == 0;
+}
+
+/* False once the other end has gone */
+static bool receive_line(FILE *from, string &line) {
+    char buffer[1024];
+    if (from == NULL || fgets(buffer, sizeof(buffer), from) == NULL)
+        return false;
+    line = buffer;
+    if (!line.empty() && line[line.size() - 1] == '\n')
+        line.erase(line.size() - 1);
+    return true;
+}
+
+/* Start args with the ends of two pipes appended, the lane reads the first and writes the second */
+static bool spawn_lane(vector<string> args, LaneProcess &process) {
+    // close on exec, a lane another worker starts meanwhile must not hold these open or EOF never comes
+    int to_lane[2];
+    int from_lane[2];
+    if (pipe2(to_lane, O_CLOEXEC) != 0)
+        return false;
+    if (pipe2(from_lane, O_CLOEXEC) != 0) {
+        close(to_lane[0]);
+        close(to_lane[1]);
+        return false;
+    }
+    args.push_back(to_string(to_lane[0]));
+    args.push_back(to_string(from_lane[1]));
+    vector<char *> argv;
+    for (size_t i = 0; i < args.size(); ++i)
+        argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(NULL);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        // the other workers are threads, nothing but async-signal-safe calls until the exec
+        fcntl(to_lane[0], F_SETFD, 0);
+        fcntl(from_lane[1], F_SETFD, 0);
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    close(to_lane[0]);
+    close(from_lane[1]);
+    if (pid < 0) {
+        close(to_lane[1]);
+        close(from_lane[0]);
+        return false;
+    }
+    process.pid = pid;
+    process.to = fdopen(to_lane[1], "w");
+    process.from = fdopen(from_lane[0], "r");
+    return process.to != NULL && process.from != NULL;
+}
+
+/* Close the pipes, which ends a lane still waiting for a frame, and reap it. Empty if it exited cleanly */
+static string end_lane(LaneProcess &process) {
+    if (process.to != NULL)
+        fclose(process.to);
+    if (process.from != NULL)
+        fclose(process.from);
+    process.to = process.from = NULL;
+    int status = 0;
+    if (process.pid <= 0 || waitpid(process.pid, &status, 0) != process.pid)
+        return "";
+    if (WIFSIGNALED(status))
+        return "lane process killed by signal " + to_string(WTERMSIG(status));
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        return "lane process exited with " + to_string(WEXITSTATUS(status));
+    return "";
+}
+
+BatchRunner::BatchRunner(const BatchOptions &options) :
+        options_(options),
+        active_lanes_(0),
+        calibration_cache_(Teuchos::rcp(new CalibrationCache())),
+        cross_cache_(Teuchos::rcp(new CrossCorrelationCache(options.cross_cache_folder))),
+        wall_ms_(0.0),
+        busy_ms_(0.0),
+        num_workers_(options.workers > 0 ? options.workers : std::max(1u, thread::hardware_concurrency())) {}
+
+bool BatchRunner::add_job(const string &directory) {
+    const string folder = absolute_path(directory);
+    const string input_file = folder + "/input.xml";
+    if (folder.empty() || !ifstream(input_file.c_str()).good()) {
+        cerr << "No input.xml in " << directory << endl;
+        return false;
+    }
+    Teuchos::RCP<Teuchos::ParameterList> params = Teuchos::rcp(new Teuchos::ParameterList());
+    Teuchos::RCP<Teuchos::ParameterList> overrides = Teuchos::rcp(new Teuchos::ParameterList());
+    BatchJobStats stats;
+    stats.directory = folder;
+    stats.name = base_name(folder);
+    for (int copy = 2; std::any_of(stats_.begin(), stats_.end(), [&stats](const BatchJobStats &other) {
+        return other.name == stats.name;
+    }); ++copy)
+        stats.name = base_name(folder) + "_" + to_string(copy);
+    try {
+        Teuchos::Ptr<Teuchos::ParameterList> params_ptr(params.get());
+        Teuchos::updateParametersFromXmlFile(input_file, params_ptr);
+        // the jobs share the working directory, every file they name has to be found from anywhere.
+        // A relative image folder that is not inside the job directory was written for running from
+        // its parent (SecondTest names ./SecondTest/), the images are then next to input.xml
+        const string image_folder = params->get<string>(DICe::image_folder, "");
+        if (image_folder.empty() || image_folder[0] != '/')
+            overrides->set(DICe::image_folder, !image_folder.empty() && is_directory(folder + "/" + image_folder)
+                                               ? folder + "/" + image_folder +
+                                                 (image_folder[image_folder.size() - 1] == '/' ? "" : "/")
+                                               : folder + "/");
+        resolve_against(params, DICe::correlation_parameters_file, folder, overrides);
+        resolve_against(params, DICe::subset_file, folder, overrides);
+        resolve_against(params, DICe::calibration_parameters_file, folder, overrides);
+        resolve_against(params, DICe::camera_system_file, folder, overrides);
+        params->setParameters(*overrides);
+        vector<string> image_files;
+        vector<string> stereo_image_files;
+        DICe::decipher_image_file_names(params, image_files, stereo_image_files);
+        stats.frames = (int_t) image_files.size() - 1;
+    } catch (const std::exception &e) {
+        cerr << "Cannot read " << input_file << ": " << e.what() << endl;
+        return false;
+    }
+    if (stats.frames <= 0) {
+        cerr << "No deformed images in " << input_file << endl;
+        return false;
+    }
+    Job job;
+    job.input_file = input_file;
+    job.overrides = overrides;
+    job.splittable = false;
+    jobs_.push_back(job);
+    stats_.push_back(stats);
+    return true;
+}
+
+vector<string> BatchRunner::expand_job_directories(const vector<string> &patterns) {
+    vector<string> directories;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        glob_t matches;
+        if (glob(patterns[i].c_str(), GLOB_NOCHECK, NULL, &matches) == 0) {
+            for (size_t match = 0; match < matches.gl_pathc; ++match)
+                if (is_directory(matches.gl_pathv[match]))
+                    directories.push_back(matches.gl_pathv[match]);
+        }
+        globfree(&matches);
+    }
+    return directories;
+}
+
+double BatchRunner::now_ms() const {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start_).count();
+}
+
+bool BatchRunner::run() {
+    start_ = chrono::steady_clock::now();
+    if (!options_.output_folder.empty() && options_.output_folder[0] != '/') {
+        char buffer[4096];
+        if (getcwd(buffer, sizeof(buffer)) != NULL)
+            options_.output_folder = string(buffer) + "/" + options_.output_folder;
+    }
+    mkdir(options_.output_folder.c_str(), 0755);
+    if (options_.cross_cache_folder.empty()) {
+        // the split sessions of a job find the cross-correlation of the first one here
+        options_.cross_cache_folder = options_.output_folder + "/cross_cache";
+        mkdir(options_.cross_cache_folder.c_str(), 0755);
+    }
+    char program[PATH_MAX];
+    const ssize_t length = readlink("/proc/self/exe", program, sizeof(program) - 1);
+    worker_program_ = length > 0 ? string(program, length) : "masters_batch";
+    // a lane that dies between two frames must not take the whole batch down with it
+    signal(SIGPIPE, SIG_IGN);
+    // the results of each job go to a folder of their own, DICe appends the file names straight on
+    for (size_t job = 0; job < jobs_.size(); ++job) {
+        mkdir((options_.output_folder + "/" + stats_[job].name).c_str(), 0755);
+        jobs_[job].overrides->set(DICe::output_folder, options_.output_folder + "/" + stats_[job].name + "/");
+    }
+
+    // longest first, dealt round the workers so each starts on the longest job it has. A thief
+    // takes from the other end, the short jobs fill in around the long ones
+    vector<size_t> order(jobs_.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    const vector<BatchJobStats> &stats = stats_;
+    stable_sort(order.begin(), order.end(), [&stats](size_t a, size_t b) {
+        return stats[a].frames > stats[b].frames;
+    });
+    lanes_.clear();
+    queues_.assign(num_workers_, deque<Lane *>());
+    for (size_t rank = 0; rank < order.size(); ++rank) {
+        unique_ptr<Lane> lane(new Lane());
+        lane->job = order[rank];
+        lane->next = 1;
+        lane->end = stats_[order[rank]].frames + 1;
+        lane->offset = 0;
+        lane->running = false;
+        lane->ready = false;
+        queues_[rank % num_workers_].push_front(lane.get());
+        lanes_.push_back(std::move(lane));
+    }
+    active_lanes_ = 0;
+    busy_ms_ = 0.0;
+
+    vector<thread> workers;
+    for (size_t worker = 0; worker < num_workers_; ++worker)
+        workers.push_back(thread(&BatchRunner::worker_loop, this, worker));
+    for (size_t worker = 0; worker < workers.size(); ++worker)
+        workers[worker].join();
+    wall_ms_ = now_ms();
+
+    bool all_good = true;
+    for (size_t job = 0; job < stats_.size(); ++job)
+        if (stats_[job].failed_step || !stats_[job].error.empty() || stats_[job].frames_done < stats_[job].frames)
+            all_good = false;
+    return all_good;
+}
+
+void BatchRunner::worker_loop(size_t worker) {
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+        Lane *lane = take(worker);
+        if (lane == NULL) {
+            if (active_lanes_ == 0) {
+                cond_.notify_all();
+                return;
+            }
+            // a running job may be worth splitting once it is set up, or the last ones finish
+            cond_.wait(lock);
+            continue;
+        }
+        lane->running = true;
+        ++active_lanes_;
+        lock.unlock();
+        run_lane(*lane);
+        lock.lock();
+        lane->running = false;
+        lane->ready = false;
+        --active_lanes_;
+        cond_.notify_all();
+    }
+}
+
+BatchRunner::Lane *BatchRunner::take(size_t worker) {
+    deque<Lane *> &own = queues_[worker];
+    if (!own.empty()) {
+        Lane *lane = own.back();
+        own.pop_back();
+        return lane;
+    }
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        deque<Lane *> &victim = queues_[(worker + i) % queues_.size()];
+        if (!victim.empty()) {
+            Lane *lane = victim.front();
+            victim.pop_front();
+            return lane;
+        }
+    }
+    return split(worker);
+}
+
+BatchRunner::Lane *BatchRunner::split(size_t worker) {
+    Lane *victim = NULL;
+    int_t most = 0;
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        Lane *lane = lanes_[i].get();
+        if (!lane->ready || !jobs_[lane->job].splittable)
+            continue;
+        if (lane->end - lane->next > most) {
+            most = lane->end - lane->next;
+            victim = lane;
+        }
+    }
+    // the thief pays for a setup of its own, a few frames are not worth it
+    if (victim == NULL || most < 2 * std::max((int_t) 1, options_.min_split_frames))
+        return NULL;
+    unique_ptr<Lane> lane(new Lane());
+    lane->job = victim->job;
+    lane->next = victim->next + most / 2;
+    lane->end = victim->end;
+    lane->offset = lane->next - 1;
+    lane->running = false;
+    lane->ready = false;
+    victim->end = lane->next;
+    cout << "Worker " << worker << " takes frames " << lane->next << " to " << lane->end - 1 << " of "
+         << stats_[lane->job].name << endl;
+    lanes_.push_back(std::move(lane));
+    return lanes_.back().get();
+}
+
+vector<string> BatchRunner::lane_arguments(const Lane &lane) const {
+    vector<string> args;
+    args.push_back(worker_program_);
+    args.push_back("--cross-cache");
+    args.push_back(options_.cross_cache_folder);
+    if (!options_.image_cache_folder.empty()) {
+        args.push_back("--image-cache");
+        args.push_back(options_.image_cache_folder);
+        args.push_back("--image-cache-mb");
+        args.push_back(to_string(options_.image_cache_mb));
+    }
+    if (options_.parallel_stereo)
+        args.push_back("--parallel-stereo");
+    if (options_.tracking)
+        args.push_back("--tracking");
+    args.push_back("--lane");
+    args.push_back(stats_[lane.job].directory);
+    args.push_back(options_.output_folder + "/" + stats_[lane.job].name + "/");
+    args.push_back(to_string(lane.offset));
+    return args;
+}
+
+void BatchRunner::run_lane(Lane &lane) {
+    const double start = now_ms();
+    {
+        lock_guard<mutex> lock(mutex_);
+        BatchJobStats &stats = stats_[lane.job];
+        if (stats.sessions == 0)
+            stats.start_ms = start;
+        ++stats.sessions;
+    }
+    bool failed_step = false;
+    string error;
+    string reply;
+    LaneProcess process;
+    int cached = 0;
+    int incremental = 0;
+    if (!spawn_lane(lane_arguments(lane), process)) {
+        error = "cannot start a lane process";
+    } else if (!receive_line(process.from, reply) ||
+               sscanf(reply.c_str(), "ready %d %d", &cached, &incremental) != 2) {
+        error = "setup failed";
+    } else {
+        {
+            lock_guard<mutex> lock(mutex_);
+            BatchJobStats &stats = stats_[lane.job];
+            stats.setup_ms += now_ms() - start;
+            if (cached)
+                ++stats.cross_correlation_cached;
+            // every split session starts from the reference, the incremental formulation moves it
+            if (lane.offset == 0)
+                jobs_[lane.job].splittable = !incremental;
+            lane.ready = true;
+        }
+        cond_.notify_all();
+        for (;;) {
+            int_t image_it;
+            {
+                lock_guard<mutex> lock(mutex_);
+                if (lane.next >= lane.end)
+                    break;
+                image_it = lane.next++;
+            }
+            const double frame_start = now_ms();
+            int frame_failed = 0;
+            if (!send_line(process.to, "frame " + to_string(image_it)) || !receive_line(process.from, reply) ||
+                sscanf(reply.c_str(), "done %d", &frame_failed) != 1) {
+                error = "frame " + to_string(image_it) + " failed";
+                break;
+            }
+            lock_guard<mutex> lock(mutex_);
+            BatchJobStats &stats = stats_[lane.job];
+            stats.frame_ms += now_ms() - frame_start;
+            ++stats.frames_done;
+            if (lane.offset > 0)
+                ++stats.frames_stolen;
+            if (frame_failed) {
+                stats.failed_step = true;
+                failed_step = true;
+            }
+        }
+        size_t loads = 0;
+        size_t hits = 0;
+        if (error.empty()) {
+            if (!send_line(process.to, string("finish ") + (failed_step ? "1" : "0")) ||
+                !receive_line(process.from, reply) || sscanf(reply.c_str(), "finished %zu %zu", &loads, &hits) != 2)
+                error = "writing the results failed";
+            lock_guard<mutex> lock(mutex_);
+            calibration_stats_.loads += loads;
+            calibration_stats_.hits += hits;
+        }
+    }
+    if (!error.empty()) {
+        // the lane says what went wrong if it still could, else how it ended
+        const string ended = end_lane(process);
+        if (reply.compare(0, 6, "error ") == 0)
+            error = reply.substr(6);
+        else if (!ended.empty())
+            error += ", " + ended;
+    } else {
+        error = end_lane(process);
+    }
+    lock_guard<mutex> lock(mutex_);
+    if (!error.empty()) {
+        stats_[lane.job].error = error;
+        // nobody else may pick up the rest of a lane that went wrong
+        lane.next = lane.end;
+    }
+    const double end = now_ms();
+    stats_[lane.job].end_ms = std::max(stats_[lane.job].end_ms, end);
+    busy_ms_ += end - start;
+}
+
+int BatchRunner::serve_lane(const string &output_folder, int_t offset, int read_fd, int write_fd) {
+    FILE *from = fdopen(read_fd, "r");
+    FILE *to = fdopen(write_fd, "w");
+    if (from == NULL || to == NULL || jobs_.size() != 1)
+        return -1;
+    Job &job = jobs_[0];
+    job.overrides->set(DICe::output_folder, output_folder);
+    int return_val = 0;
+    try {
+        CorrelationSession session(job.input_file, job.overrides);
+        session.set_calibration_cache(calibration_cache_);
+        session.set_cross_correlation_cache(cross_cache_);
+        if (!options_.image_cache_folder.empty())
+            session.set_image_cache(Teuchos::rcp(new ImageCache(options_.image_cache_folder,
+                                                                (size_t) options_.image_cache_mb << 20)));
+        session.set_parallel_stereo(options_.parallel_stereo);
+        session.set_tracking(options_.tracking);
+        session.set_frame_offset(offset);
+        session.set_global_timers(false);
+        session.setup();
+        send_line(to, string("ready ") + (session.cross_correlation_cached() ? "1" : "0") +
+                      (session.schema()->use_incremental_formulation() ? " 1" : " 0"));
+        string request;
+        int image_it = 0;
+        int failed_step = 0;
+        // the worker closing the pipe without a finish means the batch gave up on the lane
+        while (receive_line(from, request)) {
+            if (sscanf(request.c_str(), "frame %d", &image_it) == 1) {
+                send_line(to, string("done ") + (session.correlate_frame(image_it) ? "1" : "0"));
+            } else if (sscanf(request.c_str(), "finish %d", &failed_step) == 1) {
+                session.finish(failed_step != 0);
+                const CalibrationCacheStats calibration = calibration_cache_->stats();
+                send_line(to, "finished " + to_string(calibration.loads) + " " + to_string(calibration.hits));
+                break;
+            }
+        }
+    } catch (const std::exception &e) {
+        string message = e.what();
+        replace(message.begin(), message.end(), '\n', ' ');
+        send_line(to, "error " + message.substr(0, 1000));
+        return_val = -1;
+    }
+    fclose(from);
+    fclose(to);
+    return return_val;
+}
+
+CalibrationCacheStats BatchRunner::calibration_stats() const {
+    lock_guard<mutex> lock(mutex_);
+    return calibration_stats_;
+}
+
+double BatchRunner::worker_utilisation() const {
+    return wall_ms_ > 0.0 ? busy_ms_ / (num_workers_ * wall_ms_) : 0.0;
+}
+
+void BatchRunner::print_summary(ostream &os) const {
+    char line[512];
+    os << "\n--- Batch of " << stats_.size() << " jobs on " << num_workers_ << " workers in " << wall_ms_ / 1000.0
+       << " s ---\n" << endl;
+    snprintf(line, sizeof(line), "%-24s %11s %8s %7s %6s %10s %10s %9s %9s  %s", "job", "frames", "sessions",
+             "stolen", "cached", "setup ms", "ms/frame", "wall s", "frames/s", "status");
+    os << line << endl;
+    long frames = 0;
+    for (size_t job = 0; job < stats_.size(); ++job) {
+        const BatchJobStats &s = stats_[job];
+        const string status = !s.error.empty() ? "error: " + s.error : s.failed_step ? "failed step" :
+                                                                      s.frames_done < s.frames ? "incomplete" : "ok";
+        char done[32];
+        snprintf(done, sizeof(done), "%ld/%d", s.frames_done, (int) s.frames);
+        snprintf(line, sizeof(line), "%-24s %11s %8d %7ld %6d %10.1f %10.1f %9.2f %9.2f  %s", s.name.c_str(), done,
+                 s.sessions, s.frames_stolen, s.cross_correlation_cached, s.setup_ms,
+                 s.frames_done > 0 ? s.frame_ms / s.frames_done : 0.0, s.wall_ms() / 1000.0, s.frames_per_second(),
+                 status.c_str());
+        os << line << endl;
+        frames += s.frames_done;
+    }
+    const CalibrationCacheStats calibration = calibration_stats();
+    os << "\nTotal: " << frames << " frames, " << (wall_ms_ > 0.0 ? 1000.0 * frames / wall_ms_ : 0.0)
+       << " frames/s, workers busy " << 100.0 * worker_utilisation() << "% of the time, calibrations parsed "
+       << calibration.loads << " and reused " << calibration.hits << " times" << endl;
+}
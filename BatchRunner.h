@@ -0,0 +1,192 @@
+#ifndef CUSTOM_APP_BATCHRUNNER_H
+#define CUSTOM_APP_BATCHRUNNER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <Teuchos_ParameterList.hpp>
+#include <Teuchos_RCP.hpp>
+
+#include "CalibrationCache.h"
+#include "CorrelationSession.h"
+#include "CrossCorrelationCache.h"
+#include "ImageCache.h"
+
+struct BatchOptions {
+    /* lane processes at a time, 0 for one per core */
+    size_t workers;
+    /* a thief only splits a job if both halves keep at least this many frames */
+    int_t min_split_frames;
+    /* each job writes to output_folder/<job name>/ */
+    std::string output_folder;
+    /* shared by the lanes on disk, output_folder/cross_cache when empty */
+    std::string cross_cache_folder;
+    std::string image_cache_folder;
+    int image_cache_mb;
+    bool parallel_stereo;
+    bool tracking;
+
+    BatchOptions() :
+            workers(0),
+            min_split_frames(4),
+            output_folder("batch_results"),
+            image_cache_mb(4096),
+            parallel_stereo(false),
+            tracking(false) {}
+};
+
+/* How one job went, times are wall clock from the start of run() */
+struct BatchJobStats {
+    std::string directory;
+    std::string name;
+    int_t frames;
+    long frames_done;
+    /* sessions that worked on the job, more than one if it was split */
+    int sessions;
+    /* frames correlated by sessions split off the first one */
+    long frames_stolen;
+    /* sessions whose setup restored the cross-correlation instead of running it */
+    int cross_correlation_cached;
+    double setup_ms;
+    double frame_ms;
+    double start_ms;
+    double end_ms;
+    bool failed_step;
+    std::string error;
+
+    BatchJobStats() :
+            frames(0),
+            frames_done(0),
+            sessions(0),
+            frames_stolen(0),
+            cross_correlation_cached(0),
+            setup_ms(0.0),
+            frame_ms(0.0),
+            start_ms(0.0),
+            end_ms(0.0),
+            failed_step(false) {}
+
+    double wall_ms() const { return end_ms > start_ms ? end_ms - start_ms : 0.0; }
+
+    double frames_per_second() const { return wall_ms() > 0.0 ? 1000.0 * frames_done / wall_ms() : 0.0; }
+};
+
+/**
+ * Runs many recorded datasets (directories laid out like FirstTest, with input.xml, params.xml,
+ * cal.xml and the images) concurrently. Every worker has a deque of jobs; it works
+ * on its own from the back and, when that is empty, steals a job that has not started from the
+ * front of another worker's deque. With nothing left to start, an idle worker splits the running
+ * job with the most frames to go: it takes the second half of the remaining frames and correlates
+ * them with a session of its own, so one long sequence does not hold up the end of the batch while
+ * the other cores sit idle. A split session starts from the same reference as the first, which
+ * the incremental formulation does not allow, so those jobs are never split.
+ *
+ * DICe and Teuchos make no promise that several Schemas can run side by side in one process, so
+ * the workers only schedule: each lane is a session in a masters_batch --lane process of its own
+ * (see serve_lane()), started by the worker that takes it and told over a pipe which frame to
+ * correlate next. A lane that crashes takes only its own job down. The lanes share the
+ * cross-correlation cache through its folder, so a split session (or a job with the same
+ * reference pair and inputs) restores the cross-correlation instead of running it again; the
+ * calibration cache lives in each lane, every session parses its cal.xml. The relative paths in
+ * each input.xml are resolved against its directory, nothing depends on the working directory.
+ * The sessions leave Teuchos' timers alone, there is no timing file per job; the times of each
+ * job are in its BatchJobStats.
+ */
+class BatchRunner {
+public:
+    explicit BatchRunner(const BatchOptions &options);
+
+    /** Queue the dataset in directory, false if it has no input.xml */
+    bool add_job(const std::string &directory);
+
+    /** Correlate every job, true if all of them finished without an error or a failed step */
+    bool run();
+
+    const std::vector<BatchJobStats> &job_stats() const { return stats_; }
+
+    double wall_ms() const { return wall_ms_; }
+
+    /** Time the workers spent in setup or on a frame over the time they were there */
+    double worker_utilisation() const;
+
+    /** Summed over the lanes */
+    CalibrationCacheStats calibration_stats() const;
+
+    /** One line per job with its throughput, then the totals */
+    void print_summary(std::ostream &os) const;
+
+    /** The directories named by each argument, shell style wildcards expanded, in argument order */
+    static std::vector<std::string> expand_job_directories(const std::vector<std::string> &patterns);
+
+    /**
+     * The lane process end: correlates the one job added to this runner, writing to output_folder
+     * and numbering from offset, frame by frame as the worker on the other end of read_fd/write_fd
+     * asks for them. The exit code for masters_batch.
+     */
+    int serve_lane(const std::string &output_folder, int_t offset, int read_fd, int write_fd);
+
+private:
+    struct Job {
+        std::string input_file;
+        Teuchos::RCP<Teuchos::ParameterList> overrides;
+        bool splittable;
+    };
+
+    /* One session working through the image indices [next, end) of a job */
+    struct Lane {
+        size_t job;
+        int_t next;
+        int_t end;
+        /* frames before next when the lane was made, the output numbering starts after them */
+        int_t offset;
+        bool running;
+        /* set up and correlating, only then can it be split */
+        bool ready;
+    };
+
+    void worker_loop(size_t worker);
+
+    /** Own deque, then another worker's, then a split. NULL once there is nothing left, with mutex_ held */
+    Lane *take(size_t worker);
+
+    /** Second half of the remaining frames of the running lane with the most to go, with mutex_ held */
+    Lane *split(size_t worker);
+
+    void run_lane(Lane &lane);
+
+    /** masters_batch with the options and the --lane arguments for lane, the pipe ends still to add */
+    std::vector<std::string> lane_arguments(const Lane &lane) const;
+
+    double now_ms() const;
+
+    BatchOptions options_;
+    std::vector<Job> jobs_;
+    std::vector<BatchJobStats> stats_;
+    std::vector<std::unique_ptr<Lane> > lanes_;
+    std::vector<std::deque<Lane *> > queues_;
+    /* lanes a worker is setting up or correlating */
+    size_t active_lanes_;
+    /* one lock for the scheduler state, a frame takes far longer than it is held */
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    /* the caches of a lane process */
+    Teuchos::RCP<CalibrationCache> calibration_cache_;
+    Teuchos::RCP<CrossCorrelationCache> cross_cache_;
+    /* what the lanes reported when they finished */
+    CalibrationCacheStats calibration_stats_;
+    /* the masters_batch the lanes are started from */
+    std::string worker_program_;
+    std::chrono::steady_clock::time_point start_;
+    double wall_ms_;
+    double busy_ms_;
+    size_t num_workers_;
+};
+
+#endif //CUSTOM_APP_BATCHRUNNER_H
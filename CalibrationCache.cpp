@@ -0,0 +1,44 @@
+#include "CalibrationCache.h"
+
+#include "FileHash.h"
+
+using namespace std;
+
+Teuchos::RCP<DICe::Triangulation> CalibrationCache::acquire(const string &cal_file_name) {
+    const uint64_t key = hash_file(cal_file_name);
+    {
+        lock_guard<mutex> lock(mutex_);
+        vector<Teuchos::RCP<DICe::Triangulation> > &idle = idle_[key];
+        // an unreadable file hashes to the seed, it must not stand in for the next one
+        if (key != FNV_OFFSET_BASIS && !idle.empty()) {
+            Teuchos::RCP<DICe::Triangulation> triangulation = idle.back();
+            idle.pop_back();
+            lent_[triangulation.get()] = key;
+            ++stats_.hits;
+            return triangulation;
+        }
+    }
+    // parsed without the lock, sessions starting together on the same file each get their own
+    Teuchos::RCP<DICe::Triangulation> triangulation = Teuchos::rcp(new DICe::Triangulation(cal_file_name));
+    lock_guard<mutex> lock(mutex_);
+    ++stats_.loads;
+    if (key != FNV_OFFSET_BASIS)
+        lent_[triangulation.get()] = key;
+    return triangulation;
+}
+
+void CalibrationCache::release(Teuchos::RCP<DICe::Triangulation> &triangulation) {
+    lock_guard<mutex> lock(mutex_);
+    map<const DICe::Triangulation *, uint64_t>::iterator it = lent_.find(triangulation.get());
+    if (it != lent_.end()) {
+        // the count only changes with the lock held, the caller's reference is dropped below
+        idle_[it->second].push_back(triangulation);
+        lent_.erase(it);
+    }
+    triangulation = Teuchos::null;
+}
+
+CalibrationCacheStats CalibrationCache::stats() const {
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,48 @@
+#ifndef CUSTOM_APP_CALIBRATIONCACHE_H
+#define CUSTOM_APP_CALIBRATIONCACHE_H
+
+#include <DICe.h>
+#include <DICe_Triangulation.h>
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <Teuchos_RCP.hpp>
+
+struct CalibrationCacheStats {
+    size_t loads;
+    size_t hits;
+
+    CalibrationCacheStats() : loads(0), hits(0) {}
+};
+
+/**
+ * Parsed DICe::Triangulations by calibration file content, so a session does not parse a cal.xml
+ * another session with the same file already parsed. A triangulation is lent to one session at a
+ * time: DICe keeps state in it during the cross-correlation and its RCP count is not atomic, so
+ * two sessions never hold the same one. A session hands it back when it is done and the next one
+ * with the same file takes it over. Safe to share between threads.
+ */
+class CalibrationCache {
+public:
+    /** A triangulation for cal_file_name no other session holds, parsed only if none is idle */
+    Teuchos::RCP<DICe::Triangulation> acquire(const std::string &cal_file_name);
+
+    /** Hand back a triangulation from acquire(), the caller must not use it afterwards */
+    void release(Teuchos::RCP<DICe::Triangulation> &triangulation);
+
+    CalibrationCacheStats stats() const;
+
+private:
+    std::map<uint64_t, std::vector<Teuchos::RCP<DICe::Triangulation> > > idle_;
+    /* content hash of every triangulation out on loan */
+    std::map<const DICe::Triangulation *, uint64_t> lent_;
+    CalibrationCacheStats stats_;
+    mutable std::mutex mutex_;
+};
+
+#endif //CUSTOM_APP_CALIBRATIONCACHE_H
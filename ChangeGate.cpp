@@ -0,0 +1,94 @@
+#include "ChangeGate.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+/* the threshold is in 8 bit grey levels, scale the differences of deeper images down to match */
+static double grey_level_scale(const cv::Mat &frame) {
+    return frame.depth() == CV_16U ? 1.0 / 257.0 : 1.0;
+}
+
+ChangeGate::ChangeGate() :
+        threshold_(0.0),
+        subset_dim_(0) {}
+
+void ChangeGate::configure(double threshold) {
+    threshold_ = std::max(0.0, threshold);
+}
+
+void ChangeGate::reset(size_t num_subsets, int_t subset_dim) {
+    subset_dim_ = subset_dim;
+    windows_[0].release();
+    windows_[1].release();
+    stored_.assign(num_subsets, 0);
+    skip_.assign(num_subsets, 0);
+    stats_ = ChangeGateStats();
+}
+
+cv::Rect ChangeGate::window(const cv::Point &centre) const {
+    return cv::Rect(centre.x - subset_dim_ / 2, centre.y - subset_dim_ / 2, subset_dim_, subset_dim_);
+}
+
+bool ChangeGate::unchanged(int side, const GateView &view, size_t subset) const {
+    const cv::Rect box = window(view.centres[subset]);
+    if (box.x < 0 || box.y < 0 || box.x + box.width > view.frame.cols || box.y + box.height > view.frame.rows)
+        return false;
+    const cv::Mat stored = windows_[side].row(subset).reshape(0, subset_dim_);
+    const double difference = cv::norm(view.frame(box), stored, cv::NORM_L1);
+    return difference * grey_level_scale(view.frame) <= threshold_ * box.area() * view.frame.channels();
+}
+
+bool ChangeGate::store(int side, const GateView &view, size_t subset) {
+    const cv::Rect box = window(view.centres[subset]);
+    // a window off the edge cannot be compared, the subset is solved every frame
+    if (box.x < 0 || box.y < 0 || box.x + box.width > view.frame.cols || box.y + box.height > view.frame.rows)
+        return false;
+    cv::Mat stored = windows_[side].row(subset).reshape(0, subset_dim_);
+    view.frame(box).copyTo(stored);
+    return true;
+}
+
+void ChangeGate::plan(const GateView &left, const GateView &right) {
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    std::fill(skip_.begin(), skip_.end(), 0);
+    const bool stereo = !right.frame.empty();
+    // a new camera mode or depth makes every stored window useless
+    if (windows_[0].type() != left.frame.type() || (stereo && windows_[1].type() != right.frame.type()))
+        std::fill(stored_.begin(), stored_.end(), 0);
+    int_t carried = 0;
+    for (size_t subset = 0; subset < skip_.size(); ++subset) {
+        if (!stored_[subset] || !unchanged(0, left, subset) || (stereo && !unchanged(1, right, subset)))
+            continue;
+        skip_[subset] = 1;
+        ++carried;
+    }
+    const double gate_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    ++stats_.frames;
+    stats_.last_carried = carried;
+    stats_.last_solved = (int_t) skip_.size() - carried;
+    stats_.subsets_carried += carried;
+    stats_.subsets_solved += stats_.last_solved;
+    stats_.last_gate_ms = gate_ms;
+    stats_.total_gate_ms += gate_ms;
+}
+
+void ChangeGate::record(const GateView &left, const GateView &right, const vector<int_t> &skipped) {
+    const bool stereo = !right.frame.empty();
+    const int rows = (int) stored_.size();
+    const int cols = subset_dim_ * subset_dim_;
+    if (windows_[0].type() != left.frame.type() || windows_[0].rows != rows) {
+        windows_[0].create(rows, cols, left.frame.type());
+        std::fill(stored_.begin(), stored_.end(), 0);
+    }
+    if (stereo && (windows_[1].type() != right.frame.type() || windows_[1].rows != rows)) {
+        windows_[1].create(rows, cols, right.frame.type());
+        std::fill(stored_.begin(), stored_.end(), 0);
+    }
+    for (size_t subset = 0; subset < stored_.size(); ++subset) {
+        if (skipped[subset])
+            continue;
+        stored_[subset] = store(0, left, subset) && (!stereo || store(1, right, subset));
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef CUSTOM_APP_CHANGEGATE_H
+#define CUSTOM_APP_CHANGEGATE_H
+
+#include <DICe.h>
+
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/* Subsets carried over and re-solved since the last reset() */
+struct ChangeGateStats {
+    long frames;
+    long subsets_carried;
+    long subsets_solved;
+    int_t last_carried;
+    int_t last_solved;
+    double last_gate_ms;
+    double total_gate_ms;
+
+    ChangeGateStats() :
+            frames(0),
+            subsets_carried(0),
+            subsets_solved(0),
+            last_carried(0),
+            last_solved(0),
+            last_gate_ms(0.0),
+            total_gate_ms(0.0) {}
+
+    double carried_fraction() const {
+        return subsets_carried + subsets_solved > 0 ? (double) subsets_carried / (subsets_carried + subsets_solved)
+                                                    : 0.0;
+    }
+};
+
+/* One camera's side of a frame: the image handed to DICe and the centre of each local subset in it */
+struct GateView {
+    cv::Mat frame;
+    std::vector<cv::Point> centres;
+};
+
+/**
+ * Skips subsets whose image has not changed. Each subset keeps the window it was last solved on,
+ * per camera; a new frame compares the window at the same place with it and, if the mean
+ * absolute difference stays at or under the threshold on both cameras, the subset keeps its
+ * last solution instead of going through the solver again. The comparison is cv::norm(NORM_L1),
+ * which OpenCV vectorises, so the gate costs a small fraction of one solver iteration.
+ */
+class ChangeGate {
+public:
+    ChangeGate();
+
+    /** Mean absolute difference per pixel, in 8 bit grey levels, still counted as unchanged. Zero turns it off */
+    void configure(double threshold);
+
+    double threshold() const { return threshold_; }
+
+    bool enabled() const { return threshold_ > 0.0; }
+
+    /** Forget every stored window, the next frame solves all num_subsets subsets */
+    void reset(size_t num_subsets, int_t subset_dim);
+
+    /** Compare the frame with the stored windows and fill skip_flags(). right.frame is empty for 2D */
+    void plan(const GateView &left, const GateView &right);
+
+    /** 1 for every local subset the last plan() carried over */
+    std::vector<int_t> &skip_flags() { return skip_; }
+
+    /** Store the windows of every subset solved this frame, skipped has 1 for the ones that were not */
+    void record(const GateView &left, const GateView &right, const std::vector<int_t> &skipped);
+
+    /** The solution of subset is no good to carry, e.g. its track was lost: solve it next frame */
+    void invalidate(size_t subset) { stored_[subset] = 0; }
+
+    const ChangeGateStats &stats() const { return stats_; }
+
+private:
+    cv::Rect window(const cv::Point &centre) const;
+
+    bool unchanged(int side, const GateView &view, size_t subset) const;
+
+    bool store(int side, const GateView &view, size_t subset);
+
+    double threshold_;
+    int_t subset_dim_;
+    /* row i holds the window subset i was last solved on, flattened */
+    cv::Mat windows_[2];
+    std::vector<char> stored_;
+    std::vector<int_t> skip_;
+    ChangeGateStats stats_;
+};
+
+#endif //CUSTOM_APP_CHANGEGATE_H
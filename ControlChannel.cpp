@@ -0,0 +1,224 @@
+#include "ControlChannel.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+/* written by the handlers, read and cleared by the one ControlChannel */
+static volatile sig_atomic_t signal_start = 0;
+static volatile sig_atomic_t signal_stop = 0;
+static volatile sig_atomic_t signal_reference = 0;
+static volatile sig_atomic_t signal_quit = 0;
+
+static const int CONTROL_SIGNALS[] = {SIGUSR1, SIGUSR2, SIGHUP, SIGINT, SIGTERM};
+static const size_t NUM_CONTROL_SIGNALS = sizeof(CONTROL_SIGNALS) / sizeof(CONTROL_SIGNALS[0]);
+static struct sigaction previous_actions[NUM_CONTROL_SIGNALS];
+
+static void control_signal(int signal_number) {
+    switch (signal_number) {
+        case SIGUSR1:
+            signal_start = 1;
+            break;
+        case SIGUSR2:
+            signal_stop = 1;
+            break;
+        case SIGHUP:
+            signal_reference = 1;
+            break;
+        default:
+            signal_quit = 1;
+    }
+}
+
+const char *control_command_name(ControlCommand command) {
+    switch (command) {
+        case CONTROL_START:
+            return "start";
+        case CONTROL_STOP:
+            return "stop";
+        case CONTROL_REFERENCE:
+            return "reference";
+        case CONTROL_QUIT:
+            return "quit";
+        default:
+            return "none";
+    }
+}
+
+static ControlCommand parse_command(string line) {
+    while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' '))
+        line.erase(line.size() - 1);
+    if (line == "start" || line == "r")
+        return CONTROL_START;
+    if (line == "stop")
+        return CONTROL_STOP;
+    if (line == "reference" || line == "i")
+        return CONTROL_REFERENCE;
+    if (line == "quit" || line == "q")
+        return CONTROL_QUIT;
+    return CONTROL_NONE;
+}
+
+ControlChannel::ControlChannel() :
+        listener_(-1),
+        signals_installed_(false) {}
+
+ControlChannel::~ControlChannel() {
+    for (size_t client = clients_.size(); client > 0; --client)
+        close_client(client - 1);
+    if (listener_ >= 0) {
+        close(listener_);
+        unlink(path_.c_str());
+    }
+    if (signals_installed_)
+        for (size_t i = 0; i < NUM_CONTROL_SIGNALS; ++i)
+            sigaction(CONTROL_SIGNALS[i], &previous_actions[i], NULL);
+}
+
+void ControlChannel::install_signals() {
+    if (signals_installed_)
+        return;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = control_signal;
+    sigemptyset(&action.sa_mask);
+    // no SA_RESTART, a blocking poll() should return to look at the flags
+    action.sa_flags = 0;
+    for (size_t i = 0; i < NUM_CONTROL_SIGNALS; ++i)
+        sigaction(CONTROL_SIGNALS[i], &action, &previous_actions[i]);
+    // a client hanging up while we answer must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    signals_installed_ = true;
+}
+
+bool ControlChannel::listen(const string &path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (path.size() >= sizeof(address.sun_path))
+        return false;
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return false;
+    // the socket file of a previous run that did not exit cleanly
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(listener, 4) != 0) {
+        close(listener);
+        return false;
+    }
+    listener_ = listener;
+    path_ = path;
+    return true;
+}
+
+ControlCommand ControlChannel::pending_signal() {
+    // quit first, a stop and a quit in the same poll still quit
+    if (signal_quit) {
+        signal_quit = 0;
+        return CONTROL_QUIT;
+    }
+    if (signal_reference) {
+        signal_reference = 0;
+        return CONTROL_REFERENCE;
+    }
+    if (signal_stop) {
+        signal_stop = 0;
+        return CONTROL_STOP;
+    }
+    if (signal_start) {
+        signal_start = 0;
+        return CONTROL_START;
+    }
+    return CONTROL_NONE;
+}
+
+void ControlChannel::close_client(size_t client) {
+    close(clients_[client]);
+    clients_.erase(clients_.begin() + client);
+    buffers_.erase(buffers_.begin() + client);
+}
+
+ControlCommand ControlChannel::read_client(size_t client) {
+    string &buffer = buffers_[client];
+    size_t end = buffer.find('\n');
+    if (end == string::npos) {
+        char received[256];
+        const ssize_t count = read(clients_[client], received, sizeof(received));
+        if (count <= 0) {
+            if (count == 0 || (errno != EINTR && errno != EAGAIN))
+                close_client(client);
+            return CONTROL_NONE;
+        }
+        buffer.append(received, count);
+        end = buffer.find('\n');
+        if (end == string::npos) {
+            // nobody sends a command this long, drop the client rather than buffer forever
+            if (buffer.size() > 1024)
+                close_client(client);
+            return CONTROL_NONE;
+        }
+    }
+    const ControlCommand command = parse_command(buffer.substr(0, end));
+    buffer.erase(0, end + 1);
+    const char *answer = command == CONTROL_NONE ? "unknown\n" : "ok\n";
+    if (write(clients_[client], answer, strlen(answer)) < 0)
+        close_client(client);
+    return command;
+}
+
+ControlCommand ControlChannel::next(int timeout_ms) {
+    ControlCommand command = pending_signal();
+    if (command != CONTROL_NONE)
+        return command;
+    // a line already buffered from an earlier read
+    for (size_t client = 0; client < clients_.size(); ++client)
+        if (buffers_[client].find('\n') != string::npos)
+            return read_client(client);
+
+    vector<pollfd> descriptors;
+    if (listener_ >= 0) {
+        pollfd listener = {listener_, POLLIN, 0};
+        descriptors.push_back(listener);
+    }
+    for (size_t client = 0; client < clients_.size(); ++client) {
+        pollfd descriptor = {clients_[client], POLLIN, 0};
+        descriptors.push_back(descriptor);
+    }
+    if (descriptors.empty()) {
+        // signals only, a sleep that a signal cuts short
+        usleep(timeout_ms * 1000);
+        return pending_signal();
+    }
+    if (poll(&descriptors[0], descriptors.size(), timeout_ms) <= 0)
+        return pending_signal();
+
+    size_t first_client = 0;
+    if (listener_ >= 0) {
+        first_client = 1;
+        if (descriptors[0].revents & POLLIN) {
+            const int client = accept(listener_, NULL, NULL);
+            if (client >= 0) {
+                clients_.push_back(client);
+                buffers_.push_back(string());
+            }
+        }
+    }
+    // back to front so closing a client does not shift the ones still to look at
+    for (size_t i = descriptors.size(); i > first_client; --i) {
+        if (descriptors[i - 1].revents == 0)
+            continue;
+        command = read_client(i - 1 - first_client);
+        if (command != CONTROL_NONE)
+            return command;
+    }
+    return pending_signal();
+}
@@ -0,0 +1,60 @@
+#ifndef CUSTOM_APP_CONTROLCHANNEL_H
+#define CUSTOM_APP_CONTROLCHANNEL_H
+
+#include <string>
+#include <vector>
+
+enum ControlCommand {
+    CONTROL_NONE,
+    /* start correlating, the GUI's 'r' */
+    CONTROL_START,
+    /* keep capturing but stop correlating */
+    CONTROL_STOP,
+    /* take the newest pair as the new reference, the GUI's 'i' */
+    CONTROL_REFERENCE,
+    CONTROL_QUIT
+};
+
+/**
+ * Commands for a headless run, which has no window to take keys from. Signals always work:
+ * SIGUSR1 starts, SIGUSR2 stops, SIGHUP re-references, SIGINT and SIGTERM quit. With a socket
+ * path a local stream socket also takes one command per line, "start", "stop", "reference" or
+ * "quit", and answers "ok" or "unknown".
+ */
+class ControlChannel {
+public:
+    ControlChannel();
+
+    /** Puts the previous signal handlers back and removes the socket */
+    ~ControlChannel();
+
+    void install_signals();
+
+    /** Listen on a Unix domain socket at path, false if it cannot be bound */
+    bool listen(const std::string &path);
+
+    /** The next pending command, waiting up to timeout_ms for one */
+    ControlCommand next(int timeout_ms);
+
+private:
+    ControlChannel(const ControlChannel &);
+
+    ControlChannel &operator=(const ControlChannel &);
+
+    ControlCommand pending_signal();
+
+    ControlCommand read_client(size_t client);
+
+    void close_client(size_t client);
+
+    int listener_;
+    std::string path_;
+    /* connected clients and what each has sent past its last full line */
+    std::vector<int> clients_;
+    std::vector<std::string> buffers_;
+    bool signals_installed_;
+};
+
+const char *control_command_name(ControlCommand command);
+
+#endif //CUSTOM_APP_CONTROLCHANNEL_H
@@ -0,0 +1,1309 @@
+#include <DICe.h>
+#include <DICe_Parser.h>
+#include <DICe_Image.h>
+#include <DICe_ImageIO.h>
+#include <DICe_Schema.h>
+#include <DICe_Triangulation.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <Teuchos_TimeMonitor.hpp>
+#include <Teuchos_XMLParameterListHelpers.hpp>
+
+#include "SubSetData.h"
+#include "CorrelationSession.h"
+#include "FileHash.h"
+#include "ProcessGroup.h"
+#include "StageProbe.h"
+
+using namespace DICe::field_enums;
+using namespace DICe;
+using namespace std;
+
+/**
+ * Start a whole bunch of metrics to see how long stuff takes!!
+ */
+static Teuchos::RCP<Teuchos::Time> total_time = Teuchos::TimeMonitor::getNewCounter("## Total Time ##");
+static Teuchos::RCP<Teuchos::Time> setup_time = Teuchos::TimeMonitor::getNewCounter("Setup");
+static Teuchos::RCP<Teuchos::Time> cross_time = Teuchos::TimeMonitor::getNewCounter("Cross-correlation");
+static Teuchos::RCP<Teuchos::Time> corr_time = Teuchos::TimeMonitor::getNewCounter("Correlation");
+static Teuchos::RCP<Teuchos::Time> write_time = Teuchos::TimeMonitor::getNewCounter("Write Output");
+
+/* A TimeMonitor on one of the counters above, or nothing for a session that leaves them alone */
+class SessionTimer {
+public:
+    SessionTimer(const Teuchos::RCP<Teuchos::Time> &counter, bool enabled) {
+        if (enabled)
+            monitor_ = Teuchos::rcp(new Teuchos::TimeMonitor(*counter));
+    }
+
+private:
+    Teuchos::RCP<Teuchos::TimeMonitor> monitor_;
+};
+
+/* What rank 0 is about to do, sent ahead of each collective session call */
+enum SessionCommand {
+    COMMAND_RELEASE = 0,
+    COMMAND_SETUP,
+    COMMAND_RESET,
+    COMMAND_CORRELATE_FILES,
+    COMMAND_CORRELATE_IMAGES,
+    COMMAND_FINISH
+};
+
+static double elapsed_ms(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+CorrelationSession::CorrelationSession(const std::string &input_file,
+                                       const Teuchos::RCP<Teuchos::ParameterList> &overrides) :
+        input_file_(input_file),
+        overrides_(overrides),
+        is_setup_(false),
+        frame_count_(0),
+        setup_time_ms_(0.0),
+        last_frame_time_ms_(0.0),
+        cross_cache_(Teuchos::rcp(new CrossCorrelationCache())),
+        frame_offset_(0),
+        global_timers_(true),
+        cross_correlation_cached_(false),
+        parallel_stereo_(true),
+        tracking_(false),
+        tracking_gamma_threshold_(0.5),
+        async_output_(false),
+        queued_output_(false),
+        output_format_(RESULT_TEXT),
+        roi_crop_(false),
+        roi_margin_(32),
+        roi_padding_(0),
+        roi_pixels_(0.0),
+        frame_pixels_(0.0),
+        prefetch_lookahead_(0),
+        prefetch_memory_cap_mb_(512),
+        deadline_ms_(0.0),
+        applied_iteration_cap_(0),
+        change_threshold_(0.0),
+        pyramid_levels_(0),
+        pyramid_search_radius_(8) {
+    outStream = Teuchos::rcp(&std::cout, false);
+    main_data_.num_frames = 0;
+    main_data_.is_stereo = false;
+    main_data_.separate_output_file_for_each_subset = false;
+    main_data_.separate_header_file = false;
+    main_data_.proc_size = 1;
+    main_data_.proc_rank = 0;
+}
+
+CorrelationSession::~CorrelationSession() {
+    release_triangulation();
+}
+
+void CorrelationSession::setup() {
+    lead(COMMAND_SETUP);
+    SessionTimer total_time_monitor(total_time, global_timers_);
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    times_ = SessionTimes();
+    tracking_stats_ = TrackingStats();
+    pyramid_stats_ = PyramidStats();
+    {
+        SessionTimer setup_time_monitor(setup_time, global_timers_);
+        information_extraction();
+        times_.setup_ms = elapsed_ms(start);
+        const chrono::steady_clock::time_point cross_start = chrono::steady_clock::now();
+        run_cross_correlation();
+        times_.cross_correlation_ms = elapsed_ms(cross_start);
+    }
+    prepare_deadline();
+    prepare_change_gate();
+    queued_output_ = async_output_ || output_format_ == RESULT_BINARY || deadline_ms_ > 0.0 || change_gate_.enabled();
+    if (queued_output_ && output_format_ == RESULT_TEXT && main_data_.separate_output_file_for_each_subset) {
+        // the writer only knows the one file per frame layout, the extra columns are left out
+        *outStream << "Output is one file per subset, DICe writes it on the correlation thread" << std::endl;
+        queued_output_ = false;
+    }
+    if (queued_output_) {
+        prepare_async_output();
+        if (output_format_ == RESULT_TEXT)
+            *outStream << "Text output is one file per frame without DICe's run information" << std::endl;
+    } else if (result_writer_ != Teuchos::null)
+        result_writer_->flush();
+    prepare_roi();
+    // the image lists may have changed, the next correlate_frame() starts a new read-ahead
+    prefetcher_ = Teuchos::null;
+    left_lost_.clear();
+    right_lost_.clear();
+    if (tracking_) {
+        // nothing to start from yet, the first frame is seeded by feature matching (or the pyramids) everywhere
+        if (!pyramid_initializer_.enabled())
+            left_reseeder_.set_reference(cv::imread(image_files_[0], cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH));
+        left_lost_.assign(schema_->local_num_subsets(), 1);
+        if (main_data_.is_stereo) {
+            if (!pyramid_initializer_.enabled())
+                right_reseeder_.set_reference(stereo_remap_.ready() ? projected_right_reference_ :
+                                              cv::imread(stereo_image_files_[0],
+                                                         cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH));
+            right_lost_.assign(stereo_schema_->local_num_subsets(), 1);
+        }
+    }
+    frame_count_ = 0;
+    is_setup_ = true;
+    setup_time_ms_ = elapsed_ms(start);
+    *outStream << "\n--- Session set up in " << setup_time_ms_ << " ms ---\n" << std::endl;
+}
+
+void CorrelationSession::reset() {
+    lead(COMMAND_RESET);
+    schema_ = Teuchos::null;
+    stereo_schema_ = Teuchos::null;
+    release_triangulation();
+    frame_count_ = 0;
+    is_setup_ = false;
+}
+
+void CorrelationSession::release_triangulation() {
+    if (calibration_cache_ != Teuchos::null && triangulation_ != Teuchos::null)
+        calibration_cache_->release(triangulation_);
+    triangulation_ = Teuchos::null;
+}
+
+bool CorrelationSession::read_input_data_files() {
+    /**
+     * Get all of the input parameters from the input files.
+     */
+    input_params_ = Teuchos::rcp(new Teuchos::ParameterList());
+    Teuchos::Ptr<Teuchos::ParameterList> inputParamsPtr(input_params_.get());
+    Teuchos::updateParametersFromXmlFile(input_file_, inputParamsPtr);
+    if (overrides_ != Teuchos::null)
+        input_params_->setParameters(*overrides_);
+    TEUCHOS_TEST_FOR_EXCEPTION(input_params_ == Teuchos::null, std::runtime_error, "");
+
+    *outStream << "Input Parameters: " << std::endl;
+    input_params_->print(*outStream);
+    *outStream << "\n--- Input read successfully ---\n" << std::endl;
+
+    /**
+     * Get all of the correlation parameters from the input files.
+     */
+    bool is_error_est_run = false;
+    if (input_params_->isParameter(DICe::correlation_parameters_file)) {
+        const std::string paramsFileName = input_params_->get<std::string>(DICe::correlation_parameters_file);
+        correlation_params_ = DICe::read_correlation_params(paramsFileName);
+        *outStream << "User specified correlation Parameters: " << std::endl;
+        correlation_params_->print(*outStream);
+        is_error_est_run = correlation_params_->get<bool>(DICe::estimate_resolution_error, false);
+        if (is_error_est_run) {
+            // force the computing of the image laplacian for the reference image:
+            correlation_params_->set(DICe::compute_laplacian_image, true);
+        }
+        *outStream << "\n--- Correlation parameters read successfully ---\n" << std::endl;
+    } else {
+        *outStream << "Correlation parameters not specified by user" << std::endl;
+    }
+    if (tracking_) {
+        if (correlation_params_ == Teuchos::null)
+            correlation_params_ = Teuchos::rcp(new Teuchos::ParameterList());
+        // lost subsets are reseeded by the session, everything else starts from the last frame
+        correlation_params_->set(DICe::initialization_method, DICe::USE_FIELD_VALUES);
+        *outStream << "Tracking mode, each frame is initialized from the previous solution" << std::endl;
+    }
+    pyramid_initializer_.configure(0, pyramid_search_radius_);
+    if (pyramid_levels_ > 0) {
+        if (correlation_params_ == Teuchos::null)
+            correlation_params_ = Teuchos::rcp(new Teuchos::ParameterList());
+        if (correlation_params_->get<bool>(DICe::use_incremental_formulation, false)) {
+            *outStream << "The pyramid initializer is off, the incremental formulation moves the reference every frame"
+                       << std::endl;
+        } else {
+            pyramid_initializer_.configure(pyramid_levels_, pyramid_search_radius_);
+            // the session writes the starting displacements, DICe takes them from the fields
+            correlation_params_->set(DICe::initialization_method, DICe::USE_FIELD_VALUES);
+            *outStream << "Subsets are initialized by a " << pyramid_levels_ << " level pyramid search" << std::endl;
+        }
+    }
+
+    return is_error_est_run;
+}
+
+void CorrelationSession::information_extraction() {
+    const int_t proc_size = process_size();
+    const int_t proc_rank = process_rank();
+    // only print output if this is process zero
+    if (proc_rank == 0)
+        outStream = Teuchos::rcp(&std::cout, false);
+    else
+        outStream = Teuchos::rcp(&blackhole_, false);
+
+    *outStream << "Start of process." << std::endl;
+    if (proc_size > 1)
+        *outStream << "Subsets are split over " << proc_size << " processes" << std::endl;
+
+    if (proc_rank == 0) {
+        DEBUG_MSG("Parsing command line options");
+    }
+
+    /******* Get the input parameters */
+    read_input_data_files();
+
+    /******* Decipher the image file names (note: zero entry is the reference image) */
+    image_files_.clear();
+    stereo_image_files_.clear();
+    DICe::decipher_image_file_names(input_params_, image_files_, stereo_image_files_);
+    const bool is_stereo = stereo_image_files_.size() > 0;
+
+    /******* Create the list of images */
+    const int_t num_frames = image_files_.size() - 1;
+    int_t first_frame_id = 0;
+    int_t image_width = 0;
+    int_t image_height = 0;
+
+    TEUCHOS_TEST_FOR_EXCEPTION(num_frames <= 0, std::runtime_error, "");
+    *outStream << "Reference image: " << image_files_[0] << std::endl;
+    for (int_t i = 1; i <= num_frames; ++i) {
+        if (i == 10 && num_frames != 10) *outStream << "..." << std::endl;
+        else if (i > 10 && i < num_frames) continue;
+        else
+            *outStream << "Deformed image: " << image_files_[i] << std::endl;
+    }
+    *outStream << "\n--- List of images constructed successfuly ---\n" << std::endl;
+
+    /******* Get the size of the images being used */
+    utils::read_image_dimensions(image_files_[0].c_str(), image_width, image_height);
+    *outStream << "Image dimensions: " << image_width << " x " << image_height << std::endl;
+
+    /******* Where are we going to put the output information */
+    const std::string output_folder = input_params_->get<std::string>(DICe::output_folder, "");
+    const bool separate_output_file_for_each_subset = input_params_->get<bool>(
+            DICe::separate_output_file_for_each_subset, false);
+    if (separate_output_file_for_each_subset) {
+        *outStream << "Output will be written to separate output files for each subset" << std::endl;
+    } else {
+        *outStream << "Output will be written to one file per frame with all subsets included" << std::endl;
+    }
+    const bool separate_header_file = input_params_->get<bool>(DICe::create_separate_run_info_file, false);
+    if (separate_header_file) {
+        *outStream
+                << "Execution information will be written to a separate file (not placed in the output headers)"
+                << std::endl;
+    }
+
+    /******* create schemas: */
+    schema_ = Teuchos::rcp(new DICe::Schema(input_params_, correlation_params_));
+    // let the schema know how many images there are in the sequence and the first frame id:
+    schema_->set_frame_range(first_frame_id + frame_offset_, num_frames);
+
+    /******* Set up the subsets */
+    *outStream << "Number of global subsets: " << schema_->global_num_subsets() << std::endl;
+    // the display needs every subset, the coordinates of the ones owned by other ranks are gathered on rank 0
+    local_ids_.resize(schema_->local_num_subsets());
+    for (int_t i = 0; i < schema_->local_num_subsets(); ++i)
+        local_ids_[i] = schema_->subset_global_id(i);
+    std::vector<scalar_t> coordinates_x;
+    std::vector<scalar_t> coordinates_y;
+    gather_subset_field(schema_->mesh()->get_field_spec("COORDINATE_X"), coordinates_x);
+    gather_subset_field(schema_->mesh()->get_field_spec("COORDINATE_Y"), coordinates_y);
+    subsets_.clear();
+    subsets_.resize(coordinates_x.size());
+    subsets_.subset_size = schema_->subset_dim();
+    for (size_t i = 0; i < coordinates_x.size(); ++i) {
+        subsets_.x_coord[i] = (int) coordinates_x[i];
+        subsets_.y_coord[i] = (int) coordinates_y[i];
+    }
+    for (int_t i = 0; i < schema_->local_num_subsets(); ++i) {
+        if (i == 10 && schema_->local_num_subsets() != 11) *outStream << "..." << std::endl;
+        else if (i > 10 && i < schema_->local_num_subsets() - 1) continue;
+        else
+            *outStream << "Proc " << proc_rank << ": subset global id: " << schema_->subset_global_id(i) << " global coordinates ("
+                       << schema_->local_field_value(i, DICe::field_enums::SUBSET_COORDINATES_X_FS) <<
+                       "," << schema_->local_field_value(i, DICe::field_enums::SUBSET_COORDINATES_Y_FS) << ")"
+                       << std::endl;
+    }
+    *outStream << std::endl;
+
+    std::string file_prefix = input_params_->get<std::string>(DICe::output_prefix, "DICe_solution");
+    std::string stereo_file_prefix = input_params_->get<std::string>(DICe::output_prefix, "DICe_solution");
+    stereo_file_prefix += "_stereo";
+
+    // for backwards compatibility allow the user to specify either a calibration_parameters_file or a camera_system_file
+    // (camera_system_file is the new preferred way)
+    TEUCHOS_TEST_FOR_EXCEPTION(is_stereo && (!input_params_->isParameter(DICe::calibration_parameters_file) &&
+                                             !input_params_->isParameter(DICe::camera_system_file)),
+                               std::runtime_error,
+                               "Error, calibration_parameters_file or camera_system_file required for stereo");
+    TEUCHOS_TEST_FOR_EXCEPTION(input_params_->isParameter(DICe::calibration_parameters_file) &&
+                               input_params_->isParameter(DICe::camera_system_file),
+                               std::runtime_error,
+                               "Error, both calibration_parameters_file and camera_system_file cannot be specified");
+
+    if (input_params_->isParameter(DICe::calibration_parameters_file) ||
+        input_params_->isParameter(DICe::camera_system_file)) {
+        if (proc_rank == 0)
+            update_legacy_txt_cal_input(
+                    input_params_); // in case an old txt format cal input file is being used it needs to have width and height added to it
+
+        const std::string cal_file_name = input_params_->isParameter(DICe::calibration_parameters_file)
+                                          ? input_params_->get<std::string>(DICe::calibration_parameters_file) :
+                                          input_params_->get<std::string>(DICe::camera_system_file);
+        release_triangulation();
+        triangulation_ = calibration_cache_ != Teuchos::null ? calibration_cache_->acquire(cal_file_name)
+                                                              : Teuchos::rcp(new DICe::Triangulation(cal_file_name));
+        cal_file_name_ = cal_file_name;
+        *outStream << "\n--- Calibration parameters read successfully ---\n" << std::endl;
+    } else {
+        *outStream << "Calibration parameters not specified by user" << std::endl;
+    }
+    TEUCHOS_TEST_FOR_EXCEPTION(is_stereo && triangulation_ == Teuchos::null, std::runtime_error,
+                               "Error, triangulation should be instantiated at this point");
+    main_data_.num_frames = num_frames;
+    main_data_.is_stereo = is_stereo;
+    main_data_.file_prefix = file_prefix;
+    main_data_.stereo_file_prefix = stereo_file_prefix;
+    main_data_.output_folder = output_folder;
+    main_data_.separate_output_file_for_each_subset = separate_output_file_for_each_subset;
+    main_data_.separate_header_file = separate_header_file;
+    main_data_.proc_rank = proc_rank;
+    main_data_.proc_size = proc_size;
+}
+
+void CorrelationSession::run_cross_correlation() {
+    /* We know this is a stereo analysis so we just assume all is correct */
+    SessionTimer cross_time_monitor(cross_time, global_timers_);
+    TEUCHOS_TEST_FOR_EXCEPTION(schema_->analysis_type() == GLOBAL_DIC, std::runtime_error,
+                               "Error, global stereo not enabled yet");
+
+    /* The result only depends on these files, if none of them changed the last result still holds */
+    std::vector<std::string> key_files;
+    key_files.push_back(input_file_);
+    key_files.push_back(image_files_[0]);
+    key_files.push_back(stereo_image_files_[0]);
+    key_files.push_back(cal_file_name_);
+    if (input_params_->isParameter(DICe::correlation_parameters_file))
+        key_files.push_back(input_params_->get<std::string>(DICe::correlation_parameters_file));
+    if (input_params_->isParameter(DICe::subset_file))
+        key_files.push_back(input_params_->get<std::string>(DICe::subset_file));
+    uint64_t cross_key = CrossCorrelationCache::make_key(key_files);
+    /* and on how it was seeded: the pyramid settings and whether lost subsets are tracked */
+    const int pyramid_settings[3] = {pyramid_initializer_.num_levels(), pyramid_initializer_.search_radius(),
+                                     tracking_ ? 1 : 0};
+    const double min_correlation = pyramid_initializer_.min_correlation();
+    cross_key = hash_bytes(pyramid_settings, sizeof(pyramid_settings), cross_key);
+    cross_key = hash_bytes(&min_correlation, sizeof(min_correlation), cross_key);
+    /* each rank keeps only its own subsets, a rank must find its own share and nobody else's */
+    const int process_layout[2] = {main_data_.proc_rank, main_data_.proc_size};
+    cross_key = hash_bytes(process_layout, sizeof(process_layout), cross_key);
+
+    // a cached result still needs the set up around it: the triangulation keeps the projective
+    // transform from initialize_cross_correlation() and the projection works from it
+    schema_->initialize_cross_correlation(triangulation_,
+                                          input_params_); // images don't need to be loaded by here they get loaded in this routine based on the input params
+    schema_->update_extents(true);
+    schema_->set_ref_image(image_files_[0]);
+    schema_->set_def_image(stereo_image_files_[0]);
+    prepare_stereo_remap();
+    if (schema_->use_nonlinear_projection()) {
+        if (stereo_remap_.ready())
+            schema_->set_def_image(projected_right_reference_.cols, projected_right_reference_.rows,
+                                   right_converter_.convert(projected_right_reference_));
+        else
+            schema_->project_right_image_into_left_frame(triangulation_, false);
+    }
+    prepare_pyramids();
+    // only the solve is skipped, the restored fields replace what the initialization put there
+    cross_correlation_cached_ = cross_cache_->restore(cross_key, schema_);
+    if (cross_correlation_cached_) {
+        *outStream << "Reusing cached cross correlation between left and right images" << std::endl;
+    } else {
+        *outStream << "Processing cross correlation between left and right images" << std::endl;
+        // searched from zero disparity, which only holds once the remap has put the right image
+        // on the left sensor; otherwise the disparity is far beyond the search radius and DICe's
+        // own initialization is the better start
+        if (pyramid_initializer_.enabled() && stereo_remap_.ready() && !right_reference_pyramid_.empty()) {
+            const chrono::steady_clock::time_point search_start = chrono::steady_clock::now();
+            int_t weak = 0;
+            const int_t seeded = pyramid_initializer_.initialize(left_reference_pyramid_, right_reference_pyramid_,
+                                                                 schema_, NULL, NULL, true, weak);
+            pyramid_stats_.search_ms += elapsed_ms(search_start);
+            *outStream << "Cross correlation seeded by the pyramids for " << seeded << " subsets, " << weak << " weak"
+                       << std::endl;
+        }
+        schema_->execute_cross_correlation();
+    }
+    schema_->save_cross_correlation_fields();
+    create_stereo_schema();
+
+    // go ahead and set up the model coordinates field
+    schema_->execute_triangulation(triangulation_, stereo_schema_);
+    if (!cross_correlation_cached_)
+        cross_cache_->store(cross_key, schema_);
+}
+
+void CorrelationSession::create_stereo_schema() {
+    stereo_schema_ = Teuchos::rcp(new DICe::Schema(input_params_, correlation_params_, schema_));
+    stereo_schema_->update_extents();
+    stereo_schema_->set_ref_image(stereo_image_files_[0]);
+    assert(stereo_schema_ != Teuchos::null);
+    if (stereo_schema_->use_nonlinear_projection()) {
+        if (stereo_remap_.ready())
+            stereo_schema_->set_ref_image(projected_right_reference_.cols, projected_right_reference_.rows,
+                                          right_converter_.convert(projected_right_reference_));
+        else
+            stereo_schema_->project_right_image_into_left_frame(triangulation_, true);
+    }
+    stereo_schema_->set_frame_range(0, 2);
+}
+
+void CorrelationSession::prepare_deadline() {
+    if (deadline_ms_ <= 0.0)
+        return;
+    const int_t max_iterations = correlation_params_->get<int_t>(DICe::max_solver_iterations_fast,
+                                                                 schema_->max_solver_iterations_fast());
+    deadline_scheduler_.configure(deadline_ms_, max_iterations);
+    capped_params_ = Teuchos::null;
+    applied_iteration_cap_ = max_iterations;
+    std::vector<char> priority(local_ids_.size(), 0);
+    if (input_params_->isParameter(DICe::subset_file)) {
+        const std::vector<int_t> priority_ids =
+                DeadlineScheduler::read_priority_subsets(input_params_->get<std::string>(DICe::subset_file));
+        for (size_t i = 0; i < local_ids_.size(); ++i)
+            priority[i] = std::find(priority_ids.begin(), priority_ids.end(), local_ids_[i]) != priority_ids.end();
+    }
+    deadline_scheduler_.reset(priority);
+    deadline_iterations_.assign(local_ids_.size(), 0.0);
+}
+
+void CorrelationSession::prepare_change_gate() {
+    const bool incremental = schema_->use_incremental_formulation();
+    change_gate_.configure(incremental ? 0.0 : change_threshold_);
+    change_gate_.reset(local_ids_.size(), schema_->subset_dim());
+    if (change_threshold_ > 0.0 && incremental)
+        *outStream << "The change gate is off, the incremental formulation solves every subset every frame" << std::endl;
+}
+
+/* Where each local subset of schema sits in the deformed image now, the reference position plus its displacement */
+static void subset_centres(const Teuchos::RCP<Schema> &schema, std::vector<cv::Point> &centres) {
+    const Teuchos::RCP<DICe::mesh::Mesh> mesh = schema->mesh();
+    const Teuchos::ArrayRCP<const scalar_t> x = mesh->get_field(mesh->get_field_spec("COORDINATE_X"))->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> y = mesh->get_field(mesh->get_field_spec("COORDINATE_Y"))->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> u = mesh->get_field(SUBSET_DISPLACEMENT_X_FS)->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> v = mesh->get_field(SUBSET_DISPLACEMENT_Y_FS)->get_1d_view();
+    centres.resize(schema->local_num_subsets());
+    for (size_t i = 0; i < centres.size(); ++i)
+        centres[i] = cv::Point((int) std::floor(x[i] + u[i] + 0.5), (int) std::floor(y[i] + v[i] + 0.5));
+}
+
+void CorrelationSession::gate_views(const cv::Mat &left_frame, const cv::Mat &right_frame) {
+    // headers only, the frames outlive the correlation of this pair
+    gate_views_[0].frame = left_frame;
+    gate_views_[1].frame = main_data_.is_stereo ? right_frame : cv::Mat();
+    subset_centres(schema_, gate_views_[0].centres);
+    if (!gate_views_[1].frame.empty())
+        subset_centres(stereo_schema_, gate_views_[1].centres);
+}
+
+std::vector<int_t> *CorrelationSession::solve_skip_flags() {
+    if (deadline_ms_ > 0.0)
+        return &deadline_scheduler_.skip_flags();
+    return change_gate_.enabled() ? &change_gate_.skip_flags() : NULL;
+}
+
+/* The solution of a subset, DICe's initialization writes these even for a subset whose solve it skips */
+static const Field_Spec *const solution_fields[] = {&SUBSET_DISPLACEMENT_X_FS, &SUBSET_DISPLACEMENT_Y_FS, &ROTATION_Z_FS,
+                                                    &NORMAL_STRETCH_XX_FS, &NORMAL_STRETCH_YY_FS, &SHEAR_STRETCH_XY_FS,
+                                                    &SIGMA_FS, &GAMMA_FS, &MATCH_FS, &STATUS_FLAG_FS};
+/* and what the triangulation makes of it */
+static const Field_Spec *const model_fields[] = {&MODEL_DISPLACEMENT_X_FS, &MODEL_DISPLACEMENT_Y_FS,
+                                                 &MODEL_DISPLACEMENT_Z_FS};
+static const size_t num_solution_fields = sizeof(solution_fields) / sizeof(solution_fields[0]);
+static const size_t num_model_fields = sizeof(model_fields) / sizeof(model_fields[0]);
+
+void CorrelationSession::hold_skipped_solutions(const std::vector<int_t> &skip) {
+    const Teuchos::RCP<Schema> schemas[2] = {schema_, stereo_schema_};
+    held_model_.clear();
+    for (int side = 0; side < (main_data_.is_stereo ? 2 : 1); ++side) {
+        std::vector<scalar_t> &held = held_solutions_[side];
+        held.clear();
+        for (size_t subset_it = 0; subset_it < skip.size(); ++subset_it) {
+            if (!skip[subset_it])
+                continue;
+            for (size_t field = 0; field < num_solution_fields; ++field)
+                held.push_back(schemas[side]->local_field_value(subset_it, *solution_fields[field]));
+            if (side == 0)
+                for (size_t field = 0; field < num_model_fields; ++field)
+                    held_model_.push_back(schema_->local_field_value(subset_it, *model_fields[field]));
+        }
+    }
+}
+
+void CorrelationSession::restore_skipped_solutions(const std::vector<int_t> &skip, bool model) {
+    const Teuchos::RCP<Schema> schemas[2] = {schema_, stereo_schema_};
+    for (int side = 0; side < (model ? 1 : main_data_.is_stereo ? 2 : 1); ++side) {
+        const std::vector<scalar_t> &held = model ? held_model_ : held_solutions_[side];
+        const Field_Spec *const *fields = model ? model_fields : solution_fields;
+        const size_t num_fields = model ? num_model_fields : num_solution_fields;
+        size_t value = 0;
+        for (size_t subset_it = 0; subset_it < skip.size(); ++subset_it) {
+            if (!skip[subset_it])
+                continue;
+            for (size_t field = 0; field < num_fields; ++field)
+                schemas[side]->local_field_value(subset_it, *fields[field]) = held[value++];
+        }
+    }
+}
+
+void CorrelationSession::apply_iteration_cap(int_t iteration_cap) {
+    if (iteration_cap == applied_iteration_cap_)
+        return;
+    // set_params() puts every parameter it is not given back to its default, so the cap goes in with the rest
+    if (capped_params_ == Teuchos::null)
+        capped_params_ = Teuchos::rcp(correlation_params_ != Teuchos::null
+                                      ? new Teuchos::ParameterList(*correlation_params_)
+                                      : new Teuchos::ParameterList());
+    capped_params_->set(DICe::max_solver_iterations_fast, iteration_cap);
+    schema_->set_params(capped_params_);
+    if (main_data_.is_stereo)
+        stereo_schema_->set_params(capped_params_);
+    applied_iteration_cap_ = iteration_cap;
+}
+
+void CorrelationSession::apply_skip_flags(const Teuchos::RCP<Schema> &schema, const std::vector<int_t> &skip) {
+    // DICe skips a subset in the frames listed for its global id, the same way a subset file's skip_solve does
+    skip_solve_frames_.clear();
+    const std::vector<int_t> this_frame(1, schema->frame_id());
+    for (size_t subset_it = 0; subset_it < skip.size(); ++subset_it)
+        if (skip[subset_it])
+            skip_solve_frames_[schema->subset_global_id(subset_it)] = this_frame;
+    schema->set_skip_solve_flags(skip_solve_frames_);
+}
+
+void CorrelationSession::prepare_pyramids() {
+    left_reference_pyramid_.levels.clear();
+    right_reference_pyramid_.levels.clear();
+    if (!pyramid_initializer_.enabled())
+        return;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    left_reference_pyramid_.build(cv::imread(image_files_[0], cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH),
+                                  pyramid_initializer_.num_levels());
+    // the right schema works on what DICe was given: the projected image if there is a projection
+    if (main_data_.is_stereo) {
+        if (stereo_remap_.ready())
+            right_reference_pyramid_.build(projected_right_reference_, pyramid_initializer_.num_levels());
+        else if (!schema_->use_nonlinear_projection())
+            right_reference_pyramid_.build(cv::imread(stereo_image_files_[0], cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH),
+                                           pyramid_initializer_.num_levels());
+        else
+            *outStream << "DICe projects the right images itself, the right subsets start from the last solution"
+                       << std::endl;
+    }
+    pyramid_stats_.build_ms += elapsed_ms(start);
+}
+
+void CorrelationSession::build_frame_pyramids(const cv::Mat &left_frame, const cv::Mat &right_frame) {
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const int num_levels = pyramid_initializer_.num_levels();
+    const bool right = main_data_.is_stereo && !right_reference_pyramid_.empty() && !right_frame.empty();
+    run_both_sides([&] { left_pyramid_.build(left_frame, num_levels); },
+                   [&] {
+                       if (right)
+                           right_pyramid_.build(right_frame, num_levels);
+                       else
+                           right_pyramid_.levels.clear();
+                   });
+    pyramid_stats_.build_ms += elapsed_ms(start);
+}
+
+void CorrelationSession::initialize_from_pyramids(const std::vector<int_t> *skip) {
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    // right after setup the fields hold the cross-correlation, and a lost track has nothing to go on
+    const bool fresh = frame_count_ == 1 || tracking_;
+    int_t seeded[2] = {0, 0};
+    int_t weak[2] = {0, 0};
+    run_both_sides([&] {
+                       seeded[0] = pyramid_initializer_.initialize(left_reference_pyramid_, left_pyramid_, schema_,
+                                                                   skip, tracking_ ? &left_lost_ : NULL, fresh,
+                                                                   weak[0]);
+                   },
+                   [&] {
+                       seeded[1] = pyramid_initializer_.initialize(right_reference_pyramid_, right_pyramid_,
+                                                                   stereo_schema_, skip,
+                                                                   tracking_ ? &right_lost_ : NULL, fresh, weak[1]);
+                   });
+    ++pyramid_stats_.frames;
+    pyramid_stats_.subsets_initialized += seeded[0] + seeded[1];
+    pyramid_stats_.subsets_weak += weak[0] + weak[1];
+    if (tracking_)
+        tracking_stats_.subsets_reseeded += seeded[0] + seeded[1];
+    pyramid_stats_.search_ms += elapsed_ms(start);
+}
+
+void CorrelationSession::prepare_stereo_remap() {
+    stereo_remap_.reset();
+    projected_right_reference_.release();
+    if (!main_data_.is_stereo || !schema_->use_nonlinear_projection())
+        return;
+    const cv::Mat left_reference = cv::imread(image_files_[0], cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+    const cv::Mat right_reference = cv::imread(stereo_image_files_[0], cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+    // a format OpenCV cannot read, DICe projects the images itself
+    if (left_reference.empty() || right_reference.empty())
+        return;
+    // the projection is onto the left sensor, every rank needs the table but one writer is enough
+    stereo_remap_.prepare(cal_file_name_, left_reference.cols, left_reference.rows, triangulation_,
+                          main_data_.proc_rank == 0);
+    stereo_remap_.apply(right_reference, projected_right_reference_);
+    *outStream << (stereo_remap_.built() ? "Built " : "Loaded ") << "the stereo remap table "
+               << StereoRemap::file_name(cal_file_name_) << " in " << stereo_remap_.prepare_ms() << " ms" << std::endl;
+}
+
+bool CorrelationSession::correlate_frame(int_t image_it) {
+    TEUCHOS_TEST_FOR_EXCEPTION(image_it <= 0 || image_it >= (int_t) image_files_.size(), std::runtime_error,
+                               "Error, invalid frame index " << image_it);
+    if (prefetch_lookahead_ > 0) {
+        if (prefetcher_ == Teuchos::null) {
+            prefetcher_ = Teuchos::rcp(new ImagePrefetcher(prefetch_lookahead_, prefetch_memory_cap_mb_ << 20));
+            prefetcher_->set_cache(image_cache_.get());
+            prefetcher_->start(image_files_, main_data_.is_stereo ? stereo_image_files_ : std::vector<std::string>(),
+                               image_it);
+        }
+        cv::Mat left_frame;
+        cv::Mat right_frame;
+        if (prefetcher_->take(image_it, left_frame, right_frame))
+            return correlate_images(left_frame, right_frame);
+        // a format OpenCV cannot read, DICe's own reader gets it
+    } else if (image_cache_ != Teuchos::null) {
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        const bool read = image_cache_->read(image_files_[image_it], cache_left_)
+                          && (!main_data_.is_stereo || image_cache_->read(stereo_image_files_[image_it], cache_right_));
+        times_.image_load_ms += elapsed_ms(start);
+        if (read)
+            return correlate_images(cache_left_, main_data_.is_stereo ? cache_right_ : cv::Mat());
+    }
+    return correlate_files(image_files_[image_it], stereo_image_files_[image_it]);
+}
+
+bool CorrelationSession::correlate_sequence() {
+    bool failed_step = false;
+
+    // iterate through the images and perform the correlation:
+    for (int_t image_it = 1; image_it <= main_data_.num_frames; ++image_it) {
+        if (correlate_frame(image_it))
+            failed_step = true;
+    } // image loop
+
+    finish(failed_step);
+    return failed_step;
+}
+
+bool CorrelationSession::correlate_files(const std::string &left_file, const std::string &right_file) {
+    TEUCHOS_TEST_FOR_EXCEPTION(!is_setup_, std::runtime_error, "Error, setup() must be called before correlating");
+    // the gate, the pyramids and the reseed need the pixels as well: decode once here and hand DICe
+    // the in-memory images. Only the leader decides, a follower is told which of the two to run
+    if (process_rank() == 0 && (change_gate_.enabled() || pyramid_initializer_.enabled() || (tracking_ && any_lost()))) {
+        const chrono::steady_clock::time_point decode_start = chrono::steady_clock::now();
+        const cv::Mat left = cv::imread(left_file, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+        const cv::Mat right = main_data_.is_stereo ? cv::imread(right_file, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH)
+                                                   : cv::Mat();
+        if (!left.empty() && (!main_data_.is_stereo || !right.empty())) {
+            times_.image_load_ms += elapsed_ms(decode_start);
+            return correlate_images(left, right);
+        }
+        // a format only DICe reads, the frame goes without the gate, the pyramids and the reseed
+    }
+    SessionTimer total_time_monitor(total_time, global_timers_);
+    ScopedProbe frame_probe(PROBE_FRAME);
+    if (lead(COMMAND_CORRELATE_FILES)) {
+        std::string left_name = left_file;
+        std::string right_name = right_file;
+        broadcast_string(left_name);
+        broadcast_string(right_name);
+    }
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    prepare_frame(left_file);
+    run_both_sides([&] {
+                       ScopedProbe probe(PROBE_IMAGE_LOAD_LEFT);
+                       schema_->set_def_image(left_file);
+                   },
+                   [&] {
+                       ScopedProbe probe(PROBE_IMAGE_LOAD_RIGHT);
+                       if (stereo_remap_.ready()) {
+                           const cv::Mat right = cv::imread(right_file, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+                           TEUCHOS_TEST_FOR_EXCEPTION(right.empty(), std::runtime_error,
+                                                      "Error, cannot read " << right_file);
+                           stereo_remap_.apply(right, projected_right_);
+                           stereo_schema_->set_def_image(projected_right_.cols, projected_right_.rows,
+                                                         right_converter_.convert(projected_right_));
+                       } else {
+                           stereo_schema_->set_def_image(right_file);
+                           if (stereo_schema_->use_nonlinear_projection())
+                               stereo_schema_->project_right_image_into_left_frame(triangulation_, false);
+                       }
+                   });
+    times_.image_load_ms += elapsed_ms(start);
+    if (change_gate_.enabled()) {
+        // nothing to compare against, every subset is solved and no window is stored for the next frame
+        gate_views(cv::Mat(), cv::Mat());
+        change_gate_.plan(gate_views_[0], gate_views_[1]);
+    }
+    if (pyramid_initializer_.enabled()) {
+        // no frame pyramids, the subsets start from their last solution
+        left_pyramid_.levels.clear();
+        right_pyramid_.levels.clear();
+    }
+    const bool failed_step = run_correlation_and_triangulation();
+    last_frame_time_ms_ = elapsed_ms(start);
+    if (deadline_ms_ > 0.0)
+        deadline_scheduler_.record_frame(last_frame_time_ms_);
+    *outStream << "Frame " << frame_count_ << " processed in " << last_frame_time_ms_ << " ms" << std::endl;
+    return failed_step;
+}
+
+bool CorrelationSession::correlate_images(const cv::Mat &left_frame, const cv::Mat &right_frame) {
+    TEUCHOS_TEST_FOR_EXCEPTION(!is_setup_, std::runtime_error, "Error, setup() must be called before correlating");
+    SessionTimer total_time_monitor(total_time, global_timers_);
+    ScopedProbe frame_probe(PROBE_FRAME);
+    if (lead(COMMAND_CORRELATE_IMAGES)) {
+        cv::Mat left_copy = left_frame;
+        cv::Mat right_copy = right_frame;
+        broadcast_mat(left_copy);
+        broadcast_mat(right_copy);
+    }
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    prepare_frame("in-memory frame");
+    // with the nonlinear projection the right schema works on the left sensor grid
+    if (main_data_.is_stereo && stereo_remap_.ready())
+        stereo_remap_.apply(right_frame, projected_right_);
+    const cv::Mat &right_input = stereo_remap_.ready() ? projected_right_ : right_frame;
+    const cv::Rect left_roi = frame_roi(schema_, left_frame);
+    const cv::Rect right_roi = main_data_.is_stereo ? frame_roi(stereo_schema_, right_input) : cv::Rect();
+    run_both_sides([&] {
+                       ScopedProbe probe(PROBE_IMAGE_LOAD_LEFT);
+                       load_def_image(schema_, left_frame, left_roi, left_converter_);
+                   },
+                   [&] {
+                       ScopedProbe probe(PROBE_IMAGE_LOAD_RIGHT);
+                       load_def_image(stereo_schema_, right_input, right_roi, right_converter_);
+                   });
+    times_.image_load_ms += elapsed_ms(start);
+    if (tracking_ && !pyramid_initializer_.enabled() && any_lost())
+        reseed_lost_subsets(left_frame, right_input);
+    if (change_gate_.enabled()) {
+        gate_views(left_frame, right_input);
+        change_gate_.plan(gate_views_[0], gate_views_[1]);
+    }
+    if (pyramid_initializer_.enabled())
+        build_frame_pyramids(left_frame, right_input);
+    const bool failed_step = run_correlation_and_triangulation();
+    last_frame_time_ms_ = elapsed_ms(start);
+    if (deadline_ms_ > 0.0)
+        deadline_scheduler_.record_frame(last_frame_time_ms_);
+    *outStream << "Frame " << frame_count_ << " processed in " << last_frame_time_ms_ << " ms" << std::endl;
+    return failed_step;
+}
+
+void CorrelationSession::prepare_frame(const std::string &label) {
+    ++frame_count_;
+    *outStream << "Processing frame: " << frame_count_ << ", " << label << std::endl;
+    if (schema_->use_incremental_formulation() && frame_count_ > 1) {
+        schema_->set_ref_image(schema_->def_img());
+    }
+    schema_->update_extents();
+    if (main_data_.is_stereo) {
+        if (stereo_schema_->use_incremental_formulation() && frame_count_ > 1) {
+            stereo_schema_->set_ref_image(stereo_schema_->def_img());
+        }
+        stereo_schema_->update_extents();
+    }
+}
+
+void CorrelationSession::prepare_roi() {
+    roi_pixels_ = 0.0;
+    frame_pixels_ = 0.0;
+    if (!roi_crop_)
+        return;
+    int_t strain_window = 0;
+    if (correlation_params_->isSublist(DICe::post_process_vsg_strain)) {
+        const Teuchos::ParameterList &vsg = correlation_params_->sublist(DICe::post_process_vsg_strain);
+        if (vsg.isType<int_t>(DICe::strain_window_size_in_pixels))
+            strain_window = vsg.get<int_t>(DICe::strain_window_size_in_pixels);
+    }
+    // DICe filters the whole frame, the zeros outside the crop must not reach the outermost subsets
+    int_t filter_mask = 0;
+    if (correlation_params_->isType<bool>(DICe::gauss_filter_images) &&
+        correlation_params_->get<bool>(DICe::gauss_filter_images))
+        filter_mask = correlation_params_->isType<int_t>(DICe::gauss_filter_mask_size)
+                      ? correlation_params_->get<int_t>(DICe::gauss_filter_mask_size) : 13;
+    // two more pixels so the image gradients at the edge of the outermost subsets are not one-sided
+    roi_padding_ = strain_window / 2 + filter_mask / 2 + std::max(roi_margin_, (int_t) 0) + 2;
+}
+
+cv::Rect CorrelationSession::frame_roi(const Teuchos::RCP<DICe::Schema> &schema, const cv::Mat &frame) {
+    const cv::Rect full_frame(0, 0, frame.cols, frame.rows);
+    frame_pixels_ += full_frame.area();
+    const int_t num_subsets = schema->local_num_subsets();
+    if (!roi_crop_ || num_subsets == 0) {
+        roi_pixels_ += full_frame.area();
+        return full_frame;
+    }
+    const Teuchos::RCP<DICe::mesh::Mesh> mesh = schema->mesh();
+    const Teuchos::ArrayRCP<const scalar_t> x = mesh->get_field(mesh->get_field_spec("COORDINATE_X"))->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> y = mesh->get_field(mesh->get_field_spec("COORDINATE_Y"))->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> u = mesh->get_field(SUBSET_DISPLACEMENT_X_FS)->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> v = mesh->get_field(SUBSET_DISPLACEMENT_Y_FS)->get_1d_view();
+    // where the subsets started and where the last frame left them, whichever the formulation uses
+    scalar_t min_x = x[0], max_x = x[0], min_y = y[0], max_y = y[0];
+    for (int_t i = 0; i < num_subsets; ++i) {
+        min_x = std::min(min_x, std::min(x[i], x[i] + u[i]));
+        max_x = std::max(max_x, std::max(x[i], x[i] + u[i]));
+        min_y = std::min(min_y, std::min(y[i], y[i] + v[i]));
+        max_y = std::max(max_y, std::max(y[i], y[i] + v[i]));
+    }
+    const int_t padding = schema->subset_dim() / 2 + roi_padding_;
+    const int_t left = (int_t) std::floor(min_x) - padding;
+    const int_t top = (int_t) std::floor(min_y) - padding;
+    cv::Rect roi(left, top, (int_t) std::ceil(max_x) + padding - left + 1, (int_t) std::ceil(max_y) + padding - top + 1);
+    roi &= full_frame;
+    if (roi.area() == 0)
+        roi = full_frame;
+    roi_pixels_ += roi.area();
+    return roi;
+}
+
+void CorrelationSession::load_def_image(const Teuchos::RCP<DICe::Schema> &schema, const cv::Mat &frame,
+                                        const cv::Rect &roi, FrameConverter &converter) {
+    // always the full frame, the subsets are in full-frame pixels; only the crop is converted
+    schema->set_def_image(frame.cols, frame.rows, converter.convert(frame, roi));
+}
+
+void CorrelationSession::run_both_sides(const std::function<void()> &left, const std::function<void()> &right) {
+    if (!main_data_.is_stereo) {
+        left();
+        return;
+    }
+    // with several ranks both schemas make collective calls, they have to come in the same order everywhere
+    if (!parallel_stereo_ || main_data_.proc_size > 1) {
+        left();
+        right();
+        return;
+    }
+    if (stereo_pool_ == Teuchos::null)
+        stereo_pool_ = Teuchos::rcp(new ThreadPool(1));
+    // the right side goes to the pool and the left runs here, both are done before this returns
+    std::future<void> right_done = stereo_pool_->submit(right);
+    try {
+        left();
+    } catch (...) {
+        right_done.wait();
+        throw;
+    }
+    right_done.get();
+}
+
+/* SIGMA, GAMMA and STATUS_FLAG of a subset after execute_correlation say whether its track is lost */
+static bool track_lost(const Teuchos::RCP<Schema> &schema, int_t subset, scalar_t gamma_threshold) {
+    const scalar_t sigma = schema->local_field_value(subset, SIGMA_FS);
+    const scalar_t gamma = schema->local_field_value(subset, GAMMA_FS);
+    const int_t status = (int_t) schema->local_field_value(subset, STATUS_FLAG_FS);
+    if (sigma < 0.0 || !(gamma <= gamma_threshold))
+        return true;
+    return status == INITIALIZE_FAILED || status == SEARCH_FAILED || status == CORRELATION_FAILED ||
+           status == CORRELATION_FAILED_BY_EXCEEDING_ITERATIONS || status == FRAME_FAILED_DUE_TO_NEGATIVE_SIGMA ||
+           status == FRAME_FAILED_DUE_TO_HIGH_GAMMA || status == FRAME_FAILED_DUE_TO_HIGH_PATH_DISTANCE;
+}
+
+bool CorrelationSession::any_lost() const {
+    return std::find(left_lost_.begin(), left_lost_.end(), 1) != left_lost_.end() ||
+           std::find(right_lost_.begin(), right_lost_.end(), 1) != right_lost_.end();
+}
+
+void CorrelationSession::reseed_lost_subsets(const cv::Mat &left_frame, const cv::Mat &right_frame) {
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int_t reseeded = left_reseeder_.reseed(left_frame, schema_, left_lost_);
+    if (main_data_.is_stereo)
+        reseeded += right_reseeder_.reseed(right_frame, stereo_schema_, right_lost_);
+    tracking_stats_.subsets_reseeded += reseeded;
+    times_.reseed_ms += elapsed_ms(start);
+    *outStream << "Reseeded " << reseeded << " subsets by feature matching" << std::endl;
+}
+
+void CorrelationSession::update_tracking() {
+    const Teuchos::RCP<Schema> schemas[2] = {schema_, stereo_schema_};
+    std::vector<char> *lost[2] = {&left_lost_, &right_lost_};
+    // a deferred or carried over subset was not solved, its fields still hold an earlier frame
+    const std::vector<int_t> *deferred = solve_skip_flags();
+    std::fill(deadline_iterations_.begin(), deadline_iterations_.end(), 0.0);
+    for (int side = 0; side < (main_data_.is_stereo ? 2 : 1); ++side) {
+        const int_t num_subsets = schemas[side]->local_num_subsets();
+        if (tracking_)
+            lost[side]->assign(num_subsets, 0);
+        for (int_t subset_it = 0; subset_it < num_subsets; ++subset_it) {
+            if (deferred != NULL && (*deferred)[subset_it])
+                continue;
+            const scalar_t iterations = schemas[side]->local_field_value(subset_it, ITERATIONS_FS);
+            if (deadline_ms_ > 0.0)
+                deadline_iterations_[subset_it] += iterations;
+            tracking_stats_.iterations += (long) iterations;
+            ++tracking_stats_.subsets_solved;
+            if ((tracking_ || change_gate_.enabled()) &&
+                track_lost(schemas[side], subset_it, tracking_gamma_threshold_)) {
+                // a failed solution is no good to carry over, whatever the image does
+                if (change_gate_.enabled())
+                    change_gate_.invalidate(subset_it);
+                if (!tracking_)
+                    continue;
+                (*lost[side])[subset_it] = 1;
+                ++tracking_stats_.subsets_lost;
+            }
+        }
+    }
+}
+
+bool CorrelationSession::lead(int command) {
+    if (process_rank() != 0 || process_size() <= 1)
+        return false;
+    broadcast_value(command);
+    return true;
+}
+
+void CorrelationSession::follow() {
+    for (;;) {
+        int command = COMMAND_RELEASE;
+        broadcast_value(command);
+        switch (command) {
+            case COMMAND_SETUP:
+                setup();
+                break;
+            case COMMAND_RESET:
+                reset();
+                break;
+            case COMMAND_CORRELATE_FILES: {
+                std::string left_file;
+                std::string right_file;
+                broadcast_string(left_file);
+                broadcast_string(right_file);
+                correlate_files(left_file, right_file);
+                break;
+            }
+            case COMMAND_CORRELATE_IMAGES: {
+                cv::Mat left_frame;
+                cv::Mat right_frame;
+                broadcast_mat(left_frame);
+                broadcast_mat(right_frame);
+                correlate_images(left_frame, right_frame);
+                break;
+            }
+            case COMMAND_FINISH: {
+                int failed_step = 0;
+                broadcast_value(failed_step);
+                finish(failed_step != 0);
+                break;
+            }
+            default:
+                return;
+        }
+    }
+}
+
+void CorrelationSession::release_followers() {
+    lead(COMMAND_RELEASE);
+}
+
+void CorrelationSession::fill_subset_store() {
+    if (main_data_.proc_size > 1) {
+        // the subsets of the other ranks only exist over there, collect them on rank 0 field by field
+        gather_subset_field(MODEL_DISPLACEMENT_X_FS, subsets_.displacement_x);
+        gather_subset_field(MODEL_DISPLACEMENT_Y_FS, subsets_.displacement_y);
+        gather_subset_field(MODEL_DISPLACEMENT_Z_FS, subsets_.displacement_z);
+        gather_subset_field(SIGMA_FS, subsets_.sigma);
+        gather_subset_field(STATUS_FLAG_FS, gathered_);
+        subsets_.status.assign(gathered_.begin(), gathered_.end());
+        if (deadline_ms_ > 0.0) {
+            gather_stale_frames(gathered_);
+            subsets_.stale_frames.assign(gathered_.begin(), gathered_.end());
+        }
+        if (change_gate_.enabled()) {
+            gather_carried_over(gathered_);
+            subsets_.carried_over.assign(gathered_.begin(), gathered_.end());
+        }
+        return;
+    }
+    const Teuchos::RCP<DICe::mesh::Mesh> mesh = schema_->mesh();
+    const Teuchos::ArrayRCP<const scalar_t> displacement_x = mesh->get_field(MODEL_DISPLACEMENT_X_FS)->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> displacement_y = mesh->get_field(MODEL_DISPLACEMENT_Y_FS)->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> displacement_z = mesh->get_field(MODEL_DISPLACEMENT_Z_FS)->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> sigma = mesh->get_field(SIGMA_FS)->get_1d_view();
+    const Teuchos::ArrayRCP<const scalar_t> status = mesh->get_field(STATUS_FLAG_FS)->get_1d_view();
+    for (size_t i = 0; i < local_ids_.size(); ++i) {
+        const int_t id = local_ids_[i];
+        subsets_.displacement_x[id] = displacement_x[i];
+        subsets_.displacement_y[id] = displacement_y[i];
+        subsets_.displacement_z[id] = displacement_z[i];
+        subsets_.sigma[id] = sigma[i];
+        subsets_.status[id] = (int) status[i];
+        subsets_.stale_frames[id] = deadline_ms_ > 0.0 ? deadline_scheduler_.stale_frames()[i] : 0;
+        subsets_.carried_over[id] = change_gate_.enabled() ? (int) change_gate_.skip_flags()[i] : 0;
+    }
+}
+
+void CorrelationSession::gather_stale_frames(std::vector<scalar_t> &gathered) {
+    const std::vector<int> &stale = deadline_scheduler_.stale_frames();
+    gather_values_.assign(stale.begin(), stale.end());
+    gather_by_global_id(local_ids_, gather_values_, schema_->global_num_subsets(), gathered);
+}
+
+void CorrelationSession::gather_carried_over(std::vector<scalar_t> &gathered) {
+    const std::vector<int_t> &carried = change_gate_.skip_flags();
+    gather_values_.assign(carried.begin(), carried.end());
+    gather_by_global_id(local_ids_, gather_values_, schema_->global_num_subsets(), gathered);
+}
+
+void CorrelationSession::gather_subset_field(const Field_Spec &spec, std::vector<scalar_t> &gathered) {
+    gather_subset_field(schema_, spec, gathered);
+}
+
+void CorrelationSession::gather_subset_field(const Teuchos::RCP<Schema> &schema, const Field_Spec &spec,
+                                             std::vector<scalar_t> &gathered) {
+    // the stereo schema is built from the left one, it owns the same subsets on every rank
+    const int_t num_local = local_ids_.size();
+    gather_values_.resize(num_local);
+    for (int_t i = 0; i < num_local; ++i)
+        gather_values_[i] = schema->local_field_value(i, spec);
+    gather_by_global_id(local_ids_, gather_values_, schema->global_num_subsets(), gathered);
+}
+
+void CorrelationSession::prepare_async_output() {
+    std::vector<std::string> requested;
+    if (correlation_params_ != Teuchos::null && correlation_params_->isSublist(DICe::output_spec)) {
+        const Teuchos::ParameterList &spec = correlation_params_->sublist(DICe::output_spec);
+        for (Teuchos::ParameterList::ConstIterator it = spec.begin(); it != spec.end(); ++it) {
+            const std::string &name = spec.name(it);
+            if (spec.isType<bool>(name) && spec.get<bool>(name))
+                requested.push_back(name);
+        }
+    } else {
+        const char *default_fields[] = {"COORDINATE_X", "COORDINATE_Y", "DISPLACEMENT_X", "DISPLACEMENT_Y",
+                                        "SIGMA", "GAMMA", "STATUS_FLAG"};
+        requested.assign(default_fields, default_fields + sizeof(default_fields) / sizeof(default_fields[0]));
+    }
+    std::vector<std::string> names;
+    output_fields_.clear();
+    for (size_t i = 0; i < requested.size(); ++i) {
+        try {
+            output_fields_.push_back(schema_->mesh()->get_field_spec(requested[i]));
+            names.push_back(requested[i]);
+        } catch (std::exception &) {
+            *outStream << "Output field " << requested[i] << " does not exist, it is left out" << std::endl;
+        }
+    }
+    // not a DICe field, the scheduler's count of frames since the subset was last solved
+    if (deadline_ms_ > 0.0)
+        names.push_back("STALE_FRAMES");
+    // 1 where the change gate kept the last solution
+    if (change_gate_.enabled())
+        names.push_back("CARRIED_OVER");
+    output_field_names_ = std::make_shared<const std::vector<std::string> >(names);
+
+    if (result_writer_ == Teuchos::null)
+        result_writer_ = Teuchos::rcp(new ResultWriter());
+    // files of the previous setup first, then the layout of this one
+    result_writer_->flush();
+    const std::string delimiter = correlation_params_ != Teuchos::null
+                                  ? correlation_params_->get<std::string>(DICe::output_delimiter, " ") : " ";
+    const bool omit_row_id = correlation_params_ != Teuchos::null &&
+                             correlation_params_->get<bool>(DICe::omit_output_row_id, false);
+    result_writer_->set_text_layout(delimiter, !omit_row_id);
+    result_writer_->set_format(output_format_);
+}
+
+void CorrelationSession::queue_snapshot(const Teuchos::RCP<Schema> &schema, const std::string &prefix) {
+    std::shared_ptr<ResultSnapshot> snapshot = std::make_shared<ResultSnapshot>();
+    snapshot->folder = main_data_.output_folder;
+    snapshot->prefix = prefix;
+    snapshot->frame = frame_offset_ + frame_count_;
+    snapshot->field_names = output_field_names_;
+    const size_t num_fields = output_fields_.size();
+    const size_t num_columns = output_field_names_->size();
+    if (main_data_.proc_size > 1) {
+        snapshot->num_subsets = schema->global_num_subsets();
+        snapshot->values.resize(num_columns * snapshot->num_subsets);
+        for (size_t field = 0; field < num_fields; ++field) {
+            gather_subset_field(schema, output_fields_[field], gathered_);
+            if (!gathered_.empty())
+                std::copy(gathered_.begin(), gathered_.end(), &snapshot->values[field * snapshot->num_subsets]);
+        }
+        size_t column = num_fields;
+        if (deadline_ms_ > 0.0) {
+            gather_stale_frames(gathered_);
+            if (!gathered_.empty())
+                std::copy(gathered_.begin(), gathered_.end(), &snapshot->values[column * snapshot->num_subsets]);
+            ++column;
+        }
+        if (change_gate_.enabled()) {
+            gather_carried_over(gathered_);
+            if (!gathered_.empty())
+                std::copy(gathered_.begin(), gathered_.end(), &snapshot->values[column * snapshot->num_subsets]);
+        }
+        if (main_data_.proc_rank != 0)
+            return;
+    } else {
+        // the only cost left on the correlation thread, one copy of each field
+        snapshot->num_subsets = schema->local_num_subsets();
+        snapshot->values.resize(num_columns * snapshot->num_subsets);
+        for (size_t field = 0; field < num_fields; ++field) {
+            const Teuchos::ArrayRCP<const scalar_t> values = schema->mesh()->get_field(output_fields_[field])->get_1d_view();
+            std::copy(values.get(), values.get() + snapshot->num_subsets, &snapshot->values[field * snapshot->num_subsets]);
+        }
+        size_t column = num_fields;
+        if (deadline_ms_ > 0.0) {
+            const std::vector<int> &stale = deadline_scheduler_.stale_frames();
+            std::copy(stale.begin(), stale.end(), &snapshot->values[column++ * snapshot->num_subsets]);
+        }
+        if (change_gate_.enabled()) {
+            const std::vector<int_t> &carried = change_gate_.skip_flags();
+            std::copy(carried.begin(), carried.end(), &snapshot->values[column * snapshot->num_subsets]);
+        }
+    }
+    result_writer_->push(snapshot);
+}
+
+ResultWriterStats CorrelationSession::output_stats() const {
+    return result_writer_ != Teuchos::null ? result_writer_->stats() : ResultWriterStats();
+}
+
+bool CorrelationSession::run_correlation_and_triangulation() {
+    bool failed_step = false;
+
+    { // start the timer
+        SessionTimer corr_time_monitor(corr_time, global_timers_);
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int_t corr_error = 0;
+        int_t stereo_corr_error = 0;
+        if (deadline_ms_ > 0.0) {
+            apply_iteration_cap(deadline_scheduler_.plan(change_gate_.enabled() ? &change_gate_.skip_flags() : NULL));
+        }
+        // the deadline's flags already include the subsets the change gate carries over
+        std::vector<int_t> *skip = solve_skip_flags();
+        if (skip != NULL) {
+            apply_skip_flags(schema_, *skip);
+            if (main_data_.is_stereo)
+                apply_skip_flags(stereo_schema_, *skip);
+        }
+        // after the skip flags, a carried over or deferred subset keeps the solution it has
+        if (pyramid_initializer_.enabled())
+            initialize_from_pyramids(skip);
+        if (skip != NULL)
+            hold_skipped_solutions(*skip);
+        run_both_sides([&] {
+                           ScopedProbe probe(PROBE_CORRELATION_LEFT);
+                           corr_error = schema_->execute_correlation();
+                       },
+                       [&] {
+                           ScopedProbe probe(PROBE_CORRELATION_RIGHT);
+                           stereo_corr_error = stereo_schema_->execute_correlation();
+                       });
+        if (corr_error || stereo_corr_error)
+            failed_step = true;
+        if (skip != NULL)
+            restore_skipped_solutions(*skip, false);
+        const double solve_ms = elapsed_ms(start);
+        times_.correlation_ms += solve_ms;
+        if (change_gate_.enabled()) {
+            // the windows where the solved subsets are now, for the next frame to compare with
+            gate_views(gate_views_[0].frame, gate_views_[1].frame);
+            change_gate_.record(gate_views_[0], gate_views_[1], *skip);
+            *outStream << "Change gate: " << change_gate_.stats().last_carried << " subsets carried over, "
+                       << change_gate_.stats().last_solved << " solved" << std::endl;
+        }
+        update_tracking();
+        if (deadline_ms_ > 0.0)
+            deadline_scheduler_.record_solve(deadline_iterations_, solve_ms);
+        const chrono::steady_clock::time_point triangulation_start = chrono::steady_clock::now();
+        {
+            ScopedProbe probe(PROBE_TRIANGULATION);
+            schema_->execute_triangulation(triangulation_, stereo_schema_);
+            if (skip != NULL)
+                restore_skipped_solutions(*skip, true);
+        }
+        {
+            ScopedProbe probe(PROBE_POST_PROCESSING);
+            schema_->execute_post_processors();
+        }
+        fill_subset_store();
+        times_.triangulation_ms += elapsed_ms(triangulation_start);
+    }
+    const chrono::steady_clock::time_point output_start = chrono::steady_clock::now();
+    ScopedProbe output_probe(PROBE_OUTPUT);
+    write_output();
+    times_.output_ms += elapsed_ms(output_start);
+    return failed_step;
+}
+
+void CorrelationSession::write_output() {
+    const bool no_text_output = input_params_->get<bool>(DICe::no_text_output_files, false);
+    const bool output_stereo_files = input_params_->get<bool>(DICe::output_stereo_files, false);
+    SessionTimer write_time_monitor(write_time, global_timers_);
+    const bool queue_output = queued_output_ && result_writer_ != Teuchos::null;
+    if (queue_output && !no_text_output) {
+        queue_snapshot(schema_, main_data_.file_prefix);
+        if (main_data_.is_stereo && output_stereo_files)
+            queue_snapshot(stereo_schema_, main_data_.stereo_file_prefix);
+    } else if (!queue_output) {
+        schema_->write_output(main_data_.output_folder, main_data_.file_prefix,
+                              main_data_.separate_output_file_for_each_subset,
+                              main_data_.separate_header_file, no_text_output);
+    }
+    schema_->post_execution_tasks();
+    // print the timing data with or without verbose flag
+    if (input_params_->get<bool>(DICe::print_stats, false)) {
+        schema_->mesh()->print_field_stats();
+    }
+    if (main_data_.is_stereo) {
+        if (output_stereo_files && !queue_output) {
+            stereo_schema_->write_output(main_data_.output_folder, main_data_.stereo_file_prefix,
+                                         main_data_.separate_output_file_for_each_subset,
+                                         main_data_.separate_header_file, no_text_output);
+        }
+        stereo_schema_->post_execution_tasks();
+    }
+}
+
+void CorrelationSession::finish(bool failed_step) {
+    if (lead(COMMAND_FINISH)) {
+        int failed = failed_step ? 1 : 0;
+        broadcast_value(failed);
+    }
+    if (!is_setup_)
+        return;
+    if (result_writer_ != Teuchos::null)
+        result_writer_->flush();
+    if (frame_offset_ > 0)
+        return;
+    schema_->write_stats(main_data_.output_folder, main_data_.file_prefix);
+    if (main_data_.is_stereo)
+        stereo_schema_->write_stats(main_data_.output_folder, main_data_.stereo_file_prefix);
+
+    if (failed_step)
+        *outStream << "\n--- Failed Step Occurred ---\n" << std::endl;
+    else
+        *outStream << "\n--- Successful Completion ---\n" << std::endl;
+
+    // output timing
+    if (!global_timers_)
+        return;
+
+    // print the timing data with or without verbose flag
+    if (input_params_->get<bool>(DICe::print_timing, false)) {
+        Teuchos::TimeMonitor::summarize(*outStream, false, true, false/*zero timers*/);
+    }
+    //  write the time output to file:
+    std::stringstream timeFileName;
+    timeFileName << main_data_.output_folder << "timing." << main_data_.proc_size << "." << main_data_.proc_rank
+                 << ".txt";
+    std::ofstream ofs(timeFileName.str(), std::ofstream::out);
+    Teuchos::TimeMonitor::summarize(ofs, false, true, false/*zero timers*/);
+    ofs.close();
+    if (main_data_.proc_rank != 0) // only keep the process zero copy of the timing results
+        std::remove(timeFileName.str().c_str());
+}
@@ -0,0 +1,453 @@
+#ifndef CUSTOM_APP_CORRELATIONSESSION_H
+#define CUSTOM_APP_CORRELATIONSESSION_H
+
+#include <DICe.h>
+#include <DICe_Schema.h>
+#include <DICe_Triangulation.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <Teuchos_ParameterList.hpp>
+#include <Teuchos_RCP.hpp>
+#include <Teuchos_oblackholestream.hpp>
+
+#include "CalibrationCache.h"
+#include "ChangeGate.h"
+#include "CrossCorrelationCache.h"
+#include "DeadlineScheduler.h"
+#include "FeatureReseeder.h"
+#include "FrameConverter.h"
+#include "ImageCache.h"
+#include "ImagePrefetcher.h"
+#include "PyramidInitializer.h"
+#include "ResultWriter.h"
+#include "StereoRemap.h"
+#include "SubSetData.h"
+#include "ThreadPool.h"
+
+typedef struct{
+    int num_frames;
+    std::string file_prefix;
+    std::string stereo_file_prefix;
+    std::string output_folder;
+    bool is_stereo;
+    bool separate_output_file_for_each_subset;
+    bool separate_header_file;
+    int proc_size;
+    int proc_rank;
+}MainDataStructType;
+
+/* Wall time spent in each stage since the last setup(), in milliseconds */
+struct SessionTimes {
+    double setup_ms;
+    double cross_correlation_ms;
+    double image_load_ms;
+    double correlation_ms;
+    double triangulation_ms;
+    double output_ms;
+    double reseed_ms;
+
+    SessionTimes() :
+            setup_ms(0.0),
+            cross_correlation_ms(0.0),
+            image_load_ms(0.0),
+            correlation_ms(0.0),
+            triangulation_ms(0.0),
+            output_ms(0.0),
+            reseed_ms(0.0) {}
+};
+
+/* Solver effort and lost tracks since the last setup(), left and right subsets together */
+struct TrackingStats {
+    long subsets_solved;
+    long iterations;
+    long subsets_lost;
+    long subsets_reseeded;
+
+    TrackingStats() :
+            subsets_solved(0),
+            iterations(0),
+            subsets_lost(0),
+            subsets_reseeded(0) {}
+
+    double mean_iterations() const { return subsets_solved > 0 ? (double) iterations / subsets_solved : 0.0; }
+};
+
+/**
+ * Owns everything that only depends on the input files and the reference pair: the parameter
+ * lists, the triangulation, the left and right schemas and the cross-correlation result.
+ * setup() does the expensive work once, after that each stereo pair only swaps the deformed
+ * images and runs the correlation and triangulation.
+ *
+ * Under mpirun DICe splits the subsets over the ranks. Every rank builds the same session,
+ * rank 0 drives it and the others sit in follow(), which repeats each setup/reset/correlate/
+ * finish call of rank 0 so the collective DICe calls line up.
+ */
+class CorrelationSession {
+public:
+    /** overrides are applied on top of the parameters read from input_file */
+    explicit CorrelationSession(const std::string &input_file = "input.xml",
+                                const Teuchos::RCP<Teuchos::ParameterList> &overrides = Teuchos::null);
+
+    /** Hands the triangulation back to the calibration cache */
+    ~CorrelationSession();
+
+    /** Parse the inputs, read the calibration, build the schemas and run the cross-correlation */
+    void setup();
+
+    /** Drop the schemas so the next setup() picks up a new reference pair */
+    void reset();
+
+    bool is_setup() const { return is_setup_; }
+
+    /** Also keep cross-correlation results on disk in folder so later runs can reuse them */
+    void set_cross_correlation_cache_folder(const std::string &folder) { cross_cache_->set_folder(folder); }
+
+    /** Take cross-correlation results from cache, shared with other sessions, instead of a private one */
+    void set_cross_correlation_cache(const Teuchos::RCP<CrossCorrelationCache> &cache) { cross_cache_ = cache; }
+
+    /** Borrow the calibration from cache, parsed by an earlier session with the same file; null parses it every setup() */
+    void set_calibration_cache(const Teuchos::RCP<CalibrationCache> &cache) { calibration_cache_ = cache; }
+
+    /**
+     * For a session that takes over the image list after image offset: its frames are numbered
+     * from offset + 1 in the output, and finish() leaves the stats and timing files to the session
+     * that started at the beginning.
+     */
+    void set_frame_offset(int_t offset) { frame_offset_ = offset; }
+
+    /**
+     * Time setup, the frames and the output on Teuchos' process wide counters and write them to the
+     * timing file in finish(), on by default. Off for sessions running on several threads at once,
+     * the counters are shared and not thread safe; the session's own frame times are kept either way.
+     */
+    void set_global_timers(bool enabled) { global_timers_ = enabled; }
+
+    /**
+     * Load and correlate the left and right images of a pair at the same time (the default). The two
+     * schemas only meet in the triangulation so the results are the same either way, serial is
+     * there for profiling and for ruling out the threads when chasing a problem.
+     */
+    void set_parallel_stereo(bool parallel) { parallel_stereo_ = parallel; }
+
+    bool parallel_stereo() const { return parallel_stereo_; }
+
+    /**
+     * Tracking mode: every subset starts from the solution of the previous frame
+     * (USE_FIELD_VALUES) instead of the initializer in the parameters file. Subsets whose SIGMA,
+     * GAMMA or STATUS_FLAG show the track was lost are reseeded by feature matching on the next
+     * frame, as is every subset on the first frame after setup(). Takes effect at the next setup().
+     */
+    void set_tracking(bool tracking) { tracking_ = tracking; }
+
+    bool tracking() const { return tracking_; }
+
+    /** A subset whose GAMMA comes out above this counts as lost */
+    void set_tracking_gamma_threshold(scalar_t threshold) { tracking_gamma_threshold_ = threshold; }
+
+    /**
+     * Copy the output_spec fields out after each frame and leave the formatting and the file I/O
+     * to a ResultWriter thread, instead of Schema::write_output on the correlation thread. The
+     * text files hold the same columns in one file per frame, but without DICe's run information
+     * (the header, or the separate file with create_separate_run_info_file). With
+     * separate_output_file_for_each_subset DICe still writes the text output itself.
+     * Takes effect at the next setup().
+     */
+    void set_async_output(bool async_output) { async_output_ = async_output; }
+
+    bool async_output() const { return async_output_; }
+
+    /**
+     * RESULT_BINARY appends every frame to <prefix>.dres in the output folder instead of a text
+     * file per frame, see ResultFile.h. It always goes through the ResultWriter thread.
+     * Takes effect at the next setup().
+     */
+    void set_output_format(ResultFormat format) { output_format_ = format; }
+
+    ResultFormat output_format() const { return output_format_; }
+
+    /**
+     * In-memory frames: convert only the crop around the subsets instead of the whole frame.
+     * The crop is the bounding box of the subsets where they are now and where they started,
+     * padded by half the subset, half the VSG strain window, half the Gauss filter and margin
+     * pixels for the motion expected before the next frame. DICe still gets an image the size of
+     * the frame, zero outside the crop, so every result stays in full-frame pixels. Takes effect
+     * at the next setup().
+     */
+    void set_roi_crop(bool roi_crop, int_t margin = 32) {
+        roi_crop_ = roi_crop;
+        roi_margin_ = margin;
+    }
+
+    bool roi_crop() const { return roi_crop_; }
+
+    /** Pixels converted for DICe over pixels captured since the last setup(), 1 without cropping */
+    double roi_fraction() const { return frame_pixels_ > 0.0 ? roi_pixels_ / frame_pixels_ : 1.0; }
+
+    /**
+     * correlate_frame()/correlate_sequence(): decode up to lookahead pairs of the input file's
+     * image list ahead on worker threads, holding at most memory_cap_mb of decoded images, and
+     * hand them to DICe in memory. Zero turns it off. Takes effect at the next setup().
+     */
+    void set_prefetch(size_t lookahead, size_t memory_cap_mb = 512) {
+        prefetch_lookahead_ = lookahead;
+        prefetch_memory_cap_mb_ = memory_cap_mb;
+    }
+
+    size_t prefetch_lookahead() const { return prefetch_lookahead_; }
+
+    /**
+     * correlate_frame()/correlate_sequence(): read the input file's images through cache, so a
+     * rerun of the same sequence maps the decoded images instead of decoding the files again.
+     * Null (the default) leaves the reading to DICe unless prefetching is on.
+     */
+    void set_image_cache(const Teuchos::RCP<ImageCache> &cache) {
+        image_cache_ = cache;
+        prefetcher_ = Teuchos::null;
+    }
+
+    Teuchos::RCP<ImageCache> image_cache() const { return image_cache_; }
+
+    /** All zero until a frame has been taken from the prefetcher */
+    PrefetchStats prefetch_stats() const {
+        return prefetcher_ != Teuchos::null ? prefetcher_->stats() : PrefetchStats();
+    }
+
+    /**
+     * Real-time mode: fit every frame into budget_ms by capping the solver iterations and, when
+     * that is not enough, deferring the lowest ranked subsets to a later frame, see
+     * DeadlineScheduler. Subsets named on a "# PRIORITY_SUBSETS" line of the subset file are
+     * never deferred. A deferred subset keeps its last solution; the results go through the
+     * ResultWriter with an extra STALE_FRAMES column. Zero turns it off. Takes effect at the
+     * next setup().
+     */
+    void set_deadline(double budget_ms) { deadline_ms_ = budget_ms; }
+
+    double deadline_ms() const { return deadline_ms_; }
+
+    /** All zero unless a deadline is set */
+    DeadlineStats deadline_stats() const {
+        return deadline_ms_ > 0.0 ? deadline_scheduler_.stats() : DeadlineStats();
+    }
+
+    /**
+     * Change detection: before each frame, compare every subset's window with the one it was last
+     * solved on, see ChangeGate. Subsets whose mean absolute difference stays at or under
+     * threshold (8 bit grey levels) on both cameras keep their last solution and skip the solver;
+     * the results go through the ResultWriter with an extra CARRIED_OVER column. Not used with the
+     * incremental formulation, whose reference moves every frame. Zero turns it off. Takes
+     * effect at the next setup().
+     */
+    void set_change_gate(double threshold) { change_threshold_ = threshold; }
+
+    double change_threshold() const { return change_threshold_; }
+
+    /** All zero unless the change gate is on */
+    ChangeGateStats change_gate_stats() const {
+        return change_gate_.enabled() ? change_gate_.stats() : ChangeGateStats();
+    }
+
+    /**
+     * Start every subset from a coarse-to-fine ZNCC search over num_levels image pyramid levels
+     * instead of the parameters file's initializer, see PyramidInitializer. The reference
+     * pyramids are built once at setup() and, when the stereo remap has rectified the right
+     * image, also seed the cross-correlation; each frame's are built once per camera. In tracking mode only the lost subsets are searched, in place of the
+     * feature matching reseed. Not used with the incremental formulation. Zero turns it off.
+     * Takes effect at the next setup().
+     */
+    void set_pyramid_initializer(int num_levels, int search_radius = 8) {
+        pyramid_levels_ = num_levels;
+        pyramid_search_radius_ = search_radius;
+    }
+
+    int pyramid_levels() const { return pyramid_levels_; }
+
+    /** All zero unless the pyramid initializer is on */
+    const PyramidStats &pyramid_stats() const { return pyramid_stats_; }
+
+    /** DICe intensity buffers the frame converters had to allocate since the session was made */
+    size_t image_buffer_allocations() const { return left_converter_.allocations() + right_converter_.allocations(); }
+
+    /** All zero unless async output is on */
+    ResultWriterStats output_stats() const;
+
+    /**
+     * Ready after setup() when the parameters ask for the nonlinear projection: the right images
+     * are then resampled into the left frame through this table rather than by DICe.
+     */
+    const StereoRemap &stereo_remap() const { return stereo_remap_; }
+
+    /** True if the last setup() took the cross-correlation solve from the cache, the set up around it still runs */
+    bool cross_correlation_cached() const { return cross_correlation_cached_; }
+
+    /** Correlate deformed frame image_it of the image list given in the input file */
+    bool correlate_frame(int_t image_it);
+
+    /** Correlate every deformed frame in the input file, then write the stats and timing */
+    bool correlate_sequence();
+
+    /**
+     * Correlate an arbitrary stereo pair read from disk, kept for offline reruns. With the change gate,
+     * the pyramids or a lost track the pair is decoded once and goes through correlate_images()
+     */
+    bool correlate_files(const std::string &left_file, const std::string &right_file);
+
+    /** Correlate a stereo pair straight from the capture buffers, nothing touches the filesystem */
+    bool correlate_images(const cv::Mat &left_frame, const cv::Mat &right_frame);
+
+    /** Write the schema stats and the timing summary */
+    void finish(bool failed_step);
+
+    /** Ranks other than 0: mirror rank 0's calls until it calls release_followers() */
+    void follow();
+
+    /** Rank 0: let the ranks in follow() return, a no-op in a single process run */
+    void release_followers();
+
+    /** Every subset with the solution of the last frame, by global subset id. Only filled on rank 0 */
+    const SubSetData &subsets() const { return subsets_; }
+
+    Teuchos::RCP<DICe::Schema> schema() const { return schema_; }
+    Teuchos::RCP<DICe::Schema> stereo_schema() const { return stereo_schema_; }
+    Teuchos::RCP<DICe::Triangulation> triangulation() const { return triangulation_; }
+    Teuchos::RCP<Teuchos::ParameterList> input_params() const { return input_params_; }
+    Teuchos::RCP<Teuchos::ParameterList> correlation_params() const { return correlation_params_; }
+    const std::vector<std::string> &image_files() const { return image_files_; }
+    const std::vector<std::string> &stereo_image_files() const { return stereo_image_files_; }
+    const MainDataStructType &main_data() const { return main_data_; }
+
+    /** Number of pairs correlated since the last setup() */
+    int_t frame_count() const { return frame_count_; }
+    double setup_time_ms() const { return setup_time_ms_; }
+    double last_frame_time_ms() const { return last_frame_time_ms_; }
+    const SessionTimes &times() const { return times_; }
+    const TrackingStats &tracking_stats() const { return tracking_stats_; }
+
+private:
+    bool read_input_data_files();
+    void release_triangulation();
+    void information_extraction();
+    void run_cross_correlation();
+    void create_stereo_schema();
+    void prepare_stereo_remap();
+    void prepare_deadline();
+    void gather_stale_frames(std::vector<scalar_t> &gathered);
+    void prepare_change_gate();
+    void prepare_pyramids();
+    void build_frame_pyramids(const cv::Mat &left_frame, const cv::Mat &right_frame);
+    void initialize_from_pyramids(const std::vector<int_t> *skip);
+    void gate_views(const cv::Mat &left_frame, const cv::Mat &right_frame);
+    void gather_carried_over(std::vector<scalar_t> &gathered);
+    std::vector<int_t> *solve_skip_flags();
+    void apply_iteration_cap(int_t iteration_cap);
+    void hold_skipped_solutions(const std::vector<int_t> &skip);
+    void restore_skipped_solutions(const std::vector<int_t> &skip, bool model);
+    void apply_skip_flags(const Teuchos::RCP<DICe::Schema> &schema, const std::vector<int_t> &skip);
+    void prepare_frame(const std::string &label);
+    void run_both_sides(const std::function<void()> &left, const std::function<void()> &right);
+    bool lead(int command);
+    bool any_lost() const;
+    void reseed_lost_subsets(const cv::Mat &left_frame, const cv::Mat &right_frame);
+    void update_tracking();
+    void gather_subset_field(const DICe::field_enums::Field_Spec &spec, std::vector<scalar_t> &gathered);
+    void gather_subset_field(const Teuchos::RCP<DICe::Schema> &schema, const DICe::field_enums::Field_Spec &spec,
+                             std::vector<scalar_t> &gathered);
+    void prepare_async_output();
+    void prepare_roi();
+    cv::Rect frame_roi(const Teuchos::RCP<DICe::Schema> &schema, const cv::Mat &frame);
+    void load_def_image(const Teuchos::RCP<DICe::Schema> &schema, const cv::Mat &frame, const cv::Rect &roi,
+                        FrameConverter &converter);
+    void queue_snapshot(const Teuchos::RCP<DICe::Schema> &schema, const std::string &prefix);
+    void fill_subset_store();
+    bool run_correlation_and_triangulation();
+    void write_output();
+
+    std::string input_file_;
+    std::string cal_file_name_;
+    Teuchos::RCP<Teuchos::ParameterList> overrides_;
+    bool is_setup_;
+    int_t frame_count_;
+    double setup_time_ms_;
+    double last_frame_time_ms_;
+    SessionTimes times_;
+
+    Teuchos::RCP<DICe::Schema> schema_;
+    Teuchos::RCP<DICe::Schema> stereo_schema_;
+    Teuchos::RCP<DICe::Triangulation> triangulation_;
+    Teuchos::RCP<Teuchos::ParameterList> input_params_;
+    Teuchos::RCP<Teuchos::ParameterList> correlation_params_;
+    std::vector<std::string> image_files_;
+    std::vector<std::string> stereo_image_files_;
+    Teuchos::RCP<std::ostream> outStream;
+    Teuchos::oblackholestream blackhole_;
+    MainDataStructType main_data_;
+    Teuchos::RCP<CrossCorrelationCache> cross_cache_;
+    Teuchos::RCP<CalibrationCache> calibration_cache_;
+    int_t frame_offset_;
+    bool global_timers_;
+    bool cross_correlation_cached_;
+    FrameConverter left_converter_;
+    FrameConverter right_converter_;
+    bool parallel_stereo_;
+    Teuchos::RCP<ThreadPool> stereo_pool_;
+    std::vector<int_t> local_ids_;
+    std::vector<scalar_t> gather_values_;
+    std::vector<scalar_t> gathered_;
+    SubSetData subsets_;
+    bool tracking_;
+    scalar_t tracking_gamma_threshold_;
+    TrackingStats tracking_stats_;
+    FeatureReseeder left_reseeder_;
+    FeatureReseeder right_reseeder_;
+    std::vector<char> left_lost_;
+    std::vector<char> right_lost_;
+    bool async_output_;
+    /* frames go through result_writer_, decided at setup() */
+    bool queued_output_;
+    ResultFormat output_format_;
+    Teuchos::RCP<ResultWriter> result_writer_;
+    std::vector<DICe::field_enums::Field_Spec> output_fields_;
+    std::shared_ptr<const std::vector<std::string> > output_field_names_;
+    bool roi_crop_;
+    int_t roi_margin_;
+    int_t roi_padding_;
+    double roi_pixels_;
+    double frame_pixels_;
+    size_t prefetch_lookahead_;
+    size_t prefetch_memory_cap_mb_;
+    Teuchos::RCP<ImagePrefetcher> prefetcher_;
+    Teuchos::RCP<ImageCache> image_cache_;
+    cv::Mat cache_left_;
+    cv::Mat cache_right_;
+    StereoRemap stereo_remap_;
+    cv::Mat projected_right_reference_;
+    cv::Mat projected_right_;
+    double deadline_ms_;
+    DeadlineScheduler deadline_scheduler_;
+    std::vector<scalar_t> deadline_iterations_;
+    /* the correlation parameters with the deadline's iteration cap, DICe only takes it through set_params() */
+    Teuchos::RCP<Teuchos::ParameterList> capped_params_;
+    int_t applied_iteration_cap_;
+    std::map<int_t, std::vector<int_t> > skip_solve_frames_;
+    /* the solutions of the subsets not solved this frame, put back after DICe's pass over them */
+    std::vector<scalar_t> held_solutions_[2];
+    std::vector<scalar_t> held_model_;
+    double change_threshold_;
+    ChangeGate change_gate_;
+    GateView gate_views_[2];
+    int pyramid_levels_;
+    int pyramid_search_radius_;
+    PyramidInitializer pyramid_initializer_;
+    ImagePyramid left_reference_pyramid_;
+    ImagePyramid right_reference_pyramid_;
+    ImagePyramid left_pyramid_;
+    ImagePyramid right_pyramid_;
+    PyramidStats pyramid_stats_;
+};
+
+#endif //CUSTOM_APP_CORRELATIONSESSION_H
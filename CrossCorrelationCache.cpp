@@ -0,0 +1,170 @@
+#include "CrossCorrelationCache.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "FileHash.h"
+
+using namespace DICe::field_enums;
+using namespace std;
+
+static const char CACHE_MAGIC[4] = {'X', 'C', 'C', '1'};
+
+/* Everything the cross-correlation, save_cross_correlation_fields and the first triangulation leave behind */
+static const struct {
+    const char *name;
+    const Field_Spec *spec;
+} cached_fields[] = {
+        {"SUBSET_DISPLACEMENT_X", &SUBSET_DISPLACEMENT_X_FS},
+        {"SUBSET_DISPLACEMENT_Y", &SUBSET_DISPLACEMENT_Y_FS},
+        {"ROTATION_Z",            &ROTATION_Z_FS},
+        {"NORMAL_STRETCH_XX",     &NORMAL_STRETCH_XX_FS},
+        {"NORMAL_STRETCH_YY",     &NORMAL_STRETCH_YY_FS},
+        {"SHEAR_STRETCH_XY",      &SHEAR_STRETCH_XY_FS},
+        {"SIGMA",                 &SIGMA_FS},
+        {"GAMMA",                 &GAMMA_FS},
+        {"BETA",                  &BETA_FS},
+        {"MATCH",                 &MATCH_FS},
+        {"STATUS_FLAG",           &STATUS_FLAG_FS},
+        {"CROSS_CORR_Q",          &CROSS_CORR_Q_FS},
+        {"CROSS_CORR_R",          &CROSS_CORR_R_FS},
+        {"MODEL_COORDINATES_X",   &MODEL_COORDINATES_X_FS},
+        {"MODEL_COORDINATES_Y",   &MODEL_COORDINATES_Y_FS},
+        {"MODEL_COORDINATES_Z",   &MODEL_COORDINATES_Z_FS},
+};
+static const size_t num_cached_fields = sizeof(cached_fields) / sizeof(cached_fields[0]);
+
+CrossCorrelationCache::CrossCorrelationCache(const string &folder) :
+        folder_(folder) {}
+
+void CrossCorrelationCache::set_folder(const string &folder) {
+    lock_guard<mutex> lock(mutex_);
+    folder_ = folder;
+}
+
+uint64_t CrossCorrelationCache::make_key(const vector<string> &files) {
+    uint64_t key = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < files.size(); ++i) {
+        // the name goes in as well so swapping two inputs gives a different key
+        const size_t slash = files[i].find_last_of('/');
+        const string base_name = slash == string::npos ? files[i] : files[i].substr(slash + 1);
+        key = hash_bytes(base_name.data(), base_name.size(), key);
+        key = hash_file(files[i], key);
+    }
+    return key;
+}
+
+string CrossCorrelationCache::file_name(uint64_t key) const {
+    string folder = folder_;
+    if (!folder.empty() && folder[folder.size() - 1] != '/')
+        folder += "/";
+    return folder + "cross_correlation." + hash_to_string(key) + ".cache";
+}
+
+bool CrossCorrelationCache::restore(uint64_t key, const Teuchos::RCP<DICe::Schema> &schema) {
+    lock_guard<mutex> lock(mutex_);
+    map<uint64_t, CrossCorrelationEntry>::iterator it = entries_.find(key);
+    if (it == entries_.end()) {
+        CrossCorrelationEntry entry;
+        if (folder_.empty() || !load(key, entry))
+            return false;
+        it = entries_.insert(make_pair(key, entry)).first;
+    }
+    const CrossCorrelationEntry &entry = it->second;
+    if (entry.num_subsets != schema->local_num_subsets() || entry.field_names.size() != num_cached_fields)
+        return false;
+    for (size_t field_it = 0; field_it < num_cached_fields; ++field_it) {
+        if (entry.field_names[field_it] != cached_fields[field_it].name)
+            return false;
+    }
+    for (size_t field_it = 0; field_it < num_cached_fields; ++field_it) {
+        for (int_t subset_it = 0; subset_it < entry.num_subsets; ++subset_it) {
+            schema->local_field_value(subset_it, *cached_fields[field_it].spec) = entry.values[field_it][subset_it];
+        }
+    }
+    return true;
+}
+
+void CrossCorrelationCache::store(uint64_t key, const Teuchos::RCP<DICe::Schema> &schema) {
+    CrossCorrelationEntry entry;
+    entry.key = key;
+    entry.num_subsets = schema->local_num_subsets();
+    entry.values.resize(num_cached_fields);
+    for (size_t field_it = 0; field_it < num_cached_fields; ++field_it) {
+        entry.field_names.push_back(cached_fields[field_it].name);
+        entry.values[field_it].resize(entry.num_subsets);
+        for (int_t subset_it = 0; subset_it < entry.num_subsets; ++subset_it) {
+            entry.values[field_it][subset_it] = schema->local_field_value(subset_it, *cached_fields[field_it].spec);
+        }
+    }
+    lock_guard<mutex> lock(mutex_);
+    entries_[key] = entry;
+    if (!folder_.empty())
+        save(entry);
+}
+
+bool CrossCorrelationCache::load(uint64_t key, CrossCorrelationEntry &entry) const {
+    ifstream file(file_name(key).c_str(), ifstream::binary);
+    if (!file.is_open())
+        return false;
+    char magic[4];
+    int32_t num_subsets = 0;
+    int32_t num_fields = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&entry.key), sizeof(entry.key));
+    file.read(reinterpret_cast<char *>(&num_subsets), sizeof(num_subsets));
+    file.read(reinterpret_cast<char *>(&num_fields), sizeof(num_fields));
+    if (!file || string(magic, 4) != string(CACHE_MAGIC, 4) || entry.key != key || num_subsets < 0 ||
+        num_fields < 0)
+        return false;
+    entry.num_subsets = num_subsets;
+    entry.field_names.resize(num_fields);
+    entry.values.resize(num_fields);
+    for (int32_t field_it = 0; field_it < num_fields; ++field_it) {
+        int32_t name_length = 0;
+        file.read(reinterpret_cast<char *>(&name_length), sizeof(name_length));
+        if (!file || name_length < 0 || name_length > 256)
+            return false;
+        entry.field_names[field_it].resize(name_length);
+        file.read(&entry.field_names[field_it][0], name_length);
+        vector<double> values(num_subsets);
+        if (num_subsets > 0)
+            file.read(reinterpret_cast<char *>(&values[0]), num_subsets * sizeof(double));
+        entry.values[field_it].assign(values.begin(), values.end());
+    }
+    return (bool) file;
+}
+
+void CrossCorrelationCache::save(const CrossCorrelationEntry &entry) const {
+    const string name = file_name(entry.key);
+    // written under a temporary name and renamed, a batch lane in another process may be loading it
+    const string temp_name = name + ".tmp." + to_string(getpid());
+    ofstream file(temp_name.c_str(), ofstream::binary | ofstream::trunc);
+    if (!file.is_open()) {
+        cout << "Cannot write the cross-correlation cache " << name << endl;
+        return;
+    }
+    const int32_t num_subsets = entry.num_subsets;
+    const int32_t num_fields = entry.field_names.size();
+    file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    file.write(reinterpret_cast<const char *>(&entry.key), sizeof(entry.key));
+    file.write(reinterpret_cast<const char *>(&num_subsets), sizeof(num_subsets));
+    file.write(reinterpret_cast<const char *>(&num_fields), sizeof(num_fields));
+    for (int32_t field_it = 0; field_it < num_fields; ++field_it) {
+        const int32_t name_length = entry.field_names[field_it].size();
+        file.write(reinterpret_cast<const char *>(&name_length), sizeof(name_length));
+        file.write(entry.field_names[field_it].data(), name_length);
+        // always stored as double so float and double builds can share a cache
+        const vector<double> values(entry.values[field_it].begin(), entry.values[field_it].end());
+        if (num_subsets > 0)
+            file.write(reinterpret_cast<const char *>(&values[0]), num_subsets * sizeof(double));
+    }
+    file.close();
+    if (!file || rename(temp_name.c_str(), name.c_str()) != 0) {
+        unlink(temp_name.c_str());
+        cout << "Cannot write the cross-correlation cache " << name << endl;
+    }
+}
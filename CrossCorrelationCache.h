@@ -0,0 +1,59 @@
+#ifndef CUSTOM_APP_CROSSCORRELATIONCACHE_H
+#define CUSTOM_APP_CROSSCORRELATIONCACHE_H
+
+#include <DICe.h>
+#include <DICe_Schema.h>
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <Teuchos_RCP.hpp>
+
+/* The left schema fields as they stand after the cross-correlation and the initial triangulation */
+struct CrossCorrelationEntry {
+    uint64_t key;
+    int_t num_subsets;
+    std::vector<std::string> field_names;
+    std::vector<std::vector<scalar_t> > values;
+};
+
+/**
+ * Keeps the result of the left/right cross-correlation so a session set up again with the same
+ * reference pair, calibration and parameters can skip it. Entries live in memory for the life of
+ * the cache and, when a folder is given, in one file per key in that folder. An entry holds the
+ * local subsets of one rank, so under MPI the key has to tell the ranks apart. Safe to share
+ * between sessions on different threads, and through the folder between processes.
+ */
+class CrossCorrelationCache {
+public:
+    explicit CrossCorrelationCache(const std::string &folder = "");
+
+    void set_folder(const std::string &folder);
+
+    /**
+     * Content hash of every file the cross-correlation depends on. The folders are left out, so
+     * copies of a dataset in different directories share an entry.
+     */
+    static uint64_t make_key(const std::vector<std::string> &files);
+
+    /** Copy a cached result into the schema fields, false if there is no usable entry for key */
+    bool restore(uint64_t key, const Teuchos::RCP<DICe::Schema> &schema);
+
+    void store(uint64_t key, const Teuchos::RCP<DICe::Schema> &schema);
+
+private:
+    std::string file_name(uint64_t key) const;
+
+    bool load(uint64_t key, CrossCorrelationEntry &entry) const;
+
+    void save(const CrossCorrelationEntry &entry) const;
+
+    std::string folder_;
+    std::map<uint64_t, CrossCorrelationEntry> entries_;
+    mutable std::mutex mutex_;
+};
+
+#endif //CUSTOM_APP_CROSSCORRELATIONCACHE_H
@@ -0,0 +1,147 @@
+#include "DeadlineScheduler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+/* weight of the newest frame in the smoothed costs */
+static const double SMOOTHING = 0.25;
+
+static double smooth(double average, double sample) {
+    return average <= 0.0 ? sample : average + SMOOTHING * (sample - average);
+}
+
+/* A slow frame is believed at once, a fast one only bit by bit: missing the deadline is worse */
+static double smooth_cost(double average, double sample) {
+    return sample > average ? sample : smooth(average, sample);
+}
+
+DeadlineScheduler::DeadlineScheduler() :
+        budget_ms_(0.0),
+        max_iterations_(25),
+        min_iterations_(5),
+        iteration_ms_(0.0),
+        overhead_ms_(0.0),
+        last_solve_ms_(0.0) {}
+
+void DeadlineScheduler::configure(double budget_ms, int_t max_iterations, int_t min_iterations) {
+    budget_ms_ = budget_ms;
+    max_iterations_ = std::max((int_t) 1, max_iterations);
+    min_iterations_ = std::max((int_t) 1, std::min(min_iterations, max_iterations_));
+}
+
+void DeadlineScheduler::reset(const vector<char> &priority) {
+    priority_ = priority;
+    skip_.assign(priority.size(), 0);
+    stale_.assign(priority.size(), 0);
+    iterations_.assign(priority.size(), 0.0);
+    order_.resize(priority.size());
+    iteration_ms_ = 0.0;
+    overhead_ms_ = 0.0;
+    last_solve_ms_ = 0.0;
+    stats_ = DeadlineStats();
+    stats_.budget_ms = budget_ms_;
+    stats_.last_iteration_cap = max_iterations_;
+}
+
+double DeadlineScheduler::predicted_ms(int_t iteration_cap, const vector<int_t> *carried) const {
+    double units = 0.0;
+    for (size_t i = 0; i < iterations_.size(); ++i)
+        if (carried == NULL || !(*carried)[i])
+            units += 1.0 + std::min(iterations_[i], (double) iteration_cap);
+    return units * iteration_ms_;
+}
+
+int_t DeadlineScheduler::plan(const vector<int_t> *carried) {
+    if (carried != NULL)
+        skip_ = *carried;
+    else
+        std::fill(skip_.begin(), skip_.end(), 0);
+    int_t cap = max_iterations_;
+    // nothing measured yet, the first frame runs in full and gives the model its numbers
+    if (iteration_ms_ > 0.0) {
+        const double available = budget_ms_ - overhead_ms_;
+        while (cap > min_iterations_ && predicted_ms(cap, carried) > available)
+            cap = std::max(min_iterations_, cap / 2);
+        if (predicted_ms(cap, carried) > available) {
+            for (size_t i = 0; i < order_.size(); ++i)
+                order_[i] = i;
+            const vector<char> &priority = priority_;
+            const vector<int> &stale = stale_;
+            stable_sort(order_.begin(), order_.end(), [&priority, &stale](size_t a, size_t b) {
+                if (priority[a] != priority[b])
+                    return priority[a] > priority[b];
+                return stale[a] > stale[b];
+            });
+            double spent = 0.0;
+            for (size_t rank = 0; rank < order_.size(); ++rank) {
+                const size_t i = order_[rank];
+                if (skip_[i])
+                    continue;
+                const double cost = (1.0 + std::min(iterations_[i], (double) cap)) * iteration_ms_;
+                if (priority_[i] || spent + cost <= available)
+                    spent += cost;
+                else
+                    skip_[i] = 1;
+            }
+        }
+    }
+    int_t deferred = 0;
+    for (size_t i = 0; i < skip_.size(); ++i) {
+        const bool is_deferred = skip_[i] && (carried == NULL || !(*carried)[i]);
+        stale_[i] = is_deferred ? stale_[i] + 1 : 0;
+        deferred += is_deferred;
+    }
+    stats_.last_deferred = deferred;
+    stats_.subsets_deferred += deferred;
+    stats_.last_iteration_cap = cap;
+    if (cap < max_iterations_)
+        ++stats_.frames_capped;
+    return cap;
+}
+
+void DeadlineScheduler::record_solve(const vector<scalar_t> &iterations, double solve_ms) {
+    double units = 0.0;
+    for (size_t i = 0; i < iterations_.size() && i < iterations.size(); ++i) {
+        if (skip_[i])
+            continue;
+        iterations_[i] = smooth(iterations_[i], iterations[i]);
+        units += 1.0 + iterations[i];
+    }
+    if (units > 0.0)
+        iteration_ms_ = smooth_cost(iteration_ms_, solve_ms / units);
+    last_solve_ms_ = solve_ms;
+}
+
+void DeadlineScheduler::record_frame(double frame_ms) {
+    overhead_ms_ = smooth_cost(overhead_ms_, std::max(0.0, frame_ms - last_solve_ms_));
+    const double used = budget_ms_ > 0.0 ? frame_ms / budget_ms_ : 0.0;
+    ++stats_.frames;
+    if (used > 1.0)
+        ++stats_.frames_over_budget;
+    stats_.last_budget_used = used;
+    stats_.total_budget_used += used;
+    if (used > stats_.max_budget_used)
+        stats_.max_budget_used = used;
+}
+
+vector<int_t> DeadlineScheduler::read_priority_subsets(const string &subset_file) {
+    vector<int_t> ids;
+    ifstream file(subset_file.c_str());
+    string line;
+    while (getline(file, line)) {
+        const size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos || line[start] != '#')
+            continue;
+        istringstream words(line.substr(start + 1));
+        string keyword;
+        if (!(words >> keyword) || keyword != "PRIORITY_SUBSETS")
+            continue;
+        int_t id;
+        while (words >> id)
+            ids.push_back(id);
+    }
+    return ids;
+}
@@ -0,0 +1,107 @@
+#ifndef CUSTOM_APP_DEADLINESCHEDULER_H
+#define CUSTOM_APP_DEADLINESCHEDULER_H
+
+#include <DICe.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* How the frames since the last reset() went against the budget */
+struct DeadlineStats {
+    double budget_ms;
+    long frames;
+    long frames_over_budget;
+    /* frames solved with fewer than the configured solver iterations */
+    long frames_capped;
+    /* deferred subsets summed over the frames */
+    long subsets_deferred;
+    int_t last_deferred;
+    int_t last_iteration_cap;
+    /* frame time over budget, 1 is exactly on time */
+    double last_budget_used;
+    double max_budget_used;
+    double total_budget_used;
+
+    DeadlineStats() :
+            budget_ms(0.0),
+            frames(0),
+            frames_over_budget(0),
+            frames_capped(0),
+            subsets_deferred(0),
+            last_deferred(0),
+            last_iteration_cap(0),
+            last_budget_used(0.0),
+            max_budget_used(0.0),
+            total_budget_used(0.0) {}
+
+    double mean_budget_used() const { return frames > 0 ? total_budget_used / frames : 0.0; }
+};
+
+/**
+ * Fits each frame's correlation into a latency budget. The cost of a frame is predicted from the
+ * last ones: a fixed part for loading, triangulation and output, plus a cost per solver
+ * iteration times the iterations each subset took lately. When the prediction does not fit the
+ * solver iterations are capped, halving down to min_iterations, and if that is still too slow the
+ * subsets at the end of the ranking are deferred. Priority subsets come first and are never
+ * deferred, then the subsets that have been deferred longest, so every subset is solved again
+ * sooner or later. A deferred subset keeps its last solution and counts as stale.
+ */
+class DeadlineScheduler {
+public:
+    DeadlineScheduler();
+
+    /** Budget per frame and the solver iteration range to work in */
+    void configure(double budget_ms, int_t max_iterations, int_t min_iterations = 5);
+
+    /** Forget the cost model, priority has one flag per local subset */
+    void reset(const std::vector<char> &priority);
+
+    /**
+     * Decide the next frame, returns the solver iteration cap and fills skip_flags(). Subsets
+     * flagged in carried keep a solution that is still current (see ChangeGate): they are skipped
+     * but cost nothing and do not go stale.
+     */
+    int_t plan(const std::vector<int_t> *carried = NULL);
+
+    /** 1 for every local subset deferred or carried over by the last plan() */
+    std::vector<int_t> &skip_flags() { return skip_; }
+
+    /** Frames since each local subset was last solved, 0 if it was solved in the last plan() */
+    const std::vector<int> &stale_frames() const { return stale_; }
+
+    /** Solver iterations of every local subset in the frame just solved and the time the solve took */
+    void record_solve(const std::vector<scalar_t> &iterations, double solve_ms);
+
+    /** Wall time of the whole frame, loading and output included */
+    void record_frame(double frame_ms);
+
+    const DeadlineStats &stats() const { return stats_; }
+
+    /**
+     * Subset ids listed after PRIORITY_SUBSETS in a comment line of a DICe subset file, e.g.
+     * "# PRIORITY_SUBSETS 0 3 7". DICe skips comments so the file stays valid for it.
+     */
+    static std::vector<int_t> read_priority_subsets(const std::string &subset_file);
+
+private:
+    double predicted_ms(int_t iteration_cap, const std::vector<int_t> *carried) const;
+
+    double budget_ms_;
+    int_t max_iterations_;
+    int_t min_iterations_;
+    std::vector<char> priority_;
+    std::vector<int_t> skip_;
+    std::vector<int> stale_;
+    /* recent solver iterations of each subset, smoothed */
+    std::vector<double> iterations_;
+    std::vector<size_t> order_;
+    /* smoothed cost of one subset iteration, the subset setup counts as one more */
+    double iteration_ms_;
+    /* smoothed frame time outside the solve */
+    double overhead_ms_;
+    double last_solve_ms_;
+    DeadlineStats stats_;
+};
+
+#endif //CUSTOM_APP_DEADLINESCHEDULER_H
@@ -0,0 +1,102 @@
+#include "FeatureReseeder.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DICe::field_enums;
+using namespace cv;
+using namespace std;
+
+/* Lowe's ratio test, a match only counts if it is clearly better than the runner up */
+static const float MATCH_RATIO = 0.8f;
+/* Fewer matches than this around a subset and the median of the whole frame is used instead */
+static const size_t MIN_LOCAL_MATCHES = 3;
+
+static scalar_t median(vector<scalar_t> &values) {
+    nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+FeatureReseeder::FeatureReseeder(int max_features) :
+        detector_(ORB::create(max_features)),
+        matcher_(NORM_HAMMING) {}
+
+void FeatureReseeder::set_reference(const Mat &reference) {
+    reference_keypoints_.clear();
+    reference_descriptors_.release();
+    if (!reference.empty())
+        detect(reference, reference_keypoints_, reference_descriptors_);
+}
+
+void FeatureReseeder::detect(const Mat &image, vector<KeyPoint> &keypoints, Mat &descriptors) {
+    // ORB wants 8 bit grayscale, the tif sequences are 16 bit and DICe hands over floating point
+    const Mat *gray = &image;
+    if (image.channels() == 3) {
+        cvtColor(image, gray_, COLOR_BGR2GRAY);
+        gray = &gray_;
+    }
+    if (gray->depth() != CV_8U) {
+        Mat scaled;
+        normalize(*gray, scaled, 0, 255, NORM_MINMAX, CV_8U);
+        gray_ = scaled;
+        gray = &gray_;
+    }
+    detector_->detectAndCompute(*gray, noArray(), keypoints, descriptors);
+}
+
+int_t FeatureReseeder::reseed(const Mat &frame, const Teuchos::RCP<DICe::Schema> &schema, const vector<char> &lost) {
+    if (!has_reference() || find(lost.begin(), lost.end(), 1) == lost.end())
+        return 0;
+    vector<KeyPoint> keypoints;
+    Mat descriptors;
+    detect(frame, keypoints, descriptors);
+    if (descriptors.empty())
+        return 0;
+    vector<vector<DMatch> > matches;
+    matcher_.knnMatch(descriptors, reference_descriptors_, matches, 2);
+
+    vector<Point2f> origins;
+    vector<scalar_t> all_dx;
+    vector<scalar_t> all_dy;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        if (matches[i].size() < 2 || matches[i][0].distance >= MATCH_RATIO * matches[i][1].distance)
+            continue;
+        const Point2f &from = reference_keypoints_[matches[i][0].trainIdx].pt;
+        const Point2f &to = keypoints[matches[i][0].queryIdx].pt;
+        origins.push_back(from);
+        all_dx.push_back(to.x - from.x);
+        all_dy.push_back(to.y - from.y);
+    }
+    if (origins.empty())
+        return 0;
+    vector<scalar_t> dx(all_dx);
+    vector<scalar_t> dy(all_dy);
+    const scalar_t frame_dx = median(dx);
+    const scalar_t frame_dy = median(dy);
+
+    const float radius = std::max(2 * schema->subset_dim(), (int_t) 20);
+    int_t seeded = 0;
+    for (int_t subset_it = 0; subset_it < schema->local_num_subsets() && subset_it < (int_t) lost.size(); ++subset_it) {
+        if (!lost[subset_it])
+            continue;
+        const float cx = schema->local_field_value(subset_it, SUBSET_COORDINATES_X_FS);
+        const float cy = schema->local_field_value(subset_it, SUBSET_COORDINATES_Y_FS);
+        dx.clear();
+        dy.clear();
+        for (size_t i = 0; i < origins.size(); ++i) {
+            if (fabs(origins[i].x - cx) <= radius && fabs(origins[i].y - cy) <= radius) {
+                dx.push_back(all_dx[i]);
+                dy.push_back(all_dy[i]);
+            }
+        }
+        const bool local = dx.size() >= MIN_LOCAL_MATCHES;
+        schema->local_field_value(subset_it, SUBSET_DISPLACEMENT_X_FS) = local ? median(dx) : frame_dx;
+        schema->local_field_value(subset_it, SUBSET_DISPLACEMENT_Y_FS) = local ? median(dy) : frame_dy;
+        schema->local_field_value(subset_it, ROTATION_Z_FS) = 0.0;
+        schema->local_field_value(subset_it, NORMAL_STRETCH_XX_FS) = 0.0;
+        schema->local_field_value(subset_it, NORMAL_STRETCH_YY_FS) = 0.0;
+        schema->local_field_value(subset_it, SHEAR_STRETCH_XY_FS) = 0.0;
+        ++seeded;
+    }
+    return seeded;
+}
@@ -0,0 +1,43 @@
+#ifndef CUSTOM_APP_FEATURERESEEDER_H
+#define CUSTOM_APP_FEATURERESEEDER_H
+
+#include <DICe.h>
+#include <DICe_Schema.h>
+
+#include <vector>
+
+#include <Teuchos_RCP.hpp>
+
+#include "opencv2/opencv.hpp"
+
+/**
+ * Feature matching fallback for the tracking mode. The reference features are found once, then
+ * only the subsets whose track was lost get a new starting displacement from the features matched
+ * around them, every other subset keeps the solution of the previous frame as its starting point.
+ */
+class FeatureReseeder {
+public:
+    explicit FeatureReseeder(int max_features = 2000);
+
+    void set_reference(const cv::Mat &reference);
+
+    bool has_reference() const { return !reference_descriptors_.empty(); }
+
+    /**
+     * Overwrite the displacement and strain fields of every subset with lost[i] set, using the
+     * median motion of the features matched near it between the reference and frame. Returns the
+     * number of subsets that were given a new seed.
+     */
+    int_t reseed(const cv::Mat &frame, const Teuchos::RCP<DICe::Schema> &schema, const std::vector<char> &lost);
+
+private:
+    void detect(const cv::Mat &image, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
+
+    cv::Ptr<cv::ORB> detector_;
+    cv::BFMatcher matcher_;
+    cv::Mat gray_;
+    std::vector<cv::KeyPoint> reference_keypoints_;
+    cv::Mat reference_descriptors_;
+};
+
+#endif //CUSTOM_APP_FEATURERESEEDER_H
@@ -0,0 +1,38 @@
+#include "FileHash.h"
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t hash_file(const string &file_name, uint64_t seed) {
+    ifstream file(file_name.c_str(), ifstream::binary);
+    if (!file.is_open())
+        return seed;
+    uint64_t hash = seed;
+    vector<char> buffer(1 << 16);
+    while (file) {
+        file.read(&buffer[0], buffer.size());
+        hash = hash_bytes(&buffer[0], file.gcount(), hash);
+    }
+    return hash;
+}
+
+string hash_to_string(uint64_t hash) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long) hash);
+    return string(text);
+}
@@ -0,0 +1,19 @@
+#ifndef CUSTOM_APP_FILEHASH_H
+#define CUSTOM_APP_FILEHASH_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+/* 64 bit FNV-1a, chained through seed so several inputs can make up one key */
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = FNV_OFFSET_BASIS);
+
+/** Hash of the file contents, the seed is returned unchanged if the file cannot be read */
+uint64_t hash_file(const std::string &file_name, uint64_t seed = FNV_OFFSET_BASIS);
+
+/** Key as 16 hex digits for use in file names */
+std::string hash_to_string(uint64_t hash);
+
+#endif //CUSTOM_APP_FILEHASH_H
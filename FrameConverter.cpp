@@ -0,0 +1,77 @@
+#include "FrameConverter.h"
+
+#include <stdexcept>
+
+#include <Teuchos_TestForException.hpp>
+
+using namespace cv;
+
+/* The deformed image of this frame, the one before it as the incremental reference, one spare */
+static const size_t max_intensity_buffers = 4;
+
+Teuchos::ArrayRCP<intensity_t> FrameConverter::convert(const Mat &frame) {
+    TEUCHOS_TEST_FOR_EXCEPTION(frame.empty(), std::runtime_error, "Error, cannot convert an empty frame");
+    const Teuchos::ArrayRCP<intensity_t>::size_type num_pixels = frame.rows * frame.cols;
+
+    /* Same layout as DICe, keep the Mat alive inside the array and hand over the pixels as they are */
+    if (frame.type() == INTENSITY_CV_TYPE && frame.isContinuous()) {
+        return Teuchos::arcpWithEmbeddedObj(reinterpret_cast<intensity_t *>(frame.data), 0, num_pixels, frame,
+                                            false);
+    }
+
+    /* Convert straight into the DICe buffer, the Mat header only borrows the memory */
+    Teuchos::ArrayRCP<intensity_t> intensities = intensity_buffer(num_pixels);
+    Mat target(frame.rows, frame.cols, INTENSITY_CV_TYPE, intensities.getRawPtr());
+    grayscale(frame).convertTo(target, INTENSITY_CV_TYPE);
+    return intensities;
+}
+
+Teuchos::ArrayRCP<intensity_t> FrameConverter::convert(const Mat &frame, const Rect &roi) {
+    if (roi.width == frame.cols && roi.height == frame.rows)
+        return convert(frame);
+    TEUCHOS_TEST_FOR_EXCEPTION(frame.empty(), std::runtime_error, "Error, cannot convert an empty frame");
+    Teuchos::ArrayRCP<intensity_t> intensities = intensity_buffer(frame.rows * frame.cols);
+    Mat target(frame.rows, frame.cols, INTENSITY_CV_TYPE, intensities.getRawPtr());
+    /* A recycled buffer still holds an earlier frame, clear the bands around the crop */
+    target(Rect(0, 0, frame.cols, roi.y)).setTo(Scalar::all(0));
+    target(Rect(0, roi.y + roi.height, frame.cols, frame.rows - roi.y - roi.height)).setTo(Scalar::all(0));
+    target(Rect(0, roi.y, roi.x, roi.height)).setTo(Scalar::all(0));
+    target(Rect(roi.x + roi.width, roi.y, frame.cols - roi.x - roi.width, roi.height)).setTo(Scalar::all(0));
+    Mat crop = target(roi);
+    grayscale(frame(roi)).convertTo(crop, INTENSITY_CV_TYPE);
+    return intensities;
+}
+
+const Mat &FrameConverter::grayscale(const Mat &frame) {
+    if (frame.channels() == 3) {
+        cvtColor(frame, gray_, COLOR_BGR2GRAY);
+        return gray_;
+    }
+    if (frame.channels() == 4) {
+        cvtColor(frame, gray_, COLOR_BGRA2GRAY);
+        return gray_;
+    }
+    TEUCHOS_TEST_FOR_EXCEPTION(frame.channels() != 1, std::runtime_error,
+                               "Error, unsupported number of channels " << frame.channels());
+    return frame;
+}
+
+Teuchos::ArrayRCP<intensity_t> FrameConverter::intensity_buffer(Teuchos::ArrayRCP<intensity_t>::size_type num_pixels) {
+    // nobody but the converter holds a free buffer, DICe lets go of it with the image made from it
+    size_t replace = buffers_.size();
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+        if (buffers_[i].strong_count() != 1)
+            continue;
+        if (buffers_[i].size() >= num_pixels)
+            return buffers_[i].persistingView(0, num_pixels);
+        replace = i;
+    }
+    // some room to spare, a crop around moving subsets changes size a little from frame to frame
+    Teuchos::ArrayRCP<intensity_t> buffer(num_pixels + num_pixels / 8);
+    ++allocations_;
+    if (buffers_.size() < max_intensity_buffers)
+        buffers_.push_back(buffer);
+    else if (replace < buffers_.size())
+        buffers_[replace] = buffer;
+    return buffer.persistingView(0, num_pixels);
+}
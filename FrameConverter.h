@@ -0,0 +1,48 @@
+#ifndef CUSTOM_APP_FRAMECONVERTER_H
+#define CUSTOM_APP_FRAMECONVERTER_H
+
+#include <DICe.h>
+
+#include <cstddef>
+#include <vector>
+
+#include <Teuchos_ArrayRCP.hpp>
+
+#include "opencv2/opencv.hpp"
+
+/* OpenCV type matching the DICe intensity_t layout */
+#if DICE_USE_DOUBLE
+#  define INTENSITY_CV_TYPE CV_64FC1
+#else
+#  define INTENSITY_CV_TYPE CV_32FC1
+#endif
+
+/**
+ * Turns captured frames into DICe intensity arrays without going through the filesystem.
+ * Colour frames are converted to grayscale and written straight into the DICe buffer, a frame
+ * that is already single channel intensity_t is shared without a copy. The DICe buffers are
+ * recycled: one comes back once the image DICe built on it has been dropped.
+ */
+class FrameConverter {
+public:
+    FrameConverter() : allocations_(0) {}
+
+    Teuchos::ArrayRCP<intensity_t> convert(const cv::Mat &frame);
+
+    /** The whole frame's size, but only the pixels inside roi are converted, the rest are zero */
+    Teuchos::ArrayRCP<intensity_t> convert(const cv::Mat &frame, const cv::Rect &roi);
+
+    /** DICe buffers that could not be recycled */
+    size_t allocations() const { return allocations_; }
+
+private:
+    const cv::Mat &grayscale(const cv::Mat &frame);
+
+    Teuchos::ArrayRCP<intensity_t> intensity_buffer(Teuchos::ArrayRCP<intensity_t>::size_type num_pixels);
+
+    cv::Mat gray_;
+    std::vector<Teuchos::ArrayRCP<intensity_t> > buffers_;
+    size_t allocations_;
+};
+
+#endif //CUSTOM_APP_FRAMECONVERTER_H
@@ -0,0 +1,57 @@
+#include "FramePool.h"
+
+using namespace cv;
+using namespace std;
+
+FramePool::FramePool(size_t max_buffers) :
+        max_buffers_(max_buffers),
+        allocations_(0) {
+    buffers_.reserve(max_buffers_);
+}
+
+Mat FramePool::acquire(int rows, int cols, int type) {
+    lock_guard<mutex> lock(mutex_);
+    // only the pool holds a free buffer and only the pool hands buffers out, so it stays free until returned
+    size_t reshape = buffers_.size();
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+        if (!is_free(buffers_[i]))
+            continue;
+        if (buffers_[i].rows == rows && buffers_[i].cols == cols && buffers_[i].type() == type)
+            return buffers_[i];
+        reshape = i;
+    }
+    ++allocations_;
+    Mat buffer(rows, cols, type);
+    if (buffers_.size() < max_buffers_)
+        buffers_.push_back(buffer);
+    else if (reshape < buffers_.size())
+        // the camera changed mode, a free buffer of the old shape makes room
+        buffers_[reshape] = buffer;
+    return buffer;
+}
+
+Mat FramePool::acquire_like(const Mat &like) {
+    if (like.empty())
+        return Mat();
+    return acquire(like.rows, like.cols, like.type());
+}
+
+void FramePool::adopt(const Mat &buffer) {
+    // views and wrapped external memory cannot be told free from the reference count
+    if (buffer.empty() || buffer.u == NULL || !buffer.isContinuous())
+        return;
+    lock_guard<mutex> lock(mutex_);
+    ++allocations_;
+    if (buffers_.size() < max_buffers_)
+        buffers_.push_back(buffer);
+}
+
+size_t FramePool::allocations() const {
+    lock_guard<mutex> lock(mutex_);
+    return allocations_;
+}
+
+size_t FramePool::buffers() const {
+    lock_guard<mutex> lock(mutex_);
+    return buffers_.size();
+}
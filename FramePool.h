@@ -0,0 +1,43 @@
+#ifndef CUSTOM_APP_FRAMEPOOL_H
+#define CUSTOM_APP_FRAMEPOOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/**
+ * Recycles cv::Mat pixel buffers between frames. A buffer is free again once every Mat handed
+ * out for it has been released, which the pool sees from the OpenCV reference count, so frames
+ * can go through the queues and into results without being returned by hand. At most
+ * max_buffers are kept; past that acquire() falls back to a plain allocation.
+ */
+class FramePool {
+public:
+    explicit FramePool(size_t max_buffers = 16);
+
+    /** A buffer of this shape that nobody else holds, only allocated when none is free */
+    cv::Mat acquire(int rows, int cols, int type);
+
+    /** Same shape as like, an empty Mat if like is empty */
+    cv::Mat acquire_like(const cv::Mat &like);
+
+    /** Keep a buffer allocated elsewhere, e.g. by a decoder, for later acquire() calls */
+    void adopt(const cv::Mat &buffer);
+
+    /** Buffers the pool could not recycle and had to allocate */
+    size_t allocations() const;
+
+    size_t buffers() const;
+
+private:
+    static bool is_free(const cv::Mat &buffer) { return buffer.u != NULL && buffer.u->refcount == 1; }
+
+    const size_t max_buffers_;
+    std::vector<cv::Mat> buffers_;
+    size_t allocations_;
+    mutable std::mutex mutex_;
+};
+
+#endif //CUSTOM_APP_FRAMEPOOL_H
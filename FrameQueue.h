@@ -0,0 +1,131 @@
+#ifndef CUSTOM_APP_FRAMEQUEUE_H
+#define CUSTOM_APP_FRAMEQUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded queue joining two pipeline stages. A producer never blocks: when the queue is full
+ * the oldest entry is dropped so a slow consumer always sees the newest data.
+ *
+ * The slots are allocated once. push() copy-assigns into a slot and the pops swap the entry out
+ * with the caller's item, so an entry that owns memory (vectors, Mats) keeps reusing it instead
+ * of allocating per frame. A slot keeps whatever it last held until it is written again.
+ */
+template<class T>
+class FrameQueue {
+public:
+    explicit FrameQueue(size_t capacity = 2) :
+            capacity_(capacity == 0 ? 1 : capacity),
+            slots_(capacity_),
+            head_(0),
+            size_(0),
+            pushed_(0),
+            dropped_(0),
+            closed_(false) {}
+
+    void push(const T &item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_)
+                return;
+            if (size_ == capacity_) {
+                head_ = (head_ + 1) % capacity_;
+                --size_;
+                ++dropped_;
+            }
+            slots_[(head_ + size_) % capacity_] = item;
+            ++size_;
+            ++pushed_;
+        }
+        cond_.notify_one();
+    }
+
+    /** Take the oldest entry, waiting up to timeout_ms for one to arrive */
+    bool pop(T &item, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                            [this] { return size_ > 0 || closed_; }))
+            return false;
+        if (size_ == 0)
+            return false;
+        take_front(item);
+        return true;
+    }
+
+    /** Take the newest entry and drop anything older, waiting up to timeout_ms for one to arrive */
+    bool pop_latest(T &item, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                            [this] { return size_ > 0 || closed_; }))
+            return false;
+        if (size_ == 0)
+            return false;
+        dropped_ += size_ - 1;
+        std::swap(item, slots_[(head_ + size_ - 1) % capacity_]);
+        size_ = 0;
+        return true;
+    }
+
+    bool try_pop(T &item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size_ == 0)
+            return false;
+        take_front(item);
+        return true;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_ = 0;
+    }
+
+    /** Wake up every waiting consumer, further pushes are ignored */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        cond_.notify_all();
+    }
+
+    size_t depth() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    size_t pushed() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pushed_;
+    }
+
+    size_t dropped() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_;
+    }
+
+private:
+    void take_front(T &item) {
+        std::swap(item, slots_[head_]);
+        head_ = (head_ + 1) % capacity_;
+        --size_;
+    }
+
+    const size_t capacity_;
+    std::vector<T> slots_;
+    size_t head_;
+    size_t size_;
+    size_t pushed_;
+    size_t dropped_;
+    bool closed_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+#endif //CUSTOM_APP_FRAMEQUEUE_H
@@ -0,0 +1,166 @@
+#include "FrameSource.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace cv;
+using namespace std;
+
+double monotonic_ms() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+VideoCaptureSource::VideoCaptureSource(VideoCapture &capture, bool use_device_clock) :
+        capture_(capture),
+        use_device_clock_(false),
+        timestamp_ms_(0.0) {
+    // chosen once, stamps that switch clocks from frame to frame cannot be compared
+    if (use_device_clock && capture_.grab())
+        use_device_clock_ = capture_.get(CAP_PROP_POS_MSEC) > 0.0;
+}
+
+bool VideoCaptureSource::grab() {
+    if (!capture_.grab())
+        return false;
+    timestamp_ms_ = use_device_clock_ ? capture_.get(CAP_PROP_POS_MSEC) : monotonic_ms();
+    return true;
+}
+
+SyntheticFrameSource::SyntheticFrameSource(int width, int height, double period_ms, double skew_ms,
+                                           double jitter_ms, bool realtime, unsigned int seed) :
+        pattern_(height, width, CV_8UC3),
+        period_ms_(period_ms),
+        skew_ms_(skew_ms),
+        jitter_ms_(jitter_ms),
+        realtime_(realtime),
+        start_ms_(monotonic_ms()),
+        frame_index_(-1),
+        timestamp_ms_(0.0),
+        generator_(seed) {
+    randu(pattern_, Scalar::all(0), Scalar::all(255));
+}
+
+bool SyntheticFrameSource::grab() {
+    ++frame_index_;
+    const double nominal_ms = start_ms_ + frame_index_ * period_ms_;
+    if (realtime_) {
+        const double wait_ms = nominal_ms - monotonic_ms();
+        if (wait_ms > 0.0)
+            this_thread::sleep_for(chrono::duration<double, milli>(wait_ms));
+    }
+    double jitter = 0.0;
+    if (jitter_ms_ > 0.0) {
+        uniform_real_distribution<double> distribution(-jitter_ms_, jitter_ms_);
+        jitter = distribution(generator_);
+    }
+    timestamp_ms_ = nominal_ms + skew_ms_ + jitter;
+    return true;
+}
+
+bool SyntheticFrameSource::retrieve(Mat &frame) {
+    pattern_.copyTo(frame);
+    // stamp the frame index into the top row so a pair can be checked visually
+    putText(frame, to_string(frame_index_), Point(10, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(255, 255, 255));
+    return true;
+}
+
+double SyntheticFrameSource::get(int prop_id) const {
+    switch (prop_id) {
+        case CAP_PROP_FRAME_WIDTH:
+            return pattern_.cols;
+        case CAP_PROP_FRAME_HEIGHT:
+            return pattern_.rows;
+        case CAP_PROP_FPS:
+            return period_ms_ > 0.0 ? 1000.0 / period_ms_ : 0.0;
+        case CAP_PROP_POS_MSEC:
+            return timestamp_ms_ - start_ms_;
+        default:
+            return 0.0;
+    }
+}
+
+ReplayFrameSource::ReplayFrameSource(const vector<string> &files, double period_ms, bool loop, bool realtime) :
+        files_(files),
+        cache_(NULL),
+        period_ms_(period_ms),
+        loop_(loop),
+        realtime_(realtime),
+        start_ms_(monotonic_ms()),
+        frame_index_(-1),
+        timestamp_ms_(0.0) {}
+
+vector<string> ReplayFrameSource::list_directory(const string &directory, const string &tag) {
+    vector<string> files;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL)
+        return files;
+    string folder = directory;
+    if (!folder.empty() && folder[folder.size() - 1] != '/')
+        folder += "/";
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        const string name(entry->d_name);
+        const size_t dot = name.rfind('.');
+        if (dot == string::npos || dot < tag.size())
+            continue;
+        if (name.compare(dot - tag.size(), tag.size(), tag) == 0)
+            files.push_back(folder + name);
+    }
+    closedir(dir);
+    sort(files.begin(), files.end());
+    return files;
+}
+
+void ReplayFrameSource::rewind() {
+    start_ms_ = monotonic_ms();
+    frame_index_ = -1;
+}
+
+bool ReplayFrameSource::grab() {
+    if (files_.empty())
+        return false;
+    if (frame_index_ + 1 >= (long) files_.size()) {
+        if (!loop_)
+            return false;
+        rewind();
+    }
+    ++frame_index_;
+    if (period_ms_ > 0.0) {
+        timestamp_ms_ = start_ms_ + frame_index_ * period_ms_;
+        if (realtime_) {
+            const double wait_ms = timestamp_ms_ - monotonic_ms();
+            if (wait_ms > 0.0)
+                this_thread::sleep_for(chrono::duration<double, milli>(wait_ms));
+        }
+    } else {
+        timestamp_ms_ = monotonic_ms();
+    }
+    return true;
+}
+
+bool ReplayFrameSource::retrieve(Mat &frame) {
+    if (frame_index_ < 0)
+        return false;
+    if (cache_ != NULL)
+        return cache_->read(files_[frame_index_], frame);
+    // keep the bit depth, DICe reads 16 bit images at full range as well
+    frame = imread(files_[frame_index_], IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+    return !frame.empty();
+}
+
+double ReplayFrameSource::get(int prop_id) const {
+    switch (prop_id) {
+        case CAP_PROP_FRAME_COUNT:
+            return files_.size();
+        case CAP_PROP_POS_FRAMES:
+            return frame_index_ + 1;
+        case CAP_PROP_FPS:
+            return period_ms_ > 0.0 ? 1000.0 / period_ms_ : 0.0;
+        case CAP_PROP_POS_MSEC:
+            return timestamp_ms_ - start_ms_;
+        default:
+            return 0.0;
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef CUSTOM_APP_FRAMESOURCE_H
+#define CUSTOM_APP_FRAMESOURCE_H
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "ImageCache.h"
+
+/** Milliseconds on the monotonic clock, the common time base for stamping frames */
+double monotonic_ms();
+
+/**
+ * Where the live loop gets its frames from. Follows the VideoCapture grab()/retrieve() split so
+ * a stereo pair can be latched back to back before either frame is decoded.
+ */
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    virtual bool is_opened() const = 0;
+
+    /** Latch the next frame and record its timestamp */
+    virtual bool grab() = 0;
+
+    /** Decode the frame latched by the last grab(), into frame's own buffer when it has the right shape */
+    virtual bool retrieve(cv::Mat &frame) = 0;
+
+    /**
+     * Timestamp of the last grabbed frame. A source keeps one clock for all its frames:
+     * monotonic_ms() time unless it stamps frames with the camera's own clock, see VideoCaptureSource.
+     */
+    virtual double timestamp_ms() const = 0;
+
+    virtual double get(int /* prop_id */) const { return 0.0; }
+
+    bool read(cv::Mat &frame) { return grab() && retrieve(frame); }
+};
+
+/**
+ * A camera opened through OpenCV. Frames are stamped on the monotonic clock when grab() returns,
+ * or with CAP_PROP_POS_MSEC if use_device_clock is set and the driver reports it for the first
+ * frame, which the constructor grabs to find out. The clock is not changed after that.
+ */
+class VideoCaptureSource : public FrameSource {
+public:
+    explicit VideoCaptureSource(cv::VideoCapture &capture, bool use_device_clock = false);
+
+    bool is_opened() const { return capture_.isOpened(); }
+
+    bool grab();
+
+    bool retrieve(cv::Mat &frame) { return capture_.retrieve(frame); }
+
+    double timestamp_ms() const { return timestamp_ms_; }
+
+    double get(int prop_id) const { return capture_.get(prop_id); }
+
+    /** True if the frames are stamped with CAP_PROP_POS_MSEC */
+    bool device_clock() const { return use_device_clock_; }
+
+    /** Stamp on the monotonic clock from the next grab() on, for a camera paired with one that has no clock */
+    void use_monotonic_clock() { use_device_clock_ = false; }
+
+private:
+    cv::VideoCapture &capture_;
+    bool use_device_clock_;
+    double timestamp_ms_;
+};
+
+/**
+ * Generates a speckle pattern at a fixed frame period for offline sync checks. skew_ms is added
+ * to every timestamp and jitter_ms spreads it uniformly, so a pair of these with different skews
+ * reproduces a known left/right offset. With realtime set grab() sleeps to keep the period.
+ */
+class SyntheticFrameSource : public FrameSource {
+public:
+    SyntheticFrameSource(int width, int height, double period_ms, double skew_ms = 0.0, double jitter_ms = 0.0,
+                         bool realtime = true, unsigned int seed = 1);
+
+    bool is_opened() const { return true; }
+
+    bool grab();
+
+    bool retrieve(cv::Mat &frame);
+
+    double timestamp_ms() const { return timestamp_ms_; }
+
+    double get(int prop_id) const;
+
+private:
+    cv::Mat pattern_;
+    const double period_ms_;
+    const double skew_ms_;
+    const double jitter_ms_;
+    const bool realtime_;
+    const double start_ms_;
+    long frame_index_;
+    double timestamp_ms_;
+    std::mt19937 generator_;
+};
+
+/**
+ * Plays back recorded images in order. With period_ms set the timestamps follow that period
+ * (and realtime paces grab() to it), otherwise frames are stamped when they are grabbed.
+ */
+class ReplayFrameSource : public FrameSource {
+public:
+    explicit ReplayFrameSource(const std::vector<std::string> &files, double period_ms = 0.0, bool loop = false,
+                               bool realtime = false);
+
+    /** Every file in directory whose name without extension ends in tag (e.g. "_0"), sorted by name */
+    static std::vector<std::string> list_directory(const std::string &directory, const std::string &tag);
+
+    bool is_opened() const { return !files_.empty(); }
+
+    bool grab();
+
+    bool retrieve(cv::Mat &frame);
+
+    double timestamp_ms() const { return timestamp_ms_; }
+
+    double get(int prop_id) const;
+
+    size_t size() const { return files_.size(); }
+
+    /** Go back to the first file */
+    void rewind();
+
+    /** Read through cache, which must outlive the source. NULL (the default) decodes every file */
+    void set_cache(ImageCache *cache) { cache_ = cache; }
+
+private:
+    std::vector<std::string> files_;
+    ImageCache *cache_;
+    const double period_ms_;
+    const bool loop_;
+    const bool realtime_;
+    double start_ms_;
+    long frame_index_;
+    double timestamp_ms_;
+};
+
+#endif //CUSTOM_APP_FRAMESOURCE_H
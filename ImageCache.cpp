@@ -0,0 +1,233 @@
+#include "ImageCache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "FileHash.h"
+
+using namespace cv;
+using namespace std;
+
+static const char ENTRY_MAGIC[8] = {'D', 'I', 'C', 'E', 'I', 'M', 'G', '1'};
+static const size_t ENTRY_ALIGNMENT = 4096;
+static const char *ENTRY_SUFFIX = ".img";
+
+/* Followed by the source path, the pixel rows start at data_offset */
+struct EntryHeader {
+    char magic[8];
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    uint32_t path_bytes;
+    int64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t data_offset;
+    uint64_t data_bytes;
+};
+
+static int64_t mtime_ns(const struct stat &info) {
+    return (int64_t) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+static bool has_suffix(const string &name, const char *suffix) {
+    const size_t length = strlen(suffix);
+    return name.size() > length && name.compare(name.size() - length, length, suffix) == 0;
+}
+
+ImageCache::ImageCache(const string &folder, size_t max_bytes) :
+        folder_(folder),
+        max_bytes_(max_bytes),
+        temp_counter_(0) {
+    if (!folder_.empty() && folder_[folder_.size() - 1] != '/')
+        folder_ += "/";
+    mkdir(folder_.c_str(), 0755);
+    DIR *dir = opendir(folder_.c_str());
+    if (dir == NULL)
+        return;
+    for (struct dirent *item = readdir(dir); item != NULL; item = readdir(dir)) {
+        const string name(item->d_name);
+        struct stat info;
+        if (stat((folder_ + name).c_str(), &info) != 0)
+            continue;
+        if (has_suffix(name, ENTRY_SUFFIX)) {
+            Entry entry;
+            entry.bytes = info.st_size;
+            entry.last_used_ns = mtime_ns(info);
+            entries_[name] = entry;
+            stats_.bytes += entry.bytes;
+        } else if (name.find(".tmp.") != string::npos) {
+            // left behind by a run that stopped halfway through a store, unless its writer is still
+            // alive: batch lanes in other processes share the folder
+            const int writer = atoi(name.c_str() + name.find(".tmp.") + 5);
+            if (writer <= 0 || (kill(writer, 0) != 0 && errno == ESRCH))
+                unlink((folder_ + name).c_str());
+        }
+    }
+    closedir(dir);
+    lock_guard<mutex> lock(mutex_);
+    evict();
+}
+
+bool ImageCache::read(const string &file_name, Mat &image) {
+    struct stat info;
+    char real_path[PATH_MAX];
+    if (stat(file_name.c_str(), &info) != 0 || realpath(file_name.c_str(), real_path) == NULL)
+        return false;
+    const string source(real_path);
+    const int64_t source_mtime_ns = mtime_ns(info);
+    uint64_t key = hash_bytes(source.data(), source.size());
+    key = hash_bytes(&source_mtime_ns, sizeof(source_mtime_ns), key);
+    key = hash_bytes(&info.st_size, sizeof(info.st_size), key);
+    const string entry_name = hash_to_string(key) + ENTRY_SUFFIX;
+
+    if (load(entry_name, source, info.st_size, source_mtime_ns, image)) {
+        lock_guard<mutex> lock(mutex_);
+        ++stats_.hits;
+        return true;
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        ++stats_.misses;
+    }
+    image = imread(file_name, IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+    if (image.empty())
+        return false;
+    store(entry_name, source, info.st_size, source_mtime_ns, image);
+    return true;
+}
+
+bool ImageCache::load(const string &entry_name, const string &source, int64_t source_size,
+                      int64_t source_mtime_ns, Mat &image) {
+    const string path = folder_ + entry_name;
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if (fstat(descriptor, &info) == 0 && (size_t) info.st_size >= sizeof(EntryHeader))
+        mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+        return false;
+    const char *bytes = static_cast<const char *>(mapping);
+    EntryHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    // a hash collision or a damaged entry is a miss, the store that follows replaces it
+    bool valid = memcmp(header.magic, ENTRY_MAGIC, sizeof(header.magic)) == 0
+                 && header.source_size == source_size && header.source_mtime_ns == source_mtime_ns
+                 && header.path_bytes == source.size()
+                 && sizeof(header) + header.path_bytes <= header.data_offset
+                 && header.data_offset + header.data_bytes <= (uint64_t) info.st_size
+                 && header.rows > 0 && header.cols > 0
+                 && header.data_bytes == (uint64_t) header.rows * header.cols * CV_ELEM_SIZE(header.type);
+    if (valid)
+        valid = source.compare(0, string::npos, bytes + sizeof(header), header.path_bytes) == 0;
+    if (valid) {
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+        image.create(header.rows, header.cols, header.type);
+        memcpy(image.data, bytes + header.data_offset, header.data_bytes);
+    }
+    munmap(mapping, info.st_size);
+    if (!valid)
+        return false;
+
+    // the mtime of an entry is its last use, the eviction order survives the process
+    utimensat(AT_FDCWD, path.c_str(), NULL, 0);
+    lock_guard<mutex> lock(mutex_);
+    map<string, Entry>::iterator entry = entries_.find(entry_name);
+    if (entry != entries_.end()) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        entry->second.last_used_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+    return true;
+}
+
+void ImageCache::store(const string &entry_name, const string &source, int64_t source_size,
+                       int64_t source_mtime_ns, const Mat &image) {
+    const Mat continuous = image.isContinuous() ? image : image.clone();
+    EntryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ENTRY_MAGIC, sizeof(header.magic));
+    header.rows = continuous.rows;
+    header.cols = continuous.cols;
+    header.type = continuous.type();
+    header.path_bytes = source.size();
+    header.source_size = source_size;
+    header.source_mtime_ns = source_mtime_ns;
+    header.data_offset = (sizeof(header) + source.size() + ENTRY_ALIGNMENT - 1) / ENTRY_ALIGNMENT * ENTRY_ALIGNMENT;
+    header.data_bytes = continuous.total() * continuous.elemSize();
+    if (header.data_offset + header.data_bytes > max_bytes_)
+        return;
+
+    vector<char> head(header.data_offset, 0);
+    memcpy(&head[0], &header, sizeof(header));
+    memcpy(&head[sizeof(header)], source.data(), source.size());
+    string temp_name;
+    {
+        lock_guard<mutex> lock(mutex_);
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".tmp.%d.%lu", (int) getpid(), (unsigned long) temp_counter_++);
+        temp_name = folder_ + entry_name + suffix;
+    }
+    // written under a temporary name and renamed, a reader never maps half an entry
+    FILE *file = fopen(temp_name.c_str(), "wb");
+    if (file == NULL)
+        return;
+    const bool written = fwrite(&head[0], 1, head.size(), file) == head.size()
+                         && fwrite(continuous.data, 1, header.data_bytes, file) == header.data_bytes;
+    const bool closed = fclose(file) == 0;
+    if (!written || !closed || rename(temp_name.c_str(), (folder_ + entry_name).c_str()) != 0) {
+        unlink(temp_name.c_str());
+        cout << "Cannot write the image cache entry for " << source << endl;
+        return;
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    Entry &entry = entries_[entry_name];
+    stats_.bytes -= entry.bytes;
+    entry.bytes = head.size() + header.data_bytes;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    entry.last_used_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    stats_.bytes += entry.bytes;
+    evict();
+}
+
+void ImageCache::evict() {
+    while (stats_.bytes > max_bytes_ && !entries_.empty()) {
+        map<string, Entry>::iterator oldest = entries_.begin();
+        for (map<string, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+            if (it->second.last_used_ns < oldest->second.last_used_ns)
+                oldest = it;
+        unlink((folder_ + oldest->first).c_str());
+        stats_.bytes -= oldest->second.bytes;
+        entries_.erase(oldest);
+        ++stats_.evictions;
+    }
+}
+
+void ImageCache::clear() {
+    lock_guard<mutex> lock(mutex_);
+    for (map<string, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+        unlink((folder_ + it->first).c_str());
+    entries_.clear();
+    stats_.bytes = 0;
+}
+
+ImageCacheStats ImageCache::stats() const {
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
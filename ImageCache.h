@@ -0,0 +1,71 @@
+#ifndef CUSTOM_APP_IMAGECACHE_H
+#define CUSTOM_APP_IMAGECACHE_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+struct ImageCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    /* bytes of every entry in the folder */
+    size_t bytes;
+
+    ImageCacheStats() : hits(0), misses(0), evictions(0), bytes(0) {}
+};
+
+/**
+ * Decoded images kept on disk between runs, so re-running a recorded sequence skips the TIFF
+ * or JPEG decode. An entry is keyed by the real path, mtime and size of the source file and
+ * holds a page-aligned header followed by the raw rows, a hit is one mmap and copy. When the
+ * folder grows past max_bytes the least recently used entries go; reading an entry touches
+ * its mtime so the order carries over to the next run. Safe to share between threads, and
+ * between processes through the folder: each keeps its own view of the entries, so the size cap
+ * only holds roughly then.
+ */
+class ImageCache {
+public:
+    ImageCache(const std::string &folder, size_t max_bytes);
+
+    /**
+     * The image as imread(file_name, IMREAD_GRAYSCALE | IMREAD_ANYDEPTH) gives it, written into
+     * image's buffer when it has the right shape. False if the file cannot be read at all.
+     */
+    bool read(const std::string &file_name, cv::Mat &image);
+
+    /** Delete every entry */
+    void clear();
+
+    ImageCacheStats stats() const;
+
+    const std::string &folder() const { return folder_; }
+
+private:
+    struct Entry {
+        size_t bytes;
+        int64_t last_used_ns;
+    };
+
+    bool load(const std::string &entry_name, const std::string &source, int64_t source_size,
+              int64_t source_mtime_ns, cv::Mat &image);
+
+    void store(const std::string &entry_name, const std::string &source, int64_t source_size,
+               int64_t source_mtime_ns, const cv::Mat &image);
+
+    /** Drop the oldest entries until the folder is under max_bytes, with mutex_ held */
+    void evict();
+
+    std::string folder_;
+    const size_t max_bytes_;
+    std::map<std::string, Entry> entries_;
+    ImageCacheStats stats_;
+    size_t temp_counter_;
+    mutable std::mutex mutex_;
+};
+
+#endif //CUSTOM_APP_IMAGECACHE_H
@@ -0,0 +1,92 @@
+#include "ImagePrefetcher.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace cv;
+using namespace std;
+
+static Mat decode(const string &file_name, ImageCache *cache) {
+    if (cache == NULL)
+        return imread(file_name, IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+    Mat image;
+    if (!cache->read(file_name, image))
+        image.release();
+    return image;
+}
+
+static size_t image_bytes(const Mat &image) {
+    return image.total() * image.elemSize();
+}
+
+ImagePrefetcher::ImagePrefetcher(size_t lookahead, size_t memory_cap_bytes, size_t num_threads) :
+        lookahead_(lookahead > 0 ? lookahead : 1),
+        memory_cap_bytes_(memory_cap_bytes),
+        cache_(NULL),
+        next_(0),
+        pair_bytes_(0),
+        pool_(num_threads > 0 ? num_threads : 1) {}
+
+void ImagePrefetcher::start(const vector<string> &left_files, const vector<string> &right_files, size_t first) {
+    // decodes of an earlier sequence finish in the background, their results are dropped
+    pending_.clear();
+    left_files_ = left_files;
+    right_files_ = right_files;
+    next_ = first;
+    stats_ = PrefetchStats();
+    schedule(first);
+}
+
+size_t ImagePrefetcher::max_in_flight() const {
+    if (pair_bytes_ == 0)
+        return 1;
+    return std::max((size_t) 1, std::min(lookahead_, memory_cap_bytes_ / pair_bytes_));
+}
+
+void ImagePrefetcher::submit(size_t index) {
+    const string left_file = left_files_[index];
+    const string right_file = index < right_files_.size() ? right_files_[index] : string();
+    ImageCache *cache = cache_;
+    // both sides of a pair decode at the same time
+    PendingPair &pending = pending_[index];
+    pending.first = pool_.submit([left_file, cache] { return decode(left_file, cache); });
+    if (!right_file.empty())
+        pending.second = pool_.submit([right_file, cache] { return decode(right_file, cache); });
+}
+
+void ImagePrefetcher::schedule(size_t index) {
+    if (next_ < index)
+        next_ = index;
+    while (next_ < left_files_.size() && next_ < index + lookahead_ && pending_.size() < max_in_flight())
+        submit(next_++);
+    const size_t held = pending_.size() * pair_bytes_;
+    if (held > stats_.peak_bytes)
+        stats_.peak_bytes = held;
+}
+
+bool ImagePrefetcher::take(size_t index, Mat &left, Mat &right) {
+    if (index >= left_files_.size())
+        return false;
+    // asked for a pair out of order, or the cap held it back: decode it now
+    if (pending_.find(index) == pending_.end())
+        submit(index);
+    PendingPair &pending = pending_[index];
+    const bool ready = pending.first.wait_for(chrono::seconds(0)) == future_status::ready &&
+                       (!pending.second.valid() ||
+                        pending.second.wait_for(chrono::seconds(0)) == future_status::ready);
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    left = pending.first.get();
+    right = pending.second.valid() ? pending.second.get() : Mat();
+    if (ready) {
+        ++stats_.hits;
+    } else {
+        ++stats_.waits;
+        stats_.wait_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    pending_.erase(index);
+    // everything before index is of no use any more
+    pending_.erase(pending_.begin(), pending_.lower_bound(index));
+    pair_bytes_ = image_bytes(left) + image_bytes(right);
+    schedule(index + 1);
+    return !left.empty() && (right_files_.empty() || !right.empty());
+}
@@ -0,0 +1,76 @@
+#ifndef CUSTOM_APP_IMAGEPREFETCHER_H
+#define CUSTOM_APP_IMAGEPREFETCHER_H
+
+#include <cstddef>
+#include <future>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "ImageCache.h"
+#include "ThreadPool.h"
+
+struct PrefetchStats {
+    /* pairs that were decoded by the time they were asked for */
+    size_t hits;
+    /* pairs the caller had to wait for, including any not scheduled ahead */
+    size_t waits;
+    double wait_ms;
+    /* most decoded bytes held at once, taken pairs not included */
+    size_t peak_bytes;
+
+    PrefetchStats() : hits(0), waits(0), wait_ms(0.0), peak_bytes(0) {}
+};
+
+/**
+ * Decodes the image pairs of an offline sequence ahead of the correlation. While pair n is
+ * being correlated the worker threads read and decode pairs n+1 .. n+lookahead, as far as the
+ * memory cap allows; at least the next pair is always in flight. The images are read like
+ * DICe reads them, grayscale at the bit depth of the file. take() is meant to be called from
+ * one thread, in increasing order.
+ */
+class ImagePrefetcher {
+public:
+    ImagePrefetcher(size_t lookahead, size_t memory_cap_bytes, size_t num_threads = 2);
+
+    /** Read through cache, which must outlive the prefetcher. NULL (the default) decodes every file */
+    void set_cache(ImageCache *cache) { cache_ = cache; }
+
+    /** Forget any earlier sequence and start decoding from pair first */
+    void start(const std::vector<std::string> &left_files, const std::vector<std::string> &right_files,
+               size_t first);
+
+    /** Pair index, right stays empty without right files. False if either image cannot be read */
+    bool take(size_t index, cv::Mat &left, cv::Mat &right);
+
+    const PrefetchStats &stats() const { return stats_; }
+
+    size_t lookahead() const { return lookahead_; }
+
+private:
+    typedef std::pair<std::future<cv::Mat>, std::future<cv::Mat> > PendingPair;
+
+    void submit(size_t index);
+
+    void schedule(size_t index);
+
+    size_t max_in_flight() const;
+
+    const size_t lookahead_;
+    const size_t memory_cap_bytes_;
+    ImageCache *cache_;
+    std::vector<std::string> left_files_;
+    std::vector<std::string> right_files_;
+    std::map<size_t, PendingPair> pending_;
+    size_t next_;
+    /* size of the last decoded pair, zero until one has been decoded */
+    size_t pair_bytes_;
+    PrefetchStats stats_;
+    /* last member, its destructor waits for the decodes still running */
+    ThreadPool pool_;
+};
+
+#endif //CUSTOM_APP_IMAGEPREFETCHER_H
@@ -0,0 +1,365 @@
+#include <cmath>
+#include <limits>
+
+#include "AllocationCounter.h"
+#include "LivePipeline.h"
+#include "StageProbe.h"
+
+using namespace cv;
+using namespace std;
+
+static double elapsed_ms(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+LivePipeline::LivePipeline(FrameSource &left_camera, FrameSource &right_camera, CorrelationSession &session,
+                           const PipelineOptions &options) :
+        left_camera_(left_camera),
+        right_camera_(right_camera),
+        session_(session),
+        options_(options),
+        matcher_(options.sync_tolerance_ms, options.reject_out_of_sync, 2 * options.queue_depth),
+        left_queue_(options.queue_depth),
+        right_queue_(options.queue_depth),
+        left_preview_(1),
+        right_preview_(1),
+        result_queue_(options.queue_depth),
+        // a frame can sit in its queue, the preview, the matcher history, the result queue and the render loop
+        left_pool_(4 * options.queue_depth + 8),
+        right_pool_(4 * options.queue_depth + 8),
+        publisher_(NULL),
+        running_(false),
+        correlating_(false),
+        failed_step_(false),
+        reference_pending_(false),
+        pairs_flagged_(0),
+        pairs_rejected_(0) {}
+
+LivePipeline::~LivePipeline() {
+    stop();
+}
+
+void LivePipeline::start() {
+    if (running_)
+        return;
+    running_ = true;
+    if (options_.synchronised_grab) {
+        left_thread_ = thread(&LivePipeline::stereo_capture_loop, this);
+    } else {
+        left_thread_ = thread(&LivePipeline::capture_loop, this, &left_camera_, &left_pool_, &left_queue_,
+                              &left_preview_, &capture_left_stats_, &capture_left_allocations_);
+        right_thread_ = thread(&LivePipeline::capture_loop, this, &right_camera_, &right_pool_, &right_queue_,
+                               &right_preview_, &capture_right_stats_, &capture_right_allocations_);
+    }
+    correlation_thread_ = thread(&LivePipeline::correlation_loop, this);
+}
+
+void LivePipeline::stop() {
+    {
+        lock_guard<mutex> lock(stop_mutex_);
+        running_ = false;
+    }
+    stop_cond_.notify_all();
+    left_queue_.close();
+    right_queue_.close();
+    left_preview_.close();
+    right_preview_.close();
+    result_queue_.close();
+    if (left_thread_.joinable())
+        left_thread_.join();
+    if (right_thread_.joinable())
+        right_thread_.join();
+    if (correlation_thread_.joinable())
+        correlation_thread_.join();
+}
+
+void LivePipeline::request_reference(const Mat &left, const Mat &right) {
+    lock_guard<mutex> lock(reference_mutex_);
+    reference_left_ = left.clone();
+    reference_right_ = right.clone();
+    reference_pending_ = true;
+}
+
+bool LivePipeline::next_preview(CapturedFrame &left, CapturedFrame &right) {
+    bool updated = left_preview_.pop_latest(left, 0);
+    if (right_preview_.pop_latest(right, 0))
+        updated = true;
+    return updated;
+}
+
+bool LivePipeline::next_result(CorrelationResult &result) {
+    return result_queue_.pop_latest(result, 0);
+}
+
+void LivePipeline::record_render(double render_ms, long allocations, const CorrelationResult &result) {
+    lock_guard<mutex> lock(stats_mutex_);
+    render_stats_.add(render_ms);
+    render_allocations_.add(allocations);
+    end_to_end_stats_.add(elapsed_ms(result.capture_stamp));
+}
+
+void LivePipeline::capture_loop(FrameSource *camera, FramePool *pool, FrameQueue<CapturedFrame> *work_queue,
+                                FrameQueue<CapturedFrame> *preview_queue, StageStats *capture_stats,
+                                StageStats *allocation_stats) {
+    long sequence = 0;
+    int failures = 0;
+    CapturedFrame captured;
+    while (running_) {
+        const uint64_t allocations = thread_allocation_count();
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!camera->grab()) {
+            wait_before_retry(failures);
+            continue;
+        }
+        captured.timestamp_ms = camera->timestamp_ms();
+        // a buffer nobody else holds, the previous one may still be queued or in use downstream
+        captured.image = pool->acquire_like(captured.image);
+        const uchar *buffer = captured.image.data;
+        if (!camera->retrieve(captured.image) || captured.image.empty()) {
+            wait_before_retry(failures);
+            continue;
+        }
+        failures = 0;
+        if (captured.image.data != buffer)
+            // first frame, a new camera mode or a source that always decodes into new memory
+            pool->adopt(captured.image);
+        captured.stamp = chrono::steady_clock::now();
+        captured.sequence = sequence++;
+        const double capture_ms = elapsed_ms(start);
+        if (probes_enabled())
+            record_probe(camera == &left_camera_ ? PROBE_CAPTURE_LEFT : PROBE_CAPTURE_RIGHT, start, captured.stamp);
+        work_queue->push(captured);
+        preview_queue->push(captured);
+        {
+            lock_guard<mutex> lock(stats_mutex_);
+            capture_stats->add(capture_ms);
+            allocation_stats->add(thread_allocation_count() - allocations);
+        }
+    }
+}
+
+void LivePipeline::stereo_capture_loop() {
+    // tolerance is left to the matcher in the worker so both capture modes are judged the same way
+    StereoGrabber grabber(left_camera_, right_camera_, numeric_limits<double>::max());
+    StereoFrame pair;
+    int failures = 0;
+    while (running_) {
+        const uint64_t allocations = thread_allocation_count();
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        pair.left.image = left_pool_.acquire_like(pair.left.image);
+        pair.right.image = right_pool_.acquire_like(pair.right.image);
+        const uchar *left_buffer = pair.left.image.data;
+        const uchar *right_buffer = pair.right.image.data;
+        if (!grabber.grab(pair) || pair.left.image.empty() || pair.right.image.empty()) {
+            wait_before_retry(failures);
+            continue;
+        }
+        failures = 0;
+        if (pair.left.image.data != left_buffer)
+            left_pool_.adopt(pair.left.image);
+        if (pair.right.image.data != right_buffer)
+            right_pool_.adopt(pair.right.image);
+        const double capture_ms = elapsed_ms(start);
+        if (probes_enabled()) {
+            record_probe(PROBE_CAPTURE_LEFT, start, pair.left.stamp);
+            record_probe(PROBE_CAPTURE_RIGHT, start, pair.right.stamp);
+        }
+        left_queue_.push(pair.left);
+        right_queue_.push(pair.right);
+        left_preview_.push(pair.left);
+        right_preview_.push(pair.right);
+        {
+            lock_guard<mutex> lock(stats_mutex_);
+            capture_left_stats_.add(capture_ms);
+            capture_right_stats_.add(capture_ms);
+            // one thread grabs both, its allocations are booked on the left
+            capture_left_allocations_.add(thread_allocation_count() - allocations);
+        }
+    }
+}
+
+void LivePipeline::wait_before_retry(int &failures) {
+    // a camera that went away or a replay that ran out fails at once, retrying straight away would spin a core;
+    // the wait doubles up to 64 ms so a glitch costs little and a dead source next to nothing
+    const int wait_ms = 1 << failures;
+    if (failures < 6)
+        ++failures;
+    unique_lock<mutex> lock(stop_mutex_);
+    stop_cond_.wait_for(lock, chrono::milliseconds(wait_ms), [this] { return !running_; });
+}
+
+void LivePipeline::correlation_loop() {
+    CapturedFrame frame;
+    StereoFrame pair;
+    while (running_) {
+        {
+            lock_guard<mutex> lock(reference_mutex_);
+            if (reference_pending_) {
+                {
+                    ScopedProbe probe(PROBE_ENCODE);
+                    imwrite("Img_0000_0.jpeg", reference_left_);
+                    imwrite("Img_0000_1.jpeg", reference_right_);
+                }
+                // new reference pair, the cross-correlation has to be redone
+                session_.finish(failed_step_);
+                session_.reset();
+                failed_step_ = false;
+                reference_pending_ = false;
+            }
+        }
+        // hand everything captured so far to the matcher, it keeps the newest pair it can form
+        if (!left_queue_.pop(frame, 50))
+            continue;
+        matcher_.add_left(frame);
+        while (left_queue_.try_pop(frame))
+            matcher_.add_left(frame);
+        while (right_queue_.try_pop(frame))
+            matcher_.add_right(frame);
+        const bool matched = matcher_.match(pair);
+        {
+            lock_guard<mutex> lock(stats_mutex_);
+            if (matched)
+                pair_skew_stats_.add(fabs(pair.skew_ms));
+            pairs_flagged_ = matcher_.flagged();
+            pairs_rejected_ = matcher_.rejected();
+        }
+        if (!matched || !correlating_)
+            continue;
+        if (correlate_pair(pair))
+            failed_step_ = true;
+    }
+}
+
+bool LivePipeline::correlate_pair(const StereoFrame &pair) {
+    const CapturedFrame &left = pair.left;
+    const CapturedFrame &right = pair.right;
+    const uint64_t allocations = thread_allocation_count();
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!session_.is_setup()) {
+        session_.setup();
+    }
+    bool failed_step;
+    if (options_.file_handoff) {
+        {
+            ScopedProbe probe(PROBE_ENCODE);
+            imwrite("Img_0001_0.jpeg", left.image);
+            imwrite("Img_0001_1.jpeg", right.image);
+        }
+        failed_step = session_.correlate_files("Img_0001_0.jpeg", "Img_0001_1.jpeg");
+    } else {
+        failed_step = session_.correlate_images(left.image, right.image);
+    }
+
+    // one result reused for every pair, the subset store is copied into the vectors it already has
+    CorrelationResult &result = result_;
+    result.left = left.image;
+    result.right = right.image;
+    result.failed_step = failed_step;
+    result.in_sync = pair.in_sync;
+    result.skew_ms = pair.skew_ms;
+    result.capture_stamp = left.stamp < right.stamp ? left.stamp : right.stamp;
+    result.sequence = left.sequence;
+
+    result.subsets = session_.subsets();
+    const DeadlineStats deadline = session_.deadline_stats();
+    result.budget_used = deadline.last_budget_used;
+    result.subsets_deferred = deadline.last_deferred;
+    const ChangeGateStats change_gate = session_.change_gate_stats();
+    result.subsets_carried = change_gate.last_carried;
+    const PyramidStats pyramid = session_.pyramid_stats();
+    if (publisher_ != NULL)
+        publisher_->publish(result.subsets, left.timestamp_ms, failed_step);
+    result.correlation_ms = elapsed_ms(start);
+    result_queue_.push(result);
+    {
+        lock_guard<mutex> lock(stats_mutex_);
+        correlation_stats_.add(result.correlation_ms);
+        correlation_allocations_.add(thread_allocation_count() - allocations);
+        deadline_stats_ = deadline;
+        change_gate_stats_ = change_gate;
+        pyramid_stats_ = pyramid;
+    }
+    return failed_step;
+}
+
+PipelineStats LivePipeline::stats() const {
+    PipelineStats stats;
+    stats.left_depth = left_queue_.depth();
+    stats.right_depth = right_queue_.depth();
+    stats.result_depth = result_queue_.depth();
+    stats.left_dropped = left_queue_.dropped();
+    stats.right_dropped = right_queue_.dropped();
+    stats.result_dropped = result_queue_.dropped();
+    lock_guard<mutex> lock(stats_mutex_);
+    stats.capture_left = capture_left_stats_;
+    stats.capture_right = capture_right_stats_;
+    stats.correlation = correlation_stats_;
+    stats.render = render_stats_;
+    stats.end_to_end = end_to_end_stats_;
+    stats.pair_skew = pair_skew_stats_;
+    stats.pairs_flagged = pairs_flagged_;
+    stats.pairs_rejected = pairs_rejected_;
+    stats.allocations_capture_left = capture_left_allocations_;
+    stats.allocations_capture_right = capture_right_allocations_;
+    stats.allocations_correlation = correlation_allocations_;
+    stats.allocations_render = render_allocations_;
+    stats.buffers_allocated_left = left_pool_.allocations();
+    stats.buffers_allocated_right = right_pool_.allocations();
+    stats.deadline = deadline_stats_;
+    stats.change_gate = change_gate_stats_;
+    stats.pyramid = pyramid_stats_;
+    return stats;
+}
+
+static void print_stage(ostream &os, const char *name, const StageStats &stage) {
+    os << "  " << name << ": n " << stage.count << ", last " << stage.last_ms << " ms, mean " << stage.mean_ms()
+       << " ms, max " << stage.max_ms << " ms" << endl;
+}
+
+static void print_allocations(ostream &os, const char *name, const StageStats &stage) {
+    os << "  " << name << ": last " << stage.last_ms << ", mean " << stage.mean_ms() << ", max " << stage.max_ms
+       << endl;
+}
+
+void LivePipeline::print_stats(ostream &os) const {
+    const PipelineStats s = stats();
+    os << "Pipeline queues (depth/dropped): left " << s.left_depth << "/" << s.left_dropped
+       << ", right " << s.right_depth << "/" << s.right_dropped
+       << ", results " << s.result_depth << "/" << s.result_dropped << endl;
+    print_stage(os, "capture left ", s.capture_left);
+    print_stage(os, "capture right", s.capture_right);
+    print_stage(os, "correlation  ", s.correlation);
+    print_stage(os, "render       ", s.render);
+    print_stage(os, "end to end   ", s.end_to_end);
+    print_stage(os, "pair skew    ", s.pair_skew);
+    os << "  pairs outside " << options_.sync_tolerance_ms << " ms: " << s.pairs_flagged << " flagged, "
+       << s.pairs_rejected << " rejected" << endl;
+    os << "Heap allocations per frame:" << endl;
+    print_allocations(os, "capture left ", s.allocations_capture_left);
+    print_allocations(os, "capture right", s.allocations_capture_right);
+    print_allocations(os, "correlation  ", s.allocations_correlation);
+    print_allocations(os, "render       ", s.allocations_render);
+    os << "  frame buffers allocated: left " << s.buffers_allocated_left << ", right " << s.buffers_allocated_right
+       << endl;
+    if (s.deadline.frames > 0) {
+        const DeadlineStats &d = s.deadline;
+        os << "Deadline " << d.budget_ms << " ms: budget used last " << 100.0 * d.last_budget_used << "%, mean "
+           << 100.0 * d.mean_budget_used() << "%, max " << 100.0 * d.max_budget_used << "%, " << d.frames_over_budget
+           << " of " << d.frames << " frames over" << endl;
+        os << "  subsets deferred last " << d.last_deferred << ", per frame " << (double) d.subsets_deferred / d.frames
+           << ", solver iteration cap " << d.last_iteration_cap << " (" << d.frames_capped << " frames capped)" << endl;
+    }
+    if (s.change_gate.frames > 0) {
+        const ChangeGateStats &g = s.change_gate;
+        os << "Change gate: carried over last " << g.last_carried << ", solved " << g.last_solved << ", "
+           << 100.0 * g.carried_fraction() << "% carried overall, gate " << g.total_gate_ms / g.frames
+           << " ms per frame" << endl;
+    }
+    if (s.pyramid.frames > 0) {
+        const PyramidStats &p = s.pyramid;
+        os << "Pyramid initializer: " << (double) p.subsets_initialized / p.frames << " subsets per frame, "
+           << p.subsets_weak << " weak, build " << p.build_ms / p.frames << " ms, search " << p.search_ms / p.frames
+           << " ms per frame" << endl;
+    }
+    print_probe_summary(os);
+}
@@ -0,0 +1,214 @@
+#ifndef CUSTOM_APP_LIVEPIPELINE_H
+#define CUSTOM_APP_LIVEPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "FramePool.h"
+#include "FrameQueue.h"
+#include "FrameSource.h"
+#include "ResultRing.h"
+#include "StereoGrabber.h"
+#include "CorrelationSession.h"
+#include "SubSetData.h"
+
+struct PipelineOptions {
+    size_t queue_depth;
+    /* write each pair to jpeg and let DICe read it back, as before the in-memory handoff */
+    bool file_handoff;
+    /* one capture thread latching both cameras back to back instead of a thread per camera */
+    bool synchronised_grab;
+    double sync_tolerance_ms;
+    bool reject_out_of_sync;
+
+    PipelineOptions() :
+            queue_depth(4),
+            file_handoff(false),
+            synchronised_grab(false),
+            sync_tolerance_ms(10.0),
+            reject_out_of_sync(false) {}
+};
+
+struct CorrelationResult {
+    cv::Mat left;
+    cv::Mat right;
+    /* snapshot of the session's subset store for this pair */
+    SubSetData subsets;
+    bool failed_step;
+    bool in_sync;
+    double skew_ms;
+    std::chrono::steady_clock::time_point capture_stamp;
+    double correlation_ms;
+    /* with a deadline: this frame's time over the budget and the subsets it deferred */
+    double budget_used;
+    int_t subsets_deferred;
+    /* with the change gate: subsets that kept their last solution */
+    int_t subsets_carried;
+    long sequence;
+};
+
+/* Running latency figures for one pipeline stage */
+struct StageStats {
+    size_t count;
+    double last_ms;
+    double total_ms;
+    double max_ms;
+
+    StageStats() : count(0), last_ms(0.0), total_ms(0.0), max_ms(0.0) {}
+
+    void add(double ms) {
+        ++count;
+        last_ms = ms;
+        total_ms += ms;
+        if (ms > max_ms)
+            max_ms = ms;
+    }
+
+    double mean_ms() const { return count == 0 ? 0.0 : total_ms / count; }
+};
+
+struct PipelineStats {
+    size_t left_depth;
+    size_t right_depth;
+    size_t result_depth;
+    size_t left_dropped;
+    size_t right_dropped;
+    size_t result_dropped;
+    StageStats capture_left;
+    StageStats capture_right;
+    StageStats correlation;
+    StageStats render;
+    StageStats end_to_end;
+    StageStats pair_skew;
+    size_t pairs_flagged;
+    size_t pairs_rejected;
+    /* heap allocations per frame of each stage, counted by AllocationCounter */
+    StageStats allocations_capture_left;
+    StageStats allocations_capture_right;
+    StageStats allocations_correlation;
+    StageStats allocations_render;
+    /* frame buffers the pools could not recycle */
+    size_t buffers_allocated_left;
+    size_t buffers_allocated_right;
+    /* all zero unless the session has a deadline */
+    DeadlineStats deadline;
+    /* all zero unless the session has a change gate */
+    ChangeGateStats change_gate;
+    /* all zero unless the session has the pyramid initializer on */
+    PyramidStats pyramid;
+};
+
+/**
+ * Capture -> correlate -> render pipeline. Each camera is drained by its own thread (or both by
+ * one StereoGrabber thread), a single worker owns the CorrelationSession, pairs the two streams
+ * by timestamp and always correlates the newest pair, and the render stage stays on the calling
+ * thread because HighGUI has to run there. The stages are joined by FrameQueues that drop the
+ * oldest entry when full.
+ */
+class LivePipeline {
+public:
+    LivePipeline(FrameSource &left_camera, FrameSource &right_camera, CorrelationSession &session,
+                 const PipelineOptions &options = PipelineOptions());
+
+    ~LivePipeline();
+
+    void start();
+
+    /** Stop and join every stage, the session is free to use again afterwards */
+    void stop();
+
+    void set_correlating(bool correlating) { correlating_ = correlating; }
+
+    bool correlating() const { return correlating_; }
+
+    /** Publish every correlated pair to a shared memory ring, the worker is its only writer */
+    void set_publisher(ResultRingWriter *publisher) { publisher_ = publisher; }
+
+    /** Store a new reference pair and make the worker set the session up again */
+    void request_reference(const cv::Mat &left, const cv::Mat &right);
+
+    /** Newest preview frames, returns false when neither camera produced anything new */
+    bool next_preview(CapturedFrame &left, CapturedFrame &right);
+
+    bool next_result(CorrelationResult &result);
+
+    /** Render stage timing and heap allocations, reported by the thread that draws the result */
+    void record_render(double render_ms, long allocations, const CorrelationResult &result);
+
+    PipelineStats stats() const;
+
+    void print_stats(std::ostream &os) const;
+
+    bool failed_step() const { return failed_step_; }
+
+private:
+    void capture_loop(FrameSource *camera, FramePool *pool, FrameQueue<CapturedFrame> *work_queue,
+                      FrameQueue<CapturedFrame> *preview_queue, StageStats *capture_stats,
+                      StageStats *allocation_stats);
+
+    void stereo_capture_loop();
+
+    void wait_before_retry(int &failures);
+
+    void correlation_loop();
+
+    bool correlate_pair(const StereoFrame &pair);
+
+    FrameSource &left_camera_;
+    FrameSource &right_camera_;
+    CorrelationSession &session_;
+    const PipelineOptions options_;
+    StereoPairMatcher matcher_;
+
+    FrameQueue<CapturedFrame> left_queue_;
+    FrameQueue<CapturedFrame> right_queue_;
+    FrameQueue<CapturedFrame> left_preview_;
+    FrameQueue<CapturedFrame> right_preview_;
+    FrameQueue<CorrelationResult> result_queue_;
+    /* capture buffers, recycled once the queues, the matcher and the render loop let go of them */
+    FramePool left_pool_;
+    FramePool right_pool_;
+    CorrelationResult result_;
+    ResultRingWriter *publisher_;
+
+    std::thread left_thread_;
+    std::thread right_thread_;
+    std::thread correlation_thread_;
+    std::atomic<bool> running_;
+    std::atomic<bool> correlating_;
+    std::atomic<bool> failed_step_;
+    /* lets stop() cut short a capture thread backing off from a failing camera */
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cond_;
+
+    std::mutex reference_mutex_;
+    cv::Mat reference_left_;
+    cv::Mat reference_right_;
+    bool reference_pending_;
+
+    mutable std::mutex stats_mutex_;
+    StageStats capture_left_stats_;
+    StageStats capture_right_stats_;
+    StageStats correlation_stats_;
+    StageStats render_stats_;
+    StageStats end_to_end_stats_;
+    StageStats pair_skew_stats_;
+    size_t pairs_flagged_;
+    size_t pairs_rejected_;
+    StageStats capture_left_allocations_;
+    StageStats capture_right_allocations_;
+    StageStats correlation_allocations_;
+    StageStats render_allocations_;
+    DeadlineStats deadline_stats_;
+    ChangeGateStats change_gate_stats_;
+    PyramidStats pyramid_stats_;
+};
+
+#endif //CUSTOM_APP_LIVEPIPELINE_H
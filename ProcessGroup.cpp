@@ -0,0 +1,132 @@
+#include "ProcessGroup.h"
+
+#include <cstdlib>
+
+#if DICE_MPI
+#  include <mpi.h>
+#endif
+
+using namespace std;
+
+#if DICE_MPI
+static bool mpi_running() {
+    int initialized = 0;
+    int finalized = 0;
+    MPI_Initialized(&initialized);
+    MPI_Finalized(&finalized);
+    return initialized && !finalized;
+}
+#endif
+
+int process_rank() {
+#if DICE_MPI
+    if (mpi_running()) {
+        int rank = 0;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        return rank;
+    }
+#endif
+    return 0;
+}
+
+int process_size() {
+#if DICE_MPI
+    if (mpi_running()) {
+        int size = 1;
+        MPI_Comm_size(MPI_COMM_WORLD, &size);
+        return size;
+    }
+#endif
+    return 1;
+}
+
+void broadcast_value(int &value) {
+#if DICE_MPI
+    if (process_size() > 1)
+        MPI_Bcast(&value, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#else
+    (void) value;
+#endif
+}
+
+void broadcast_string(string &text) {
+#if DICE_MPI
+    if (process_size() <= 1)
+        return;
+    int length = text.size();
+    broadcast_value(length);
+    text.resize(length);
+    if (length > 0)
+        MPI_Bcast(&text[0], length, MPI_CHAR, 0, MPI_COMM_WORLD);
+#else
+    (void) text;
+#endif
+}
+
+void broadcast_mat(cv::Mat &image) {
+#if DICE_MPI
+    if (process_size() <= 1)
+        return;
+    int header[3] = {image.rows, image.cols, image.type()};
+    MPI_Bcast(header, 3, MPI_INT, 0, MPI_COMM_WORLD);
+    if (process_rank() == 0) {
+        if (!image.isContinuous())
+            image = image.clone();
+    } else {
+        image.create(header[0], header[1], header[2]);
+    }
+    const size_t bytes = image.total() * image.elemSize();
+    if (bytes > 0)
+        MPI_Bcast(image.data, (int) bytes, MPI_BYTE, 0, MPI_COMM_WORLD);
+#else
+    (void) image;
+#endif
+}
+
+void gather_by_global_id(const vector<int_t> &global_ids, const vector<scalar_t> &values, int_t num_global,
+                         vector<scalar_t> &gathered) {
+    const int size = process_size();
+    gathered.clear();
+    if (size <= 1) {
+        gathered.assign(num_global, 0.0);
+        for (size_t i = 0; i < global_ids.size(); ++i)
+            gathered[global_ids[i]] = values[i];
+        return;
+    }
+#if DICE_MPI
+    const int rank = process_rank();
+    // ids and values travel as int and double so float and double builds use the same calls
+    int local_count = global_ids.size();
+    vector<int> counts(size, 0);
+    MPI_Gather(&local_count, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    vector<int> offsets(size, 0);
+    int total = 0;
+    for (int proc = 0; proc < size; ++proc) {
+        offsets[proc] = total;
+        total += counts[proc];
+    }
+    const vector<int> local_ids(global_ids.begin(), global_ids.end());
+    const vector<double> local_values(values.begin(), values.end());
+    vector<int> all_ids(rank == 0 ? total + 1 : 1);
+    vector<double> all_values(rank == 0 ? total + 1 : 1);
+    MPI_Gatherv(local_count ? &local_ids[0] : NULL, local_count, MPI_INT,
+                &all_ids[0], &counts[0], &offsets[0], MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(local_count ? &local_values[0] : NULL, local_count, MPI_DOUBLE,
+                &all_values[0], &counts[0], &offsets[0], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank != 0)
+        return;
+    gathered.assign(num_global, 0.0);
+    for (int i = 0; i < total; ++i) {
+        if (all_ids[i] >= 0 && all_ids[i] < num_global)
+            gathered[all_ids[i]] = all_values[i];
+    }
+#endif
+}
+
+void abort_processes(int error_code) {
+#if DICE_MPI
+    if (process_size() > 1)
+        MPI_Abort(MPI_COMM_WORLD, error_code);
+#endif
+    exit(error_code);
+}
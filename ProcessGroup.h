@@ -0,0 +1,39 @@
+#ifndef CUSTOM_APP_PROCESSGROUP_H
+#define CUSTOM_APP_PROCESSGROUP_H
+
+#include <DICe.h>
+
+#include <string>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/*
+ * The few MPI calls the app needs on top of what DICe does itself. Without DICE_MPI, or before
+ * DICe::initialize() has started MPI, every process is rank 0 of 1 and these are no-ops.
+ * Everything except process_rank()/process_size() is collective over MPI_COMM_WORLD with
+ * rank 0 as the root.
+ */
+
+int process_rank();
+
+int process_size();
+
+void broadcast_value(int &value);
+
+void broadcast_string(std::string &text);
+
+/** Send rank 0's image to every process, the others get a continuous copy */
+void broadcast_mat(cv::Mat &image);
+
+/**
+ * Collect the values of the locally owned subsets on rank 0. gathered ends up with num_global
+ * entries indexed by global subset id on rank 0 and is left empty everywhere else.
+ */
+void gather_by_global_id(const std::vector<int_t> &global_ids, const std::vector<scalar_t> &values,
+                         int_t num_global, std::vector<scalar_t> &gathered);
+
+/** Take every process down, for errors on rank 0 that would leave the others waiting */
+void abort_processes(int error_code);
+
+#endif //CUSTOM_APP_PROCESSGROUP_H
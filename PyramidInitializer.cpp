@@ -0,0 +1,129 @@
+#include "PyramidInitializer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DICe::field_enums;
+using namespace std;
+
+/* the finer levels only correct the rounding of the level above */
+static const int REFINE_RADIUS = 2;
+/* smallest template side at the coarse levels, smaller windows match anything */
+static const int MIN_TEMPLATE = 7;
+
+void ImagePyramid::build(const cv::Mat &image, int num_levels) {
+    levels.resize(std::max(num_levels, 1));
+    const cv::Mat *gray = &image;
+    if (image.channels() == 3) {
+        cv::cvtColor(image, gray_, cv::COLOR_BGR2GRAY);
+        gray = &gray_;
+    } else if (image.channels() == 4) {
+        cv::cvtColor(image, gray_, cv::COLOR_BGRA2GRAY);
+        gray = &gray_;
+    }
+    // a fixed scale rather than a min-max stretch, so the reference and every frame see the same mapping
+    if (gray->depth() == CV_16U)
+        gray->convertTo(levels[0], CV_8U, 1.0 / 257.0);
+    else if (gray->depth() == CV_8U || gray->depth() == CV_32F)
+        gray->copyTo(levels[0]);
+    else
+        gray->convertTo(levels[0], CV_32F);
+    for (size_t level = 1; level < levels.size(); ++level)
+        cv::pyrDown(levels[level - 1], levels[level]);
+}
+
+PyramidInitializer::PyramidInitializer() :
+        num_levels_(0),
+        search_radius_(8),
+        min_correlation_(0.5) {}
+
+void PyramidInitializer::configure(int num_levels, int search_radius, double min_correlation) {
+    num_levels_ = std::max(num_levels, 0);
+    search_radius_ = std::max(search_radius, 1);
+    min_correlation_ = min_correlation;
+}
+
+static bool inside(const cv::Rect &rect, const cv::Mat &image) {
+    return rect.x >= 0 && rect.y >= 0 && rect.x + rect.width <= image.cols && rect.y + rect.height <= image.rows;
+}
+
+/* Vertex of the parabola through three samples around a peak, as an offset from the middle one */
+static double parabola_peak(float before, float peak, float after) {
+    const double curvature = before - 2.0 * peak + after;
+    return curvature < 0.0 ? 0.5 * (before - after) / curvature : 0.0;
+}
+
+int_t PyramidInitializer::initialize(const ImagePyramid &reference, const ImagePyramid &frame,
+                                     const Teuchos::RCP<DICe::Schema> &schema, const vector<int_t> *skip,
+                                     const vector<char> *only, bool fresh, int_t &weak) const {
+    weak = 0;
+    if (!enabled() || reference.empty() || frame.empty())
+        return 0;
+    const int levels = (int) std::min(reference.levels.size(), frame.levels.size());
+    const int half_subset = schema->subset_dim() / 2;
+    cv::Mat scores;
+    int_t seeded = 0;
+    for (int_t subset_it = 0; subset_it < schema->local_num_subsets(); ++subset_it) {
+        if ((skip != NULL && (*skip)[subset_it]) || (only != NULL && !(*only)[subset_it]))
+            continue;
+        const double cx = schema->local_field_value(subset_it, SUBSET_COORDINATES_X_FS);
+        const double cy = schema->local_field_value(subset_it, SUBSET_COORDINATES_Y_FS);
+        double u = fresh ? 0.0 : schema->local_field_value(subset_it, SUBSET_DISPLACEMENT_X_FS);
+        double v = fresh ? 0.0 : schema->local_field_value(subset_it, SUBSET_DISPLACEMENT_Y_FS);
+        double score = -1.0;
+        for (int level = levels - 1; level >= 0; --level) {
+            const double scale = 1.0 / (1 << level);
+            const int half = std::max(half_subset >> level, MIN_TEMPLATE / 2);
+            const int radius = level == levels - 1 ? search_radius_ : REFINE_RADIUS;
+            const cv::Mat &reference_level = reference.levels[level];
+            const cv::Mat &frame_level = frame.levels[level];
+            const int tx = (int) std::floor(cx * scale + 0.5) - half;
+            const int ty = (int) std::floor(cy * scale + 0.5) - half;
+            const cv::Rect window(tx, ty, 2 * half + 1, 2 * half + 1);
+            if (!inside(window, reference_level))
+                continue;
+            // where the window should be in the frame, widened by the search radius and kept inside the image
+            const int px = tx + (int) std::floor(u * scale + 0.5);
+            const int py = ty + (int) std::floor(v * scale + 0.5);
+            const int left = std::max(px - radius, 0);
+            const int top = std::max(py - radius, 0);
+            const int right = std::min(px + window.width + radius, frame_level.cols);
+            const int bottom = std::min(py + window.height + radius, frame_level.rows);
+            if (right - left < window.width || bottom - top < window.height)
+                continue;
+            cv::matchTemplate(frame_level(cv::Rect(left, top, right - left, bottom - top)), reference_level(window),
+                              scores, cv::TM_CCOEFF_NORMED);
+            double best;
+            cv::Point peak;
+            cv::minMaxLoc(scores, NULL, &best, NULL, &peak);
+            double dx = left + peak.x - tx;
+            double dy = top + peak.y - ty;
+            if (level == 0) {
+                if (peak.x > 0 && peak.x + 1 < scores.cols)
+                    dx += parabola_peak(scores.at<float>(peak.y, peak.x - 1), scores.at<float>(peak.y, peak.x),
+                                        scores.at<float>(peak.y, peak.x + 1));
+                if (peak.y > 0 && peak.y + 1 < scores.rows)
+                    dy += parabola_peak(scores.at<float>(peak.y - 1, peak.x), scores.at<float>(peak.y, peak.x),
+                                        scores.at<float>(peak.y + 1, peak.x));
+                score = best;
+            }
+            u = dx / scale;
+            v = dy / scale;
+        }
+        if (score < min_correlation_) {
+            // no trustworthy match, whatever DICe put in the fields is the better start
+            ++weak;
+            continue;
+        }
+        schema->local_field_value(subset_it, SUBSET_DISPLACEMENT_X_FS) = u;
+        schema->local_field_value(subset_it, SUBSET_DISPLACEMENT_Y_FS) = v;
+        if (fresh) {
+            schema->local_field_value(subset_it, ROTATION_Z_FS) = 0.0;
+            schema->local_field_value(subset_it, NORMAL_STRETCH_XX_FS) = 0.0;
+            schema->local_field_value(subset_it, NORMAL_STRETCH_YY_FS) = 0.0;
+            schema->local_field_value(subset_it, SHEAR_STRETCH_XY_FS) = 0.0;
+        }
+        ++seeded;
+    }
+    return seeded;
+}
@@ -0,0 +1,83 @@
+#ifndef CUSTOM_APP_PYRAMIDINITIALIZER_H
+#define CUSTOM_APP_PYRAMIDINITIALIZER_H
+
+#include <DICe.h>
+#include <DICe_Schema.h>
+
+#include <vector>
+
+#include <Teuchos_RCP.hpp>
+
+#include "opencv2/opencv.hpp"
+
+/* Subsets seeded and time spent since the last setup() */
+struct PyramidStats {
+    long frames;
+    long subsets_initialized;
+    /* the best match at full resolution was too weak to trust, the subset kept its last start */
+    long subsets_weak;
+    double build_ms;
+    double search_ms;
+
+    PyramidStats() :
+            frames(0),
+            subsets_initialized(0),
+            subsets_weak(0),
+            build_ms(0.0),
+            search_ms(0.0) {}
+};
+
+/**
+ * An image and its halvings, level 0 at full resolution. Grey, 8 bit where the input is 8 or 16
+ * bit; the buffers are kept between frames so rebuilding costs no allocations.
+ */
+struct ImagePyramid {
+    std::vector<cv::Mat> levels;
+
+    void build(const cv::Mat &image, int num_levels);
+
+    bool empty() const { return levels.empty() || levels[0].empty(); }
+
+private:
+    cv::Mat gray_;
+};
+
+/**
+ * Coarse-to-fine translation estimate for every subset, as a cheaper and steadier start for the
+ * GRADIENT_BASED solver than USE_FEATURE_MATCHING. The subset's reference window is searched for
+ * with zero-normalised cross-correlation (cv::matchTemplate, TM_CCOEFF_NORMED) at the coarsest
+ * level over +-search_radius pixels around the prior, then at each finer level over +-2 pixels
+ * around the doubled estimate, and the full resolution peak gets a parabolic sub-pixel fit. The
+ * result goes into SUBSET_DISPLACEMENT_X/Y, which DICe starts from with USE_FIELD_VALUES.
+ */
+class PyramidInitializer {
+public:
+    PyramidInitializer();
+
+    void configure(int num_levels, int search_radius, double min_correlation = 0.5);
+
+    int num_levels() const { return num_levels_; }
+
+    int search_radius() const { return search_radius_; }
+
+    double min_correlation() const { return min_correlation_; }
+
+    bool enabled() const { return num_levels_ > 0; }
+
+    /**
+     * Seed the subsets of schema from reference to frame. Subsets with skip[i] set are left
+     * alone, and so are those with only[i] clear if only is given. fresh starts the search at zero
+     * displacement and zeroes the rotation and stretches, otherwise the current fields are the
+     * prior and the shape is kept. Returns the number of subsets seeded, weak counts the ones whose
+     * match was under min_correlation; those are left as they are, fresh or not. Const, the left and right schemas can be seeded at the same time.
+     */
+    int_t initialize(const ImagePyramid &reference, const ImagePyramid &frame, const Teuchos::RCP<DICe::Schema> &schema,
+                     const std::vector<int_t> *skip, const std::vector<char> *only, bool fresh, int_t &weak) const;
+
+private:
+    int num_levels_;
+    int search_radius_;
+    double min_correlation_;
+};
+
+#endif //CUSTOM_APP_PYRAMIDINITIALIZER_H
@@ -0,0 +1,156 @@
+#include "ResultFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+using namespace std;
+
+string result_file_name(const string &folder, const string &prefix) {
+    return folder + prefix + ".dres";
+}
+
+ResultFileWriter::ResultFileWriter() :
+        file_(NULL),
+        num_subsets_(0) {}
+
+ResultFileWriter::~ResultFileWriter() {
+    close();
+}
+
+bool ResultFileWriter::open(const string &file_name, const vector<string> &field_names, int64_t num_subsets) {
+    close();
+    file_ = fopen(file_name.c_str(), "wb");
+    if (file_ == NULL)
+        return false;
+    field_names_ = field_names;
+    num_subsets_ = num_subsets;
+    block_.assign(1 + field_names.size() * num_subsets, 0.0);
+
+    ResultFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+    header.byte_order = RESULT_FILE_BYTE_ORDER;
+    header.num_fields = field_names.size();
+    header.num_subsets = num_subsets;
+    const size_t used = sizeof(header) + field_names.size() * RESULT_FIELD_NAME_BYTES;
+    header.header_bytes = (used + RESULT_HEADER_ALIGNMENT - 1) / RESULT_HEADER_ALIGNMENT * RESULT_HEADER_ALIGNMENT;
+    header.frame_bytes = block_.size() * sizeof(double);
+
+    vector<char> bytes(header.header_bytes, 0);
+    memcpy(&bytes[0], &header, sizeof(header));
+    for (size_t field = 0; field < field_names.size(); ++field)
+        // longer names are cut, the last byte stays NUL
+        strncpy(&bytes[sizeof(header) + field * RESULT_FIELD_NAME_BYTES], field_names[field].c_str(),
+                RESULT_FIELD_NAME_BYTES - 1);
+    if (fwrite(&bytes[0], 1, bytes.size(), file_) != bytes.size()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ResultFileWriter::close() {
+    if (file_ != NULL)
+        fclose(file_);
+    file_ = NULL;
+}
+
+bool ResultFileWriter::matches(const vector<string> &field_names, int64_t num_subsets) const {
+    return num_subsets == num_subsets_ && field_names == field_names_;
+}
+
+bool ResultFileWriter::write_block() {
+    return file_ != NULL && fwrite(&block_[0], sizeof(double), block_.size(), file_) == block_.size();
+}
+
+void ResultFileWriter::flush() {
+    if (file_ != NULL)
+        fflush(file_);
+}
+
+ResultFileReader::ResultFileReader() :
+        data_(NULL),
+        size_(0),
+        num_subsets_(0),
+        num_frames_(0),
+        header_bytes_(0),
+        frame_bytes_(0) {}
+
+ResultFileReader::~ResultFileReader() {
+    close();
+}
+
+bool ResultFileReader::open(const string &file_name) {
+    close();
+    const int descriptor = ::open(file_name.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        error_ = "cannot open " + file_name;
+        return false;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || (size_t) info.st_size < sizeof(ResultFileHeader)) {
+        ::close(descriptor);
+        error_ = file_name + " is too short to be a result file";
+        return false;
+    }
+    void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    // the mapping keeps its own reference to the file
+    ::close(descriptor);
+    if (mapping == MAP_FAILED) {
+        error_ = "cannot map " + file_name;
+        return false;
+    }
+    data_ = static_cast<const char *>(mapping);
+    size_ = info.st_size;
+
+    ResultFileHeader header;
+    memcpy(&header, data_, sizeof(header));
+    if (memcmp(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        close();
+        error_ = file_name + " is not a result file";
+        return false;
+    }
+    if (header.byte_order != RESULT_FILE_BYTE_ORDER) {
+        close();
+        error_ = file_name + " was written on a machine with a different byte order";
+        return false;
+    }
+    if (header.header_bytes > size_ || header.frame_bytes != (1 + header.num_fields * header.num_subsets) * sizeof(double)
+        || sizeof(header) + header.num_fields * RESULT_FIELD_NAME_BYTES > header.header_bytes) {
+        close();
+        error_ = file_name + " has a damaged header";
+        return false;
+    }
+    header_bytes_ = header.header_bytes;
+    frame_bytes_ = header.frame_bytes;
+    num_subsets_ = header.num_subsets;
+    num_frames_ = (size_ - header_bytes_) / frame_bytes_;
+    const char *names = data_ + sizeof(header);
+    for (uint32_t field = 0; field < header.num_fields; ++field) {
+        const char *name = names + field * RESULT_FIELD_NAME_BYTES;
+        field_names_.push_back(string(name, strnlen(name, RESULT_FIELD_NAME_BYTES)));
+    }
+    return true;
+}
+
+void ResultFileReader::close() {
+    if (data_ != NULL)
+        munmap(const_cast<char *>(data_), size_);
+    data_ = NULL;
+    size_ = 0;
+    field_names_.clear();
+    num_subsets_ = 0;
+    num_frames_ = 0;
+    error_.clear();
+}
+
+int ResultFileReader::field_index(const string &name) const {
+    for (size_t field = 0; field < field_names_.size(); ++field)
+        if (field_names_[field] == name)
+            return field;
+    return -1;
+}
@@ -0,0 +1,129 @@
+#ifndef CUSTOM_APP_RESULTFILE_H
+#define CUSTOM_APP_RESULTFILE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Columnar result file, every frame of one schema in a single file:
+ *
+ *   header       ResultFileHeader, then num_fields names of RESULT_FIELD_NAME_BYTES each
+ *                (NUL padded), padded with zeros to header_bytes (a multiple of 4096)
+ *   frame block  float64 frame number, then num_fields columns of num_subsets float64 values
+ *
+ * Every block is frame_bytes long, so frame n starts at header_bytes + n * frame_bytes and a
+ * mapped file is read in place. The frame count is not stored, it follows from the file size,
+ * which means a file cut short by a crash is still readable up to its last whole frame.
+ * Values are in the byte order of the machine that wrote them, checked through byte_order.
+ */
+const char RESULT_FILE_MAGIC[8] = {'D', 'I', 'C', 'E', 'R', 'E', 'S', '1'};
+const uint32_t RESULT_FILE_BYTE_ORDER = 0x01020304;
+const size_t RESULT_FIELD_NAME_BYTES = 64;
+const size_t RESULT_HEADER_ALIGNMENT = 4096;
+
+struct ResultFileHeader {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t num_fields;
+    uint64_t num_subsets;
+    uint64_t header_bytes;
+    uint64_t frame_bytes;
+};
+
+/** <folder><prefix>.dres */
+std::string result_file_name(const std::string &folder, const std::string &prefix);
+
+/** Appends frames to one result file, the header is written when the file is opened */
+class ResultFileWriter {
+public:
+    ResultFileWriter();
+
+    ~ResultFileWriter();
+
+    /** Creates or truncates file_name, false if it cannot be written */
+    bool open(const std::string &file_name, const std::vector<std::string> &field_names, int64_t num_subsets);
+
+    void close();
+
+    bool is_open() const { return file_ != NULL; }
+
+    bool matches(const std::vector<std::string> &field_names, int64_t num_subsets) const;
+
+    /** values field after field, num_fields * num_subsets of them */
+    template<class T>
+    bool append(double frame, const T *values) {
+        block_[0] = frame;
+        for (size_t i = 1; i < block_.size(); ++i)
+            block_[i] = (double) values[i - 1];
+        return write_block();
+    }
+
+    /** Hand what has been appended to the OS so a reader sees it */
+    void flush();
+
+private:
+    ResultFileWriter(const ResultFileWriter &);
+
+    ResultFileWriter &operator=(const ResultFileWriter &);
+
+    bool write_block();
+
+    FILE *file_;
+    std::vector<std::string> field_names_;
+    int64_t num_subsets_;
+    std::vector<double> block_;
+};
+
+/** Read-only memory map of a result file */
+class ResultFileReader {
+public:
+    ResultFileReader();
+
+    ~ResultFileReader();
+
+    /** False with error() set if the file is missing or not a result file */
+    bool open(const std::string &file_name);
+
+    void close();
+
+    const std::string &error() const { return error_; }
+
+    const std::vector<std::string> &field_names() const { return field_names_; }
+
+    /** Index of name in field_names(), -1 if it is not there */
+    int field_index(const std::string &name) const;
+
+    int64_t num_subsets() const { return num_subsets_; }
+
+    int64_t num_frames() const { return num_frames_; }
+
+    double frame_number(int64_t frame) const { return *block(frame); }
+
+    /** The num_subsets values of one field in one frame, straight out of the mapping */
+    const double *column(int64_t frame, size_t field) const { return block(frame) + 1 + field * num_subsets_; }
+
+    double value(int64_t frame, size_t field, int64_t subset) const { return column(frame, field)[subset]; }
+
+private:
+    ResultFileReader(const ResultFileReader &);
+
+    ResultFileReader &operator=(const ResultFileReader &);
+
+    const double *block(int64_t frame) const {
+        return reinterpret_cast<const double *>(data_ + header_bytes_ + frame * frame_bytes_);
+    }
+
+    const char *data_;
+    size_t size_;
+    std::vector<std::string> field_names_;
+    int64_t num_subsets_;
+    int64_t num_frames_;
+    uint64_t header_bytes_;
+    uint64_t frame_bytes_;
+    std::string error_;
+};
+
+#endif //CUSTOM_APP_RESULTFILE_H
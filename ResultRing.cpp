@@ -0,0 +1,204 @@
+#include "ResultRing.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+static size_t aligned(size_t bytes) {
+    return (bytes + RESULT_RING_ALIGNMENT - 1) / RESULT_RING_ALIGNMENT * RESULT_RING_ALIGNMENT;
+}
+
+static size_t array_bytes(uint32_t max_subsets, size_t value_bytes) {
+    return aligned(max_subsets * value_bytes);
+}
+
+static size_t slot_bytes(uint32_t max_subsets) {
+    return aligned(sizeof(ResultRingSlot)) + 4 * array_bytes(max_subsets, sizeof(double))
+           + array_bytes(max_subsets, sizeof(int32_t));
+}
+
+/* Where each array of a slot starts, the same on both sides */
+struct SlotLayout {
+    size_t displacement_x;
+    size_t displacement_y;
+    size_t displacement_z;
+    size_t sigma;
+    size_t status;
+
+    explicit SlotLayout(uint32_t max_subsets) {
+        const size_t doubles = array_bytes(max_subsets, sizeof(double));
+        displacement_x = aligned(sizeof(ResultRingSlot));
+        displacement_y = displacement_x + doubles;
+        displacement_z = displacement_y + doubles;
+        sigma = displacement_z + doubles;
+        status = sigma + doubles;
+    }
+};
+
+ResultRingWriter::ResultRingWriter(const string &name, uint32_t slot_count, uint32_t min_subsets) :
+        name_(name),
+        slot_count_(std::max(slot_count, (uint32_t) 2)),
+        min_subsets_(min_subsets),
+        data_(NULL),
+        size_(0),
+        published_(0) {}
+
+ResultRingWriter::~ResultRingWriter() {
+    close();
+}
+
+bool ResultRingWriter::create(uint32_t max_subsets) {
+    close();
+    // a segment left behind by a writer that crashed is replaced
+    shm_unlink(name_.c_str());
+    const int descriptor = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (descriptor < 0)
+        return false;
+    const size_t size = aligned(sizeof(ResultRingHeader)) + slot_count_ * slot_bytes(max_subsets);
+    void *mapping = MAP_FAILED;
+    if (ftruncate(descriptor, size) == 0)
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name_.c_str());
+        return false;
+    }
+    data_ = static_cast<char *>(mapping);
+    size_ = size;
+
+    // ftruncate zero fills, every slot starts at sequence 0: never written
+    ResultRingHeader *header = new(data_) ResultRingHeader;
+    header->slot_count = slot_count_;
+    header->max_subsets = max_subsets;
+    header->slot_bytes = slot_bytes(max_subsets);
+    header->published.store(published_, memory_order_relaxed);
+    header->closed.store(0, memory_order_relaxed);
+    for (uint32_t slot = 0; slot < slot_count_; ++slot) {
+        ResultRingSlot *ring_slot = new(data_ + aligned(sizeof(ResultRingHeader)) + slot * header->slot_bytes)
+                ResultRingSlot;
+        ring_slot->sequence.store(0, memory_order_relaxed);
+    }
+    // readers check the magic last, the header is complete once it is there
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, RESULT_RING_MAGIC, sizeof(header->magic));
+    return true;
+}
+
+void ResultRingWriter::close() {
+    if (data_ == NULL)
+        return;
+    reinterpret_cast<ResultRingHeader *>(data_)->closed.store(1, memory_order_release);
+    munmap(data_, size_);
+    shm_unlink(name_.c_str());
+    data_ = NULL;
+    size_ = 0;
+}
+
+bool ResultRingWriter::publish(const SubSetData &subsets, double timestamp_ms, bool failed_step) {
+    const uint32_t num_subsets = subsets.size();
+    ResultRingHeader *header = reinterpret_cast<ResultRingHeader *>(data_);
+    if ((data_ == NULL || num_subsets > header->max_subsets) &&
+        !create(std::max(std::max(num_subsets, min_subsets_), (uint32_t) 1)))
+        return false;
+    header = reinterpret_cast<ResultRingHeader *>(data_);
+
+    const uint64_t frame = published_;
+    char *slot_data = data_ + aligned(sizeof(ResultRingHeader)) + (frame % slot_count_) * header->slot_bytes;
+    ResultRingSlot *slot = reinterpret_cast<ResultRingSlot *>(slot_data);
+    const SlotLayout layout(header->max_subsets);
+    slot->sequence.store(2 * frame + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->frame = frame;
+    slot->timestamp_ms = timestamp_ms;
+    slot->num_subsets = num_subsets;
+    slot->failed_step = failed_step ? 1 : 0;
+    // the subset store keeps scalar_t, the ring always has doubles so readers need not know the DICe build
+    double *displacement_x = reinterpret_cast<double *>(slot_data + layout.displacement_x);
+    double *displacement_y = reinterpret_cast<double *>(slot_data + layout.displacement_y);
+    double *displacement_z = reinterpret_cast<double *>(slot_data + layout.displacement_z);
+    double *sigma = reinterpret_cast<double *>(slot_data + layout.sigma);
+    int32_t *status = reinterpret_cast<int32_t *>(slot_data + layout.status);
+    std::copy(subsets.displacement_x.begin(), subsets.displacement_x.end(), displacement_x);
+    std::copy(subsets.displacement_y.begin(), subsets.displacement_y.end(), displacement_y);
+    std::copy(subsets.displacement_z.begin(), subsets.displacement_z.end(), displacement_z);
+    std::copy(subsets.sigma.begin(), subsets.sigma.end(), sigma);
+    std::copy(subsets.status.begin(), subsets.status.end(), status);
+    slot->sequence.store(2 * frame + 2, memory_order_release);
+    header->published.store(++published_, memory_order_release);
+    return true;
+}
+
+ResultRingReader::ResultRingReader() :
+        data_(NULL),
+        size_(0) {}
+
+ResultRingReader::~ResultRingReader() {
+    close();
+}
+
+bool ResultRingReader::open(const string &name) {
+    close();
+    const int descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+    if (descriptor < 0)
+        return false;
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if (fstat(descriptor, &info) == 0 && (size_t) info.st_size >= sizeof(ResultRingHeader))
+        mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED)
+        return false;
+    data_ = static_cast<const char *>(mapping);
+    size_ = info.st_size;
+    const ResultRingHeader *ring = header();
+    atomic_thread_fence(memory_order_acquire);
+    // a writer still setting the segment up, or something else under that name
+    if (memcmp(ring->magic, RESULT_RING_MAGIC, sizeof(ring->magic)) != 0
+        || aligned(sizeof(ResultRingHeader)) + ring->slot_count * ring->slot_bytes > size_) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ResultRingReader::close() {
+    if (data_ != NULL)
+        munmap(const_cast<char *>(data_), size_);
+    data_ = NULL;
+    size_ = 0;
+}
+
+bool ResultRingReader::view(uint64_t n, ResultRingView &view) const {
+    const ResultRingHeader *ring = header();
+    const char *slot_data = data_ + aligned(sizeof(ResultRingHeader)) + (n % ring->slot_count) * ring->slot_bytes;
+    const ResultRingSlot *slot = reinterpret_cast<const ResultRingSlot *>(slot_data);
+    const uint64_t sequence = slot->sequence.load(memory_order_acquire);
+    if (sequence != 2 * n + 2)
+        return false;
+    const SlotLayout layout(ring->max_subsets);
+    view.frame = slot->frame;
+    view.timestamp_ms = slot->timestamp_ms;
+    view.num_subsets = std::min(slot->num_subsets, ring->max_subsets);
+    view.failed_step = slot->failed_step != 0;
+    view.displacement_x = reinterpret_cast<const double *>(slot_data + layout.displacement_x);
+    view.displacement_y = reinterpret_cast<const double *>(slot_data + layout.displacement_y);
+    view.displacement_z = reinterpret_cast<const double *>(slot_data + layout.displacement_z);
+    view.sigma = reinterpret_cast<const double *>(slot_data + layout.sigma);
+    view.status = reinterpret_cast<const int32_t *>(slot_data + layout.status);
+    view.slot = slot;
+    view.sequence = sequence;
+    return true;
+}
+
+bool ResultRingReader::still_valid(const ResultRingView &view) const {
+    // the reads of the values must not drift past the second look at the sequence
+    atomic_thread_fence(memory_order_acquire);
+    return view.slot->sequence.load(memory_order_relaxed) == view.sequence;
+}
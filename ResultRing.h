@@ -0,0 +1,129 @@
+#ifndef CUSTOM_APP_RESULTRING_H
+#define CUSTOM_APP_RESULTRING_H
+
+#include <DICe.h>
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "SubSetData.h"
+
+/*
+ * A POSIX shared memory segment holding the last slot_count frames of per-subset results for
+ * any number of local readers. One process writes, readers never write to the segment, so a slow
+ * or dead reader cannot hold up the correlation. Each slot is guarded by a sequence number in
+ * the style of a seqlock: odd while the writer fills it, 2 * (frame + 1) once frame is complete.
+ * A reader looks at a slot in place and checks the sequence again when it is done; if the writer
+ * came round in the meantime the view is torn and the reader drops it.
+ */
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#  error "the result ring needs lock-free 64 bit atomics to be shared between processes"
+#endif
+
+static const char RESULT_RING_MAGIC[8] = {'D', 'I', 'C', 'E', 'R', 'N', 'G', '1'};
+static const size_t RESULT_RING_ALIGNMENT = 64;
+
+struct ResultRingHeader {
+    char magic[8];
+    uint32_t slot_count;
+    uint32_t max_subsets;
+    uint64_t slot_bytes;
+    /* frames published so far, frame n lives in slot n % slot_count */
+    std::atomic<uint64_t> published;
+    /* set before the writer unlinks the segment, e.g. to make a bigger one */
+    std::atomic<uint32_t> closed;
+};
+
+struct ResultRingSlot {
+    std::atomic<uint64_t> sequence;
+    uint64_t frame;
+    double timestamp_ms;
+    uint32_t num_subsets;
+    uint32_t failed_step;
+    /* followed by max_subsets doubles of each of displacement x, y, z and sigma, then the int32 status */
+};
+
+/* One frame as it sits in the segment, valid until ResultRingReader::still_valid() says otherwise */
+struct ResultRingView {
+    uint64_t frame;
+    double timestamp_ms;
+    uint32_t num_subsets;
+    bool failed_step;
+    const double *displacement_x;
+    const double *displacement_y;
+    const double *displacement_z;
+    const double *sigma;
+    const int32_t *status;
+
+    const ResultRingSlot *slot;
+    uint64_t sequence;
+};
+
+class ResultRingWriter {
+public:
+    /** name is a shm_open name such as "/masters_results" */
+    explicit ResultRingWriter(const std::string &name, uint32_t slot_count = 64, uint32_t min_subsets = 0);
+
+    /** Marks the segment closed and unlinks it */
+    ~ResultRingWriter();
+
+    /**
+     * Copy the MODEL_DISPLACEMENT_X/Y/Z, SIGMA and STATUS_FLAG values of every subset into the
+     * next slot. Creates the segment on first use, and again, bigger, if the subsets outgrow it.
+     */
+    bool publish(const SubSetData &subsets, double timestamp_ms, bool failed_step);
+
+    uint64_t published() const { return published_; }
+
+    const std::string &name() const { return name_; }
+
+private:
+    bool create(uint32_t max_subsets);
+
+    void close();
+
+    const std::string name_;
+    const uint32_t slot_count_;
+    const uint32_t min_subsets_;
+    char *data_;
+    size_t size_;
+    uint64_t published_;
+};
+
+class ResultRingReader {
+public:
+    ResultRingReader();
+
+    ~ResultRingReader();
+
+    /** Map the segment read-only, false if no writer has created it yet */
+    bool open(const std::string &name);
+
+    void close();
+
+    bool is_open() const { return data_ != NULL; }
+
+    /** The writer went away or replaced the segment, open() again */
+    bool closed() const { return header()->closed.load(std::memory_order_acquire) != 0; }
+
+    uint64_t published() const { return header()->published.load(std::memory_order_acquire); }
+
+    uint32_t slot_count() const { return header()->slot_count; }
+
+    /** Frame index n (0 based) if it is complete and still in the ring */
+    bool view(uint64_t n, ResultRingView &view) const;
+
+    /** True if nothing overwrote the slot since view() */
+    bool still_valid(const ResultRingView &view) const;
+
+private:
+    const ResultRingHeader *header() const { return reinterpret_cast<const ResultRingHeader *>(data_); }
+
+    const char *data_;
+    size_t size_;
+};
+
+#endif //CUSTOM_APP_RESULTRING_H
@@ -0,0 +1,166 @@
+#include "ResultWriter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+static double elapsed_ms(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+ResultWriter::ResultWriter(size_t max_pending) :
+        max_pending_(max_pending > 0 ? max_pending : 1),
+        delimiter_(" "),
+        row_ids_(true),
+        format_(RESULT_TEXT),
+        in_flight_(0),
+        stopping_(false) {
+    thread_ = thread(&ResultWriter::writer_loop, this);
+}
+
+ResultWriter::~ResultWriter() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    not_empty_.notify_all();
+    // the loop only returns once the queue is empty
+    thread_.join();
+    binary_files_.clear();
+}
+
+void ResultWriter::set_text_layout(const string &delimiter, bool row_ids) {
+    unique_lock<mutex> lock(mutex_);
+    // the writer thread reads the layout without the lock while it has a batch in hand
+    drained_.wait(lock, [this] { return pending_.empty() && in_flight_ == 0; });
+    delimiter_ = delimiter;
+    row_ids_ = row_ids;
+}
+
+void ResultWriter::set_format(ResultFormat format) {
+    unique_lock<mutex> lock(mutex_);
+    drained_.wait(lock, [this] { return pending_.empty() && in_flight_ == 0; });
+    format_ = format;
+    binary_files_.clear();
+}
+
+void ResultWriter::push(const shared_ptr<const ResultSnapshot> &snapshot) {
+    unique_lock<mutex> lock(mutex_);
+    if (pending_.size() >= max_pending_) {
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        not_full_.wait(lock, [this] { return pending_.size() < max_pending_; });
+        stats_.blocked_ms += elapsed_ms(start);
+    }
+    pending_.push_back(snapshot);
+    if (pending_.size() > stats_.max_pending)
+        stats_.max_pending = pending_.size();
+    lock.unlock();
+    not_empty_.notify_one();
+}
+
+void ResultWriter::flush() {
+    unique_lock<mutex> lock(mutex_);
+    drained_.wait(lock, [this] { return pending_.empty() && in_flight_ == 0; });
+}
+
+ResultWriterStats ResultWriter::stats() const {
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+string ResultWriter::text_file_name(const ResultSnapshot &snapshot) {
+    char number[32];
+    snprintf(number, sizeof(number), "%04d", (int) snapshot.frame);
+    return snapshot.folder + snapshot.prefix + "_" + number + ".txt";
+}
+
+void ResultWriter::writer_loop() {
+    deque<shared_ptr<const ResultSnapshot> > batch;
+    for (;;) {
+        ResultFormat format;
+        {
+            unique_lock<mutex> lock(mutex_);
+            not_empty_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty())
+                return;
+            batch.swap(pending_);
+            in_flight_ = batch.size();
+            format = format_;
+        }
+        not_full_.notify_all();
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (format == RESULT_BINARY)
+                write_binary(*batch[i]);
+            else
+                write_text(*batch[i]);
+        }
+        for (map<string, shared_ptr<ResultFileWriter> >::iterator it = binary_files_.begin();
+             it != binary_files_.end(); ++it)
+            it->second->flush();
+        const size_t written = batch.size();
+        batch.clear();
+        {
+            lock_guard<mutex> lock(mutex_);
+            in_flight_ = 0;
+            stats_.frames_written += written;
+            ++stats_.batches;
+            stats_.write_ms += elapsed_ms(start);
+        }
+        drained_.notify_all();
+    }
+}
+
+void ResultWriter::write_text(const ResultSnapshot &snapshot) {
+    const string name = text_file_name(snapshot);
+    FILE *file = fopen(name.c_str(), "w");
+    if (file == NULL) {
+        cout << "Cannot write the result file " << name << endl;
+        return;
+    }
+    const vector<string> &field_names = *snapshot.field_names;
+    // the whole frame is formatted into one buffer and goes to the file in a single write
+    buffer_.clear();
+    if (row_ids_)
+        buffer_ += "SUBSET_ID" + delimiter_;
+    for (size_t field = 0; field < field_names.size(); ++field)
+        buffer_ += (field == 0 ? "" : delimiter_) + field_names[field];
+    buffer_ += "\n";
+    char number[32];
+    for (int_t subset = 0; subset < snapshot.num_subsets; ++subset) {
+        if (row_ids_) {
+            snprintf(number, sizeof(number), "%d", (int) subset);
+            buffer_ += number;
+            buffer_ += delimiter_;
+        }
+        for (size_t field = 0; field < field_names.size(); ++field) {
+            snprintf(number, sizeof(number), "%.6e", (double) snapshot.value(field, subset));
+            if (field > 0)
+                buffer_ += delimiter_;
+            buffer_ += number;
+        }
+        buffer_ += "\n";
+    }
+    fwrite(buffer_.data(), 1, buffer_.size(), file);
+    fclose(file);
+}
+
+void ResultWriter::write_binary(const ResultSnapshot &snapshot) {
+    const string name = result_file_name(snapshot.folder, snapshot.prefix);
+    shared_ptr<ResultFileWriter> &file = binary_files_[name];
+    if (!file) {
+        file = make_shared<ResultFileWriter>();
+        if (!file->open(name, *snapshot.field_names, snapshot.num_subsets))
+            cout << "Cannot write the result file " << name << endl;
+    }
+    if (!file->is_open())
+        return;
+    if (!file->matches(*snapshot.field_names, snapshot.num_subsets)) {
+        cout << "Frame " << snapshot.frame << " does not fit the layout of " << name << ", it is left out" << endl;
+        return;
+    }
+    if (!file->append((double) snapshot.frame, snapshot.values.data()))
+        cout << "Cannot append frame " << snapshot.frame << " to " << name << endl;
+}
@@ -0,0 +1,115 @@
+#ifndef CUSTOM_APP_RESULTWRITER_H
+#define CUSTOM_APP_RESULTWRITER_H
+
+#include <DICe.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ResultFile.h"
+
+enum ResultFormat {
+    /* one delimited text file per frame, like Schema::write_output */
+    RESULT_TEXT = 0,
+    /* every frame appended to one columnar ResultFile per prefix */
+    RESULT_BINARY
+};
+
+/* One frame of output fields copied out of a schema, never changed once it is queued */
+struct ResultSnapshot {
+    std::string folder;
+    std::string prefix;
+    int_t frame;
+    int_t num_subsets;
+    /* shared by every snapshot of a session, the field order of values */
+    std::shared_ptr<const std::vector<std::string> > field_names;
+    /* field after field, num_subsets values each */
+    std::vector<scalar_t> values;
+
+    scalar_t value(size_t field, int_t subset) const { return values[field * num_subsets + subset]; }
+};
+
+struct ResultWriterStats {
+    size_t frames_written;
+    size_t batches;
+    size_t max_pending;
+    /* time push() spent waiting for room in the queue */
+    double blocked_ms;
+    /* time the writer thread spent formatting and writing */
+    double write_ms;
+
+    ResultWriterStats() :
+            frames_written(0),
+            batches(0),
+            max_pending(0),
+            blocked_ms(0.0),
+            write_ms(0.0) {}
+};
+
+/**
+ * Writes result snapshots on its own thread so the correlation never waits for formatting or
+ * disk. Everything queued when the writer wakes up goes out as one batch. push() blocks once
+ * max_pending snapshots are waiting, so a slow disk slows the correlation down instead of
+ * eating memory, and nothing that was pushed is lost: flush() and the destructor wait for the
+ * queue to drain. Changing the layout or the format waits for the frames already queued to be
+ * written the old way, the writer thread only reads them while it has frames in hand.
+ */
+class ResultWriter {
+public:
+    explicit ResultWriter(size_t max_pending = 8);
+
+    ~ResultWriter();
+
+    /**
+     * Column delimiter and whether rows start with the subset id (output_delimiter, omit_output_row_id).
+     * Text files have a single header line with the column names, nothing of DICe's run information.
+     */
+    void set_text_layout(const std::string &delimiter, bool row_ids);
+
+    /** Also closes the binary files, the next frame of each prefix starts a new one. Waits like flush() */
+    void set_format(ResultFormat format);
+
+    void push(const std::shared_ptr<const ResultSnapshot> &snapshot);
+
+    /** Wait until everything pushed so far is on disk */
+    void flush();
+
+    ResultWriterStats stats() const;
+
+    /** <folder><prefix>_<frame>.txt, the frame number zero padded to four digits */
+    static std::string text_file_name(const ResultSnapshot &snapshot);
+
+private:
+    void writer_loop();
+
+    void write_text(const ResultSnapshot &snapshot);
+
+    void write_binary(const ResultSnapshot &snapshot);
+
+    const size_t max_pending_;
+    std::string delimiter_;
+    bool row_ids_;
+    ResultFormat format_;
+    std::string buffer_;
+    /* keyed by file name, only touched by the writer thread or with the lock held and the queue drained */
+    std::map<std::string, std::shared_ptr<ResultFileWriter> > binary_files_;
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::condition_variable drained_;
+    std::deque<std::shared_ptr<const ResultSnapshot> > pending_;
+    size_t in_flight_;
+    bool stopping_;
+    ResultWriterStats stats_;
+};
+
+#endif //CUSTOM_APP_RESULTWRITER_H
@@ -0,0 +1,186 @@
+#include "StageProbe.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#include "ProcessGroup.h"
+
+using namespace std;
+
+std::atomic<bool> probes_active(false);
+
+static const char *stage_names[NUM_PROBE_STAGES] = {
+        "capture left",
+        "capture right",
+        "encode",
+        "image load left",
+        "image load right",
+        "correlation left",
+        "correlation right",
+        "triangulation",
+        "post-processing",
+        "output",
+        "render",
+        "frame",
+};
+
+/* Ring buffer of the newest samples of one stage */
+struct StageWindow {
+    vector<double> samples;
+    size_t next;
+    size_t count;
+
+    StageWindow() : next(0), count(0) {}
+};
+
+struct TraceEvent {
+    int stage;
+    int thread;
+    double start_us;
+    double duration_us;
+};
+
+static mutex probe_mutex;
+static StageWindow windows[NUM_PROBE_STAGES];
+static size_t window_size = 1024;
+static atomic<bool> tracing(false);
+static size_t max_trace_events = 0;
+static size_t trace_dropped = 0;
+static vector<TraceEvent> trace_events;
+static const chrono::steady_clock::time_point trace_origin = chrono::steady_clock::now();
+
+/* Small stable number per thread, the trace viewer shows one row for each */
+static int thread_index() {
+    static atomic<int> next_index(0);
+    thread_local int index = next_index++;
+    return index;
+}
+
+static double microseconds_since_origin(const chrono::steady_clock::time_point &time) {
+    return chrono::duration<double, micro>(time - trace_origin).count();
+}
+
+const char *probe_stage_name(ProbeStage stage) {
+    return stage >= 0 && stage < NUM_PROBE_STAGES ? stage_names[stage] : "unknown";
+}
+
+void enable_probes(size_t window) {
+    lock_guard<mutex> lock(probe_mutex);
+    window_size = window > 0 ? window : 1;
+    for (int stage = 0; stage < NUM_PROBE_STAGES; ++stage) {
+        windows[stage] = StageWindow();
+        windows[stage].samples.resize(window_size);
+    }
+    probes_active = true;
+}
+
+void enable_probe_trace(size_t max_events) {
+    if (!probes_enabled())
+        enable_probes();
+    lock_guard<mutex> lock(probe_mutex);
+    tracing = true;
+    max_trace_events = max_events;
+    trace_events.reserve(std::min(max_events, (size_t) 65536));
+}
+
+void disable_probes() {
+    probes_active = false;
+    lock_guard<mutex> lock(probe_mutex);
+    tracing = false;
+}
+
+void reset_probes() {
+    lock_guard<mutex> lock(probe_mutex);
+    for (int stage = 0; stage < NUM_PROBE_STAGES; ++stage) {
+        windows[stage].next = 0;
+        windows[stage].count = 0;
+    }
+    trace_events.clear();
+    trace_dropped = 0;
+}
+
+void record_probe(ProbeStage stage, const chrono::steady_clock::time_point &start,
+                  const chrono::steady_clock::time_point &end) {
+    const double duration_ms = chrono::duration<double, milli>(end - start).count();
+    const int thread = tracing ? thread_index() : 0;
+    lock_guard<mutex> lock(probe_mutex);
+    StageWindow &window = windows[stage];
+    if (window.samples.empty())
+        return;
+    window.samples[window.next] = duration_ms;
+    window.next = (window.next + 1) % window.samples.size();
+    ++window.count;
+    if (tracing) {
+        if (trace_events.size() < max_trace_events) {
+            TraceEvent event;
+            event.stage = stage;
+            event.thread = thread;
+            event.start_us = microseconds_since_origin(start);
+            event.duration_us = duration_ms * 1000.0;
+            trace_events.push_back(event);
+        } else {
+            ++trace_dropped;
+        }
+    }
+}
+
+/* Nearest rank percentile of sorted samples */
+static double percentile(const vector<double> &sorted, double fraction) {
+    const size_t rank = (size_t) ceil(fraction * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+ProbeSummary probe_summary(ProbeStage stage) {
+    ProbeSummary summary;
+    vector<double> sorted;
+    {
+        lock_guard<mutex> lock(probe_mutex);
+        const StageWindow &window = windows[stage];
+        summary.count = window.count;
+        sorted.assign(window.samples.begin(),
+                      window.samples.begin() + std::min(window.count, window.samples.size()));
+    }
+    if (sorted.empty())
+        return summary;
+    sort(sorted.begin(), sorted.end());
+    summary.p50_ms = percentile(sorted, 0.50);
+    summary.p95_ms = percentile(sorted, 0.95);
+    summary.p99_ms = percentile(sorted, 0.99);
+    summary.max_ms = sorted.back();
+    return summary;
+}
+
+void print_probe_summary(ostream &os) {
+    if (!probes_enabled())
+        return;
+    os << "Stage latency over the last " << window_size << " samples (ms):" << endl;
+    for (int stage = 0; stage < NUM_PROBE_STAGES; ++stage) {
+        const ProbeSummary summary = probe_summary((ProbeStage) stage);
+        if (summary.count == 0)
+            continue;
+        os << "  " << stage_names[stage] << ": n " << summary.count << ", p50 " << summary.p50_ms
+           << ", p95 " << summary.p95_ms << ", p99 " << summary.p99_ms << ", max " << summary.max_ms << endl;
+    }
+}
+
+bool write_probe_trace(const string &file_name) {
+    ofstream file(file_name.c_str(), ofstream::out | ofstream::trunc);
+    if (!file.is_open())
+        return false;
+    const int pid = process_rank();
+    lock_guard<mutex> lock(probe_mutex);
+    file << fixed << setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < trace_events.size(); ++i) {
+        const TraceEvent &event = trace_events[i];
+        file << (i == 0 ? "" : ",") << "\n{\"name\":\"" << stage_names[event.stage]
+             << "\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << event.thread
+             << ",\"ts\":" << event.start_us << ",\"dur\":" << event.duration_us << "}";
+    }
+    file << "\n],\"otherData\":{\"dropped_events\":" << trace_dropped << "}}" << endl;
+    return (bool) file;
+}
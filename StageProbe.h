@@ -0,0 +1,94 @@
+#ifndef CUSTOM_APP_STAGEPROBE_H
+#define CUSTOM_APP_STAGEPROBE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+/* Every stage a frame goes through, from the camera to the screen */
+enum ProbeStage {
+    PROBE_CAPTURE_LEFT = 0,
+    PROBE_CAPTURE_RIGHT,
+    PROBE_ENCODE,
+    PROBE_IMAGE_LOAD_LEFT,
+    PROBE_IMAGE_LOAD_RIGHT,
+    PROBE_CORRELATION_LEFT,
+    PROBE_CORRELATION_RIGHT,
+    PROBE_TRIANGULATION,
+    PROBE_POST_PROCESSING,
+    PROBE_OUTPUT,
+    PROBE_RENDER,
+    PROBE_FRAME,
+    NUM_PROBE_STAGES
+};
+
+const char *probe_stage_name(ProbeStage stage);
+
+/* Latency percentiles of one stage over the rolling window */
+struct ProbeSummary {
+    size_t count;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+
+    ProbeSummary() : count(0), p50_ms(0.0), p95_ms(0.0), p99_ms(0.0), max_ms(0.0) {}
+};
+
+extern std::atomic<bool> probes_active;
+
+/** The one check a disabled probe pays for */
+inline bool probes_enabled() { return probes_active.load(std::memory_order_relaxed); }
+
+/** Start recording, each stage keeps its last window samples for the percentiles */
+void enable_probes(size_t window = 1024);
+
+/** Also keep every probe as a timeline event for write_probe_trace(), up to max_events of them */
+void enable_probe_trace(size_t max_events = 1000000);
+
+void disable_probes();
+
+/** Forget the samples and events recorded so far, the settings stay */
+void reset_probes();
+
+void record_probe(ProbeStage stage, const std::chrono::steady_clock::time_point &start,
+                  const std::chrono::steady_clock::time_point &end);
+
+ProbeSummary probe_summary(ProbeStage stage);
+
+void print_probe_summary(std::ostream &os);
+
+/** Chrome trace event JSON, opens in chrome://tracing and ui.perfetto.dev */
+bool write_probe_trace(const std::string &file_name);
+
+/**
+ * Times the enclosing scope as one sample of stage. When the probes are off this is a relaxed
+ * atomic load in the constructor and a branch in the destructor, the clock is never read.
+ */
+class ScopedProbe {
+public:
+    explicit ScopedProbe(ProbeStage stage) :
+            stage_(stage),
+            active_(probes_enabled()) {
+        if (active_)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedProbe() {
+        if (active_)
+            record_probe(stage_, start_, std::chrono::steady_clock::now());
+    }
+
+private:
+    ScopedProbe(const ScopedProbe &);
+
+    ScopedProbe &operator=(const ScopedProbe &);
+
+    ProbeStage stage_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif //CUSTOM_APP_STAGEPROBE_H
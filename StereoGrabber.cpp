@@ -0,0 +1,141 @@
+#include "StereoGrabber.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace cv;
+using namespace std;
+
+/* Mean frame period of a stream, zero until there are two frames to go on */
+static double period_ms(const vector<CapturedFrame> &frames) {
+    if (frames.size() < 2)
+        return 0.0;
+    return (frames.back().timestamp_ms - frames.front().timestamp_ms) / (frames.size() - 1);
+}
+
+StereoPairMatcher::StereoPairMatcher(double tolerance_ms, bool reject_out_of_sync, size_t history) :
+        tolerance_ms_(tolerance_ms),
+        reject_out_of_sync_(reject_out_of_sync),
+        history_(history == 0 ? 1 : history),
+        matched_(0),
+        flagged_(0),
+        rejected_(0) {
+    left_.reserve(history_ + 1);
+    right_.reserve(history_ + 1);
+}
+
+void StereoPairMatcher::add(vector<CapturedFrame> &frames, const CapturedFrame &frame, size_t history) {
+    frames.push_back(frame);
+    if (frames.size() > history)
+        frames.erase(frames.begin(), frames.end() - history);
+}
+
+void StereoPairMatcher::add_left(const CapturedFrame &frame) {
+    add(left_, frame, history_);
+}
+
+void StereoPairMatcher::add_right(const CapturedFrame &frame) {
+    add(right_, frame, history_);
+}
+
+bool StereoPairMatcher::match(StereoFrame &pair) {
+    if (left_.empty() || right_.empty())
+        return false;
+
+    // walk back from the newest left frame and take the first one with a partner in tolerance
+    size_t nearest = 0;
+    for (size_t l = left_.size(); l-- > 0;) {
+        double best = numeric_limits<double>::max();
+        for (size_t r = 0; r < right_.size(); ++r) {
+            const double distance = fabs(right_[r].timestamp_ms - left_[l].timestamp_ms);
+            if (distance < best) {
+                best = distance;
+                nearest = r;
+            }
+        }
+        if (best <= tolerance_ms_) {
+            pair.left = left_[l];
+            pair.right = right_[nearest];
+            pair.skew_ms = pair.right.timestamp_ms - pair.left.timestamp_ms;
+            pair.in_sync = true;
+            left_.erase(left_.begin(), left_.begin() + l + 1);
+            right_.erase(right_.begin(), right_.begin() + nearest + 1);
+            ++matched_;
+            return true;
+        }
+    }
+
+    // Nothing within tolerance. If the next frame of the lagging stream is due close enough to
+    // the newest frame of the other one it is worth waiting for it.
+    const double newest_left = left_.back().timestamp_ms;
+    const double newest_right = right_.back().timestamp_ms;
+    const bool history_full = left_.size() >= history_ || right_.size() >= history_;
+    if (!history_full) {
+        const bool right_lagging = newest_right < newest_left;
+        const double period = right_lagging ? period_ms(right_) : period_ms(left_);
+        const double lagging = right_lagging ? newest_right : newest_left;
+        const double target = right_lagging ? newest_left : newest_right;
+        if (period == 0.0 || fabs(lagging + period - target) <= tolerance_ms_)
+            return false;
+    }
+
+    // give up on the newest left frame and its nearest partner
+    size_t partner = 0;
+    double best = numeric_limits<double>::max();
+    for (size_t r = 0; r < right_.size(); ++r) {
+        const double distance = fabs(right_[r].timestamp_ms - newest_left);
+        if (distance < best) {
+            best = distance;
+            partner = r;
+        }
+    }
+    pair.left = left_.back();
+    pair.right = right_[partner];
+    pair.skew_ms = pair.right.timestamp_ms - pair.left.timestamp_ms;
+    pair.in_sync = false;
+    left_.clear();
+    right_.erase(right_.begin(), right_.begin() + partner + 1);
+    if (reject_out_of_sync_) {
+        ++rejected_;
+        return false;
+    }
+    ++flagged_;
+    return true;
+}
+
+StereoGrabber::StereoGrabber(FrameSource &left, FrameSource &right, double tolerance_ms, bool reject_out_of_sync) :
+        left_(left),
+        right_(right),
+        tolerance_ms_(tolerance_ms),
+        reject_out_of_sync_(reject_out_of_sync),
+        sequence_(0),
+        grabbed_(0),
+        flagged_(0),
+        rejected_(0) {}
+
+bool StereoGrabber::grab(StereoFrame &pair) {
+    // latch both sensors first, decoding happens afterwards
+    if (!left_.grab() || !right_.grab())
+        return false;
+    const chrono::steady_clock::time_point stamp = chrono::steady_clock::now();
+    pair.left.timestamp_ms = left_.timestamp_ms();
+    pair.right.timestamp_ms = right_.timestamp_ms();
+    if (!left_.retrieve(pair.left.image) || !right_.retrieve(pair.right.image))
+        return false;
+    pair.left.stamp = stamp;
+    pair.right.stamp = stamp;
+    pair.left.sequence = sequence_;
+    pair.right.sequence = sequence_;
+    ++sequence_;
+    ++grabbed_;
+    pair.skew_ms = pair.right.timestamp_ms - pair.left.timestamp_ms;
+    pair.in_sync = fabs(pair.skew_ms) <= tolerance_ms_;
+    if (!pair.in_sync) {
+        if (reject_out_of_sync_) {
+            ++rejected_;
+            return false;
+        }
+        ++flagged_;
+    }
+    return true;
+}
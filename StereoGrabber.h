@@ -0,0 +1,89 @@
+#ifndef CUSTOM_APP_STEREOGRABBER_H
+#define CUSTOM_APP_STEREOGRABBER_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "FrameSource.h"
+
+struct CapturedFrame {
+    cv::Mat image;
+    /* when the frame reached us, used for the pipeline latency figures */
+    std::chrono::steady_clock::time_point stamp;
+    /* source timestamp in monotonic_ms() time, used to pair left and right */
+    double timestamp_ms;
+    long sequence;
+};
+
+struct StereoFrame {
+    CapturedFrame left;
+    CapturedFrame right;
+    /* right minus left timestamp */
+    double skew_ms;
+    bool in_sync;
+};
+
+/**
+ * Pairs two independently captured streams by nearest timestamp. A pair further apart than the
+ * tolerance is either dropped (reject_out_of_sync) or handed on with in_sync cleared.
+ */
+class StereoPairMatcher {
+public:
+    explicit StereoPairMatcher(double tolerance_ms, bool reject_out_of_sync = false, size_t history = 8);
+
+    void add_left(const CapturedFrame &frame);
+
+    void add_right(const CapturedFrame &frame);
+
+    /** Newest pair that can be formed, older frames on both sides are discarded */
+    bool match(StereoFrame &pair);
+
+    double tolerance_ms() const { return tolerance_ms_; }
+    size_t matched() const { return matched_; }
+    size_t flagged() const { return flagged_; }
+    size_t rejected() const { return rejected_; }
+
+private:
+    static void add(std::vector<CapturedFrame> &frames, const CapturedFrame &frame, size_t history);
+
+    const double tolerance_ms_;
+    const bool reject_out_of_sync_;
+    const size_t history_;
+    /* a handful of frames each, a vector reserved up front never goes back to the allocator */
+    std::vector<CapturedFrame> left_;
+    std::vector<CapturedFrame> right_;
+    size_t matched_;
+    size_t flagged_;
+    size_t rejected_;
+};
+
+/**
+ * Latches both cameras with grab() back to back before retrieve() decodes either frame, so the
+ * skew inside a pair is only the time between the two grab() calls instead of a whole read.
+ */
+class StereoGrabber {
+public:
+    StereoGrabber(FrameSource &left, FrameSource &right, double tolerance_ms, bool reject_out_of_sync = false);
+
+    /** Returns false if a source failed or the pair was out of tolerance and rejected */
+    bool grab(StereoFrame &pair);
+
+    size_t grabbed() const { return grabbed_; }
+    size_t flagged() const { return flagged_; }
+    size_t rejected() const { return rejected_; }
+
+private:
+    FrameSource &left_;
+    FrameSource &right_;
+    const double tolerance_ms_;
+    const bool reject_out_of_sync_;
+    long sequence_;
+    size_t grabbed_;
+    size_t flagged_;
+    size_t rejected_;
+};
+
+#endif //CUSTOM_APP_STEREOGRABBER_H
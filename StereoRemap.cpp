@@ -0,0 +1,115 @@
+#include "StereoRemap.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "FileHash.h"
+
+using namespace cv;
+using namespace std;
+
+static const char REMAP_MAGIC[8] = {'D', 'I', 'C', 'E', 'M', 'A', 'P', '1'};
+
+struct RemapHeader {
+    char magic[8];
+    /* hash of the calibration file the table was built from */
+    uint64_t key;
+    int32_t width;
+    int32_t height;
+};
+
+StereoRemap::StereoRemap() :
+        built_(false),
+        prepare_ms_(0.0) {}
+
+void StereoRemap::reset() {
+    map_xy_.release();
+    map_fraction_.release();
+    built_ = false;
+    prepare_ms_ = 0.0;
+}
+
+void StereoRemap::prepare(const string &cal_file_name, int width, int height,
+                          const Teuchos::RCP<DICe::Triangulation> &triangulation, bool save_table) {
+    reset();
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const uint64_t key = hash_file(cal_file_name);
+    const string table_file = file_name(cal_file_name);
+    if (!load(table_file, key, width, height)) {
+        Mat map_x(height, width, CV_32FC1);
+        Mat map_y(height, width, CV_32FC1);
+        scalar_t right_x = 0.0;
+        scalar_t right_y = 0.0;
+        for (int y = 0; y < height; ++y) {
+            float *row_x = map_x.ptr<float>(y);
+            float *row_y = map_y.ptr<float>(y);
+            for (int x = 0; x < width; ++x) {
+                triangulation->project_left_to_right_sensor_coords(x, y, right_x, right_y);
+                row_x[x] = right_x;
+                row_y[x] = right_y;
+            }
+        }
+        // fixed point: a third of the float maps in memory and the SIMD path of cv::remap
+        convertMaps(map_x, map_y, map_xy_, map_fraction_, CV_16SC2, false);
+        built_ = true;
+        if (save_table)
+            save(table_file, key);
+    }
+    prepare_ms_ = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+bool StereoRemap::load(const string &table_file, uint64_t key, int width, int height) {
+    FILE *file = fopen(table_file.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    RemapHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+                 && memcmp(header.magic, REMAP_MAGIC, sizeof(header.magic)) == 0
+                 && header.key == key && header.width == width && header.height == height;
+    if (valid) {
+        map_xy_.create(height, width, CV_16SC2);
+        map_fraction_.create(height, width, CV_16UC1);
+        valid = fread(map_xy_.data, map_xy_.elemSize(), map_xy_.total(), file) == map_xy_.total()
+                && fread(map_fraction_.data, map_fraction_.elemSize(), map_fraction_.total(), file)
+                   == map_fraction_.total();
+    }
+    fclose(file);
+    if (!valid) {
+        map_xy_.release();
+        map_fraction_.release();
+    }
+    return valid;
+}
+
+void StereoRemap::save(const string &table_file, uint64_t key) const {
+    RemapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REMAP_MAGIC, sizeof(header.magic));
+    header.key = key;
+    header.width = map_xy_.cols;
+    header.height = map_xy_.rows;
+    // renamed into place so a concurrent run never reads half a table
+    const string temp_file = table_file + ".tmp." + to_string(getpid());
+    FILE *file = fopen(temp_file.c_str(), "wb");
+    if (file == NULL) {
+        cout << "Cannot write the stereo remap table " << table_file << endl;
+        return;
+    }
+    const bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                         && fwrite(map_xy_.data, map_xy_.elemSize(), map_xy_.total(), file) == map_xy_.total()
+                         && fwrite(map_fraction_.data, map_fraction_.elemSize(), map_fraction_.total(), file)
+                            == map_fraction_.total();
+    const bool closed = fclose(file) == 0;
+    if (!written || !closed || rename(temp_file.c_str(), table_file.c_str()) != 0) {
+        unlink(temp_file.c_str());
+        cout << "Cannot write the stereo remap table " << table_file << endl;
+    }
+}
+
+void StereoRemap::apply(const Mat &right, Mat &projected) const {
+    remap(right, projected, map_xy_, map_fraction_, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(0));
+}
@@ -0,0 +1,59 @@
+#ifndef CUSTOM_APP_STEREOREMAP_H
+#define CUSTOM_APP_STEREOREMAP_H
+
+#include <DICe.h>
+#include <DICe_Triangulation.h>
+
+#include <stdint.h>
+#include <string>
+
+#include <Teuchos_RCP.hpp>
+
+#include "opencv2/opencv.hpp"
+
+/**
+ * The nonlinear projection of right images into the left frame as a lookup table. DICe's
+ * project_right_image_into_left_frame() sends every pixel through the calibration each time it
+ * is called; here that is done once, for every pixel of the left sensor, and the right frames go
+ * through cv::remap with the fixed-point maps. The table is kept in <calibration file>.remap and
+ * only rebuilt when the calibration file or the image size changes.
+ */
+class StereoRemap {
+public:
+    StereoRemap();
+
+    /**
+     * Load the table for a width x height left sensor, or build it from triangulation when the
+     * file is missing or was made for another calibration. Only save writes it back to disk.
+     */
+    void prepare(const std::string &cal_file_name, int width, int height,
+                 const Teuchos::RCP<DICe::Triangulation> &triangulation, bool save);
+
+    /** Drop the table, apply() cannot be called until the next prepare() */
+    void reset();
+
+    bool ready() const { return !map_xy_.empty(); }
+
+    /** True if the last prepare() had to build the table instead of reading it */
+    bool built() const { return built_; }
+
+    double prepare_ms() const { return prepare_ms_; }
+
+    /** Right image resampled onto the left sensor grid, pixels that fall outside the right image are 0 */
+    void apply(const cv::Mat &right, cv::Mat &projected) const;
+
+    static std::string file_name(const std::string &cal_file_name) { return cal_file_name + ".remap"; }
+
+private:
+    bool load(const std::string &file_name, uint64_t key, int width, int height);
+
+    void save(const std::string &file_name, uint64_t key) const;
+
+    /* integer source pixel and interpolation table index per destination pixel, as cv::convertMaps makes them */
+    cv::Mat map_xy_;
+    cv::Mat map_fraction_;
+    bool built_;
+    double prepare_ms_;
+};
+
+#endif //CUSTOM_APP_STEREOREMAP_H
@@ -1,27 +1,27 @@
 //
 // Created by haemish on 2020/04/11.
 //
-#include <DICe.h>
-#include <DICe_Parser.h>
-#include <DICe_Image.h>
-#include <DICe_ImageIO.h>
-#include <DICe_Schema.h>
-#include <DICe_Triangulation.h>
-
-
-#include <fstream>
-
-#include <Teuchos_TimeMonitor.hpp>
-#include <Teuchos_XMLParameterListHelpers.hpp>
-
-#include "opencv2/opencv.hpp"
-
 #include "SubSetData.h"
 
 using namespace std;
 
-static list<SubSetData> subSets;
+void SubSetData::resize(size_t num_subsets) {
+    const size_t old_size = ids.size();
+    ids.resize(num_subsets);
+    for (size_t i = old_size; i < num_subsets; ++i)
+        ids[i] = i;
+    x_coord.resize(num_subsets, 0);
+    y_coord.resize(num_subsets, 0);
+    displacement_x.resize(num_subsets, 0.0);
+    displacement_y.resize(num_subsets, 0.0);
+    displacement_z.resize(num_subsets, 0.0);
+    sigma.resize(num_subsets, 0.0);
+    status.resize(num_subsets, 0);
+    stale_frames.resize(num_subsets, 0);
+    carried_over.resize(num_subsets, 0);
+}
 
-list<SubSetData> *getSubSets(){
-    return &subSets;
+void SubSetData::clear() {
+    resize(0);
+    subset_size = 0;
 }
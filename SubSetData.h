@@ -5,26 +5,49 @@
 #ifndef CUSTOM_APP_SUBSETDATA_H
 #define CUSTOM_APP_SUBSETDATA_H
 
-using namespace std;
+#include <DICe.h>
 
+#include <cstddef>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+/**
+ * Every subset of the session as a structure of arrays, entry i of each array belongs to global
+ * subset id i. The coordinates and size are set once at setup, the solution arrays are filled in
+ * one pass after each frame so the overlay, the text and any export read plain vectors instead of
+ * going back to the schema fields subset by subset.
+ */
 class SubSetData {
 public:
-    int Subset_Idx;
-    int X_Coord;
-    int Y_Coord;
-    int Subset_Size;
-
-    double displacement_x;
-    double displacement_y;
-    double displacement_z;
-
-    SubSetData(int x, int y, int s) {     // Constructor
-        X_Coord = x;
-        Y_Coord = y;
-        Subset_Size = s;
+    SubSetData() : subset_size(0) {}
+
+    std::vector<int_t> ids;
+    std::vector<int> x_coord;
+    std::vector<int> y_coord;
+    int subset_size;
+
+    std::vector<scalar_t> displacement_x;
+    std::vector<scalar_t> displacement_y;
+    std::vector<scalar_t> displacement_z;
+    std::vector<scalar_t> sigma;
+    std::vector<int> status;
+    /* frames since the subset was last solved, non-zero only when a deadline deferred it */
+    std::vector<int> stale_frames;
+    /* 1 where the change gate kept the last solution because the subset's image had not changed */
+    std::vector<int> carried_over;
+
+    size_t size() const { return ids.size(); }
+
+    /** Size every array for num_subsets, the ids run from 0 */
+    void resize(size_t num_subsets);
+
+    void clear();
+
+    /** Square covered by subset i in the left image */
+    cv::Rect box(size_t i) const {
+        return cv::Rect(x_coord[i] - subset_size / 2, y_coord[i] - subset_size / 2, subset_size, subset_size);
     }
 };
 
-list<SubSetData> *getSubSets();
-
 #endif //CUSTOM_APP_SUBSETDATA_H
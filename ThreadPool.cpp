@@ -0,0 +1,42 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t num_threads) :
+        stopping_(false) {
+    if (num_threads == 0)
+        num_threads = 1;
+    for (size_t i = 0; i < num_threads; ++i)
+        workers_.push_back(thread(&ThreadPool::worker_loop, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i)
+        workers_[i].join();
+}
+
+size_t ThreadPool::pending() const {
+    lock_guard<mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void ThreadPool::worker_loop() {
+    for (;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            // queued work is still finished on shutdown so no future is left without a value
+            if (tasks_.empty())
+                return;
+            task = tasks_.front();
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
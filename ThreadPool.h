@@ -0,0 +1,53 @@
+#ifndef CUSTOM_APP_THREADPOOL_H
+#define CUSTOM_APP_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Fixed set of worker threads taking tasks off a shared queue in submission order. submit()
+ * hands back a future, an exception thrown by the task comes out of future::get().
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t num_threads);
+
+    ~ThreadPool();
+
+    template<class F>
+    std::future<typename std::result_of<F()>::type> submit(F task) {
+        typedef typename std::result_of<F()>::type result_type;
+        std::shared_ptr<std::packaged_task<result_type()> > packaged(new std::packaged_task<result_type()>(task));
+        std::future<result_type> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back([packaged] { (*packaged)(); });
+        }
+        cond_.notify_one();
+        return result;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    /** Tasks queued but not picked up by a worker yet */
+    size_t pending() const;
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()> > tasks_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stopping_;
+};
+
+#endif //CUSTOM_APP_THREADPOOL_H
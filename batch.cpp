@@ -0,0 +1,138 @@
+// Batch reprocessing: correlates many recorded datasets laid out like FirstTest/SecondTest/ThirdTest
+// at once, each share of a job in a masters_batch process of its own, see BatchRunner, and ends with
+// the throughput of each, e.g.
+//
+//   masters_batch --workers 8 --output batch.jsonl 'recordings/*' FirstTest SecondTest
+//
+// Arguments are job directories or wildcard patterns (quote them so the shell leaves them alone),
+// --list <file> adds one per line. Results go to batch_results/<job>/ (--output-folder <dir>).
+// --min-split <frames> is the smallest share of a running job an idle worker takes over, 4 by default.
+//
+// --cross-cache <dir> keeps the cross-correlation results on disk for later batches as well,
+// --image-cache <dir> the decoded images (--image-cache-mb caps it). --parallel-stereo also
+// correlates the two cameras of a pair at once, off by default as the workers already fill the cores.
+//
+// --lane <job directory> <output folder> <first frame offset> <read fd> <write fd> is how the batch
+// starts its lane processes, not meant to be typed.
+//
+#include <DICe.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.h"
+#include "ProcessGroup.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    BatchOptions options;
+    vector<string> patterns;
+    string output_file;
+    bool lane = false;
+    string lane_directory;
+    string lane_output_folder;
+    int lane_offset = 0;
+    int lane_read_fd = -1;
+    int lane_write_fd = -1;
+
+    for (int arg_it = 1; arg_it < argc; ++arg_it) {
+        const string arg(argv[arg_it]);
+        if (arg == "--workers" && arg_it + 1 < argc)
+            options.workers = (size_t) atoi(argv[++arg_it]);
+        else if (arg == "--min-split" && arg_it + 1 < argc)
+            options.min_split_frames = atoi(argv[++arg_it]);
+        else if (arg == "--output-folder" && arg_it + 1 < argc)
+            options.output_folder = argv[++arg_it];
+        else if (arg == "--output" && arg_it + 1 < argc)
+            output_file = argv[++arg_it];
+        else if (arg == "--cross-cache" && arg_it + 1 < argc)
+            options.cross_cache_folder = argv[++arg_it];
+        else if (arg == "--image-cache" && arg_it + 1 < argc)
+            options.image_cache_folder = argv[++arg_it];
+        else if (arg == "--image-cache-mb" && arg_it + 1 < argc)
+            options.image_cache_mb = atoi(argv[++arg_it]);
+        else if (arg == "--parallel-stereo")
+            options.parallel_stereo = true;
+        else if (arg == "--tracking")
+            options.tracking = true;
+        else if (arg == "--lane" && arg_it + 5 < argc) {
+            lane = true;
+            lane_directory = argv[++arg_it];
+            lane_output_folder = argv[++arg_it];
+            lane_offset = atoi(argv[++arg_it]);
+            lane_read_fd = atoi(argv[++arg_it]);
+            lane_write_fd = atoi(argv[++arg_it]);
+        } else if (arg == "--list" && arg_it + 1 < argc) {
+            ifstream list(argv[++arg_it]);
+            string line;
+            while (getline(list, line))
+                if (!line.empty() && line[0] != '#')
+                    patterns.push_back(line);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option " << arg << endl;
+            return -1;
+        } else
+            patterns.push_back(arg);
+    }
+    if (lane) {
+        DICe::initialize(argc, argv);
+        BatchRunner runner(options);
+        const int return_val = runner.add_job(lane_directory)
+                               ? runner.serve_lane(lane_output_folder, lane_offset, lane_read_fd, lane_write_fd) : -1;
+        DICe::finalize();
+        return return_val;
+    }
+    const vector<string> directories = BatchRunner::expand_job_directories(patterns);
+    if (directories.empty()) {
+        cerr << "Usage: masters_batch [options] <job directory or pattern>..." << endl;
+        return -1;
+    }
+
+    DICe::initialize(argc, argv);
+    if (process_size() > 1) {
+        // the lanes are processes of their own, there is no way to split their subsets over ranks as well
+        if (process_rank() == 0)
+            cerr << "masters_batch runs in a single process, start it without mpirun" << endl;
+        DICe::finalize();
+        return -1;
+    }
+    int return_val = 0;
+    BatchRunner runner(options);
+    for (size_t i = 0; i < directories.size(); ++i)
+        if (!runner.add_job(directories[i]))
+            return_val = -1;
+    if (!runner.run())
+        return_val = -1;
+    runner.print_summary(cout);
+
+    if (!output_file.empty()) {
+        ofstream report(output_file.c_str(), ofstream::out | ofstream::app);
+        const vector<BatchJobStats> &jobs = runner.job_stats();
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            const BatchJobStats &job = jobs[i];
+            report << "{\"job\":\"" << job.name << "\""
+                   << ",\"directory\":\"" << job.directory << "\""
+                   << ",\"frames\":" << job.frames
+                   << ",\"frames_done\":" << job.frames_done
+                   << ",\"sessions\":" << job.sessions
+                   << ",\"frames_stolen\":" << job.frames_stolen
+                   << ",\"cross_correlation_cached\":" << job.cross_correlation_cached
+                   << ",\"failed_step\":" << (job.failed_step ? "true" : "false")
+                   << ",\"error\":" << (job.error.empty() ? "false" : "true")
+                   << ",\"setup_ms\":" << job.setup_ms
+                   << ",\"frame_mean_ms\":" << (job.frames_done > 0 ? job.frame_ms / job.frames_done : 0.0)
+                   << ",\"wall_ms\":" << job.wall_ms()
+                   << ",\"frames_per_second\":" << job.frames_per_second()
+                   << ",\"batch_wall_ms\":" << runner.wall_ms()
+                   << ",\"worker_utilisation\":" << runner.worker_utilisation()
+                   << "}" << endl;
+        }
+        cout << "Batch results appended to " << output_file << endl;
+    }
+    DICe::finalize();
+    return return_val;
+}
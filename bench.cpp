@@ -0,0 +1,431 @@
+// Offline benchmark: runs setup, correlation and triangulation over recorded datasets laid out
+// like FirstTest/SecondTest/ThirdTest and appends one JSON line per dataset, e.g.
+//
+//   masters_bench --repeat 5 --output bench.jsonl FirstTest SecondTest ThirdTest
+//
+// --prefetch <n> decodes up to n pairs ahead on worker threads (--prefetch-memory-mb caps them).
+//
+// --deadline-ms <ms> runs the real-time scheduler and reports how much of the budget each frame used.
+//
+// --change-gate <grey levels> carries over the subsets whose windows did not change and reports how many.
+//
+// --pyramid-init <levels> starts the subsets from a coarse-to-fine pyramid search (--pyramid-radius
+// <pixels> at the coarsest level) instead of the initializer in params.xml. To hold it against
+// feature matching run the same datasets with and without it and compare frame_mean_ms and
+// sigma_mean, e.g. with params.xml set to USE_FEATURE_MATCHING:
+//
+//   masters_bench --tracking FirstTest && masters_bench --tracking --pyramid-init 3 FirstTest
+//
+// Every file is decoded on every run unless --image-cache <dir> keeps the decoded images there
+// between runs (capped by --image-cache-mb, --clear-image-cache starts cold). Load times with the
+// cache are hit times, not decode times; image_cache_hits/misses in each line say which they are.
+//
+// With an MPI enabled DICe the subsets are split over the ranks, e.g. for the scaling on SecondTest:
+//
+//   for n in 1 2 4; do mpirun -np $n masters_bench SecondTest; done
+//
+#include <DICe.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Teuchos_ParameterList.hpp>
+#include <Teuchos_RCP.hpp>
+
+#include "opencv2/opencv.hpp"
+
+#include "AllocationCounter.h"
+#include "CorrelationSession.h"
+#include "FrameSource.h"
+#include "ProcessGroup.h"
+#include "StageProbe.h"
+
+using namespace cv;
+using namespace std;
+
+struct BenchOptions {
+    vector<string> datasets;
+    int repeat;
+    bool file_handoff;
+    string output_file;
+    string output_folder;
+    string cross_cache_folder;
+    bool serial_stereo;
+    bool tracking;
+    bool probes;
+    bool async_output;
+    bool binary_output;
+    bool roi_crop;
+    int roi_margin;
+    int prefetch;
+    int prefetch_memory_mb;
+    string image_cache_folder;
+    int image_cache_mb;
+    bool clear_image_cache;
+    double deadline_ms;
+    double change_gate;
+    int pyramid_levels;
+    int pyramid_radius;
+    string trace_file;
+};
+
+static double elapsed_ms(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+static string current_directory() {
+    char buffer[4096];
+    if (getcwd(buffer, sizeof(buffer)) == NULL)
+        return ".";
+    return string(buffer);
+}
+
+/* Mean SIGMA of the subsets that converged in the last frame, and how many there were */
+static double converged_sigma(const SubSetData &subsets, int &count) {
+    double sum = 0.0;
+    count = 0;
+    for (size_t i = 0; i < subsets.sigma.size(); ++i) {
+        if (subsets.sigma[i] < 0.0)
+            continue;
+        sum += subsets.sigma[i];
+        ++count;
+    }
+    return sum;
+}
+
+static bool run_dataset(const BenchOptions &options, const Teuchos::RCP<ImageCache> &image_cache,
+                        const string &dataset, ostream &report) {
+    const string home = current_directory();
+    if (chdir(dataset.c_str()) != 0) {
+        cerr << "Cannot enter dataset directory " << dataset << endl;
+        return false;
+    }
+
+    // keep the solution files out of the dataset and away from absolute paths in input.xml, and
+    // read the images from the dataset whatever folder input.xml expects to be run from
+    Teuchos::RCP<Teuchos::ParameterList> overrides = Teuchos::rcp(new Teuchos::ParameterList());
+    overrides->set(DICe::output_folder, options.output_folder);
+    overrides->set(DICe::image_folder, current_directory() + "/");
+
+    // percentiles are per dataset, the trace keeps every dataset on one timeline
+    if (options.trace_file.empty())
+        reset_probes();
+    const chrono::steady_clock::time_point total_start = chrono::steady_clock::now();
+    CorrelationSession session("input.xml", overrides);
+    session.set_cross_correlation_cache_folder(options.cross_cache_folder);
+    session.set_parallel_stereo(!options.serial_stereo);
+    session.set_tracking(options.tracking);
+    session.set_async_output(options.async_output);
+    session.set_output_format(options.binary_output ? RESULT_BINARY : RESULT_TEXT);
+    session.set_roi_crop(options.roi_crop, options.roi_margin);
+    session.set_prefetch(options.prefetch, options.prefetch_memory_mb);
+    session.set_image_cache(image_cache);
+    session.set_deadline(options.deadline_ms);
+    session.set_change_gate(options.change_gate);
+    session.set_pyramid_initializer(options.pyramid_levels, options.pyramid_radius);
+    if (process_rank() != 0) {
+        // under mpirun the other ranks only take their share of the subsets, rank 0 reads and reports
+        session.follow();
+        return chdir(home.c_str()) == 0;
+    }
+    session.setup();
+
+    const vector<string> &image_files = session.image_files();
+    const vector<string> &stereo_image_files = session.stereo_image_files();
+    ReplayFrameSource left(vector<string>(image_files.begin() + 1, image_files.end()));
+    ReplayFrameSource right(vector<string>(stereo_image_files.begin() + 1, stereo_image_files.end()));
+    left.set_cache(image_cache.get());
+    right.set_cache(image_cache.get());
+    const ImageCacheStats cache_start = image_cache != Teuchos::null ? image_cache->stats() : ImageCacheStats();
+
+    bool failed_step = false;
+    int frames = 0;
+    double decode_ms = 0.0;
+    double frame_ms = 0.0;
+    double max_frame_ms = 0.0;
+    uint64_t allocations = 0;
+    uint64_t max_allocations = 0;
+    double sigma_sum = 0.0;
+    long sigma_count = 0;
+    Mat left_frame;
+    Mat right_frame;
+    for (int repeat_it = 0; repeat_it < options.repeat; ++repeat_it) {
+        left.rewind();
+        right.rewind();
+        for (int image_it = 1; image_it < (int) image_files.size(); ++image_it) {
+            const uint64_t frame_allocations = allocation_count();
+            const chrono::steady_clock::time_point frame_start = chrono::steady_clock::now();
+            bool frame_failed;
+            if (options.file_handoff || options.prefetch > 0) {
+                // with read-ahead the session decodes the files itself and correlates them in memory
+                frame_failed = session.correlate_frame(image_it);
+            } else {
+                if (!left.read(left_frame) || !right.read(right_frame)) {
+                    cerr << "Cannot read frame " << image_it << " of " << dataset << endl;
+                    break;
+                }
+                decode_ms += elapsed_ms(frame_start);
+                frame_failed = session.correlate_images(left_frame, right_frame);
+            }
+            const double this_frame_ms = elapsed_ms(frame_start);
+            frame_ms += this_frame_ms;
+            if (this_frame_ms > max_frame_ms)
+                max_frame_ms = this_frame_ms;
+            const uint64_t this_frame_allocations = allocation_count() - frame_allocations;
+            allocations += this_frame_allocations;
+            if (this_frame_allocations > max_allocations)
+                max_allocations = this_frame_allocations;
+            if (frame_failed)
+                failed_step = true;
+            int converged = 0;
+            sigma_sum += converged_sigma(session.subsets(), converged);
+            sigma_count += converged;
+            ++frames;
+        }
+    }
+    session.finish(failed_step);
+    session.release_followers();
+    const double total_ms = elapsed_ms(total_start);
+    const SessionTimes &times = session.times();
+    const ResultWriterStats output_stats = session.output_stats();
+    const PrefetchStats prefetch = session.prefetch_stats();
+    const DeadlineStats deadline = session.deadline_stats();
+    const ChangeGateStats gate = session.change_gate_stats();
+    const PyramidStats &pyramid = session.pyramid_stats();
+    const ImageCacheStats cache = image_cache != Teuchos::null ? image_cache->stats() : ImageCacheStats();
+
+    report << "{\"dataset\":\"" << dataset << "\""
+           << ",\"mode\":\"" << (options.file_handoff ? "file" : "memory") << "\""
+           << ",\"processes\":" << process_size()
+           << ",\"frames\":" << frames
+           << ",\"subsets\":" << session.schema()->global_num_subsets()
+           << ",\"failed_step\":" << (failed_step ? "true" : "false")
+           << ",\"setup_ms\":" << times.setup_ms
+           << ",\"cross_correlation_ms\":" << times.cross_correlation_ms
+           << ",\"cross_correlation_cached\":" << (session.cross_correlation_cached() ? "true" : "false")
+           << ",\"stereo_remap\":" << (session.stereo_remap().ready() ? "true" : "false")
+           << ",\"stereo_remap_built\":" << (session.stereo_remap().built() ? "true" : "false")
+           << ",\"stereo_remap_ms\":" << session.stereo_remap().prepare_ms()
+           << ",\"parallel_stereo\":" << (session.parallel_stereo() ? "true" : "false")
+           << ",\"decode_ms\":" << decode_ms
+           << ",\"image_load_ms\":" << times.image_load_ms
+           << ",\"prefetch\":" << session.prefetch_lookahead()
+           << ",\"prefetch_hits\":" << prefetch.hits
+           << ",\"prefetch_waits\":" << prefetch.waits
+           << ",\"prefetch_wait_ms\":" << prefetch.wait_ms
+           << ",\"prefetch_peak_mb\":" << prefetch.peak_bytes / 1048576.0
+           << ",\"image_cache\":" << (image_cache != Teuchos::null ? "true" : "false")
+           << ",\"image_cache_hits\":" << cache.hits - cache_start.hits
+           << ",\"image_cache_misses\":" << cache.misses - cache_start.misses
+           << ",\"image_cache_evictions\":" << cache.evictions - cache_start.evictions
+           << ",\"image_cache_mb\":" << cache.bytes / 1048576.0
+           << ",\"roi_crop\":" << (session.roi_crop() ? "true" : "false")
+           << ",\"roi_fraction\":" << session.roi_fraction()
+           << ",\"correlation_ms\":" << times.correlation_ms
+           << ",\"triangulation_ms\":" << times.triangulation_ms
+           << ",\"output_ms\":" << times.output_ms
+           << ",\"async_output\":" << (session.async_output() ? "true" : "false")
+           << ",\"binary_output\":" << (session.output_format() == RESULT_BINARY ? "true" : "false")
+           << ",\"output_blocked_ms\":" << output_stats.blocked_ms
+           << ",\"output_write_ms\":" << output_stats.write_ms
+           << ",\"output_batches\":" << output_stats.batches
+           << ",\"output_max_pending\":" << output_stats.max_pending
+           << ",\"deadline_ms\":" << session.deadline_ms()
+           << ",\"budget_used_mean\":" << deadline.mean_budget_used()
+           << ",\"budget_used_max\":" << deadline.max_budget_used
+           << ",\"frames_over_budget\":" << deadline.frames_over_budget
+           << ",\"frames_iteration_capped\":" << deadline.frames_capped
+           << ",\"subsets_deferred_per_frame\":"
+           << (deadline.frames > 0 ? (double) deadline.subsets_deferred / deadline.frames : 0.0)
+           << ",\"change_gate\":" << session.change_threshold()
+           << ",\"subsets_carried_per_frame\":" << (gate.frames > 0 ? (double) gate.subsets_carried / gate.frames : 0.0)
+           << ",\"subsets_carried_fraction\":" << gate.carried_fraction()
+           << ",\"change_gate_ms\":" << gate.total_gate_ms
+           << ",\"pyramid_levels\":" << session.pyramid_levels()
+           << ",\"pyramid_build_ms\":" << pyramid.build_ms
+           << ",\"pyramid_search_ms\":" << pyramid.search_ms
+           << ",\"subsets_pyramid_initialized\":" << pyramid.subsets_initialized
+           << ",\"subsets_pyramid_weak\":" << pyramid.subsets_weak
+           << ",\"tracking\":" << (session.tracking() ? "true" : "false")
+           << ",\"reseed_ms\":" << times.reseed_ms
+           << ",\"subsets_lost\":" << session.tracking_stats().subsets_lost
+           << ",\"subsets_reseeded\":" << session.tracking_stats().subsets_reseeded
+           << ",\"mean_iterations\":" << session.tracking_stats().mean_iterations()
+           << ",\"sigma_mean\":" << (sigma_count > 0 ? sigma_sum / sigma_count : 0.0)
+           << ",\"subsets_converged_per_frame\":" << (frames > 0 ? (double) sigma_count / frames : 0.0)
+           << ",\"frame_mean_ms\":" << (frames > 0 ? frame_ms / frames : 0.0)
+           << ",\"frame_max_ms\":" << max_frame_ms
+           << ",\"frames_per_second\":" << (frame_ms > 0.0 ? 1000.0 * frames / frame_ms : 0.0)
+           << ",\"total_ms\":" << total_ms
+           << ",\"allocations_per_frame\":" << (frames > 0 ? (double) allocations / frames : 0.0)
+           << ",\"allocations_frame_max\":" << max_allocations
+           << ",\"image_buffers_allocated\":" << session.image_buffer_allocations()
+           << ",\"peak_rss_kb\":" << peak_rss_kb();
+    if (probes_enabled()) {
+        report << ",\"stages\":{";
+        bool first = true;
+        for (int stage = 0; stage < NUM_PROBE_STAGES; ++stage) {
+            const ProbeSummary summary = probe_summary((ProbeStage) stage);
+            if (summary.count == 0)
+                continue;
+            report << (first ? "" : ",") << "\"" << probe_stage_name((ProbeStage) stage) << "\":{\"n\":"
+                   << summary.count << ",\"p50_ms\":" << summary.p50_ms << ",\"p95_ms\":" << summary.p95_ms
+                   << ",\"p99_ms\":" << summary.p99_ms << ",\"max_ms\":" << summary.max_ms << "}";
+            first = false;
+        }
+        report << "}";
+    }
+    report << "}" << endl;
+
+    if (chdir(home.c_str()) != 0)
+        return false;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    options.repeat = 1;
+    options.file_handoff = false;
+    options.serial_stereo = false;
+    options.tracking = false;
+    options.probes = false;
+    options.async_output = false;
+    options.binary_output = false;
+    options.roi_crop = false;
+    options.roi_margin = 32;
+    options.prefetch = 0;
+    options.prefetch_memory_mb = 512;
+    options.image_cache_folder.clear();
+    options.image_cache_mb = 4096;
+    options.clear_image_cache = false;
+    options.deadline_ms = 0.0;
+    options.change_gate = 0.0;
+    options.pyramid_levels = 0;
+    options.pyramid_radius = 8;
+    options.output_file = "masters_bench.jsonl";
+    options.output_folder = "bench_results";
+
+    for (int arg_it = 1; arg_it < argc; ++arg_it) {
+        const string arg(argv[arg_it]);
+        if (arg == "--repeat" && arg_it + 1 < argc)
+            options.repeat = atoi(argv[++arg_it]);
+        else if (arg == "--file-handoff")
+            options.file_handoff = true;
+        else if (arg == "--output" && arg_it + 1 < argc)
+            options.output_file = argv[++arg_it];
+        else if (arg == "--output-folder" && arg_it + 1 < argc)
+            options.output_folder = argv[++arg_it];
+        else if (arg == "--cross-cache" && arg_it + 1 < argc)
+            options.cross_cache_folder = argv[++arg_it];
+        else if (arg == "--serial-stereo")
+            options.serial_stereo = true;
+        else if (arg == "--tracking")
+            options.tracking = true;
+        else if (arg == "--probes")
+            options.probes = true;
+        else if (arg == "--async-output")
+            options.async_output = true;
+        else if (arg == "--binary-output")
+            options.binary_output = true;
+        else if (arg == "--roi-crop")
+            options.roi_crop = true;
+        else if (arg == "--roi-margin" && arg_it + 1 < argc)
+            options.roi_margin = atoi(argv[++arg_it]);
+        else if (arg == "--prefetch" && arg_it + 1 < argc)
+            options.prefetch = atoi(argv[++arg_it]);
+        else if (arg == "--prefetch-memory-mb" && arg_it + 1 < argc)
+            options.prefetch_memory_mb = atoi(argv[++arg_it]);
+        else if (arg == "--image-cache" && arg_it + 1 < argc)
+            options.image_cache_folder = argv[++arg_it];
+        else if (arg == "--image-cache-mb" && arg_it + 1 < argc)
+            options.image_cache_mb = atoi(argv[++arg_it]);
+        else if (arg == "--no-image-cache")
+            options.image_cache_folder.clear(); // the default, kept for older scripts
+        else if (arg == "--clear-image-cache")
+            options.clear_image_cache = true;
+        else if (arg == "--deadline-ms" && arg_it + 1 < argc)
+            options.deadline_ms = atof(argv[++arg_it]);
+        else if (arg == "--change-gate" && arg_it + 1 < argc)
+            options.change_gate = atof(argv[++arg_it]);
+        else if (arg == "--pyramid-init" && arg_it + 1 < argc)
+            options.pyramid_levels = atoi(argv[++arg_it]);
+        else if (arg == "--pyramid-radius" && arg_it + 1 < argc)
+            options.pyramid_radius = atoi(argv[++arg_it]);
+        else if (arg == "--trace" && arg_it + 1 < argc)
+            options.trace_file = argv[++arg_it];
+        else if (arg.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option " << arg << endl;
+            return -1;
+        } else
+            options.datasets.push_back(arg);
+    }
+    if (options.datasets.empty()) {
+        options.datasets.push_back("FirstTest");
+        options.datasets.push_back("SecondTest");
+        options.datasets.push_back("ThirdTest");
+    }
+    if (options.repeat < 1)
+        options.repeat = 1;
+
+    // the datasets are run from inside their own directory so the output folder has to be absolute
+    mkdir(options.output_folder.c_str(), 0755);
+    if (options.output_folder[0] != '/')
+        options.output_folder = current_directory() + "/" + options.output_folder;
+    options.output_folder += "/";
+    if (!options.cross_cache_folder.empty() && options.cross_cache_folder[0] != '/')
+        options.cross_cache_folder = current_directory() + "/" + options.cross_cache_folder;
+
+    ofstream report(options.output_file.c_str(), ofstream::out | ofstream::app);
+    if (!options.trace_file.empty())
+        enable_probe_trace();
+    else if (options.probes)
+        enable_probes();
+    DICe::initialize(argc, argv);
+    Teuchos::RCP<ImageCache> image_cache;
+    // only rank 0 reads images, the other ranks get them broadcast
+    if (!options.image_cache_folder.empty() && process_rank() == 0) {
+        if (options.image_cache_folder[0] != '/')
+            options.image_cache_folder = current_directory() + "/" + options.image_cache_folder;
+        image_cache = Teuchos::rcp(new ImageCache(options.image_cache_folder, (size_t) options.image_cache_mb << 20));
+        if (options.clear_image_cache)
+            image_cache->clear();
+    }
+    int return_val = 0;
+    const string home = current_directory();
+    for (size_t dataset_it = 0; dataset_it < options.datasets.size(); ++dataset_it) {
+        try {
+            if (!run_dataset(options, image_cache, options.datasets[dataset_it], report))
+                return_val = -1;
+        } catch (std::exception &e) {
+            cerr << "Dataset " << options.datasets[dataset_it] << " failed: " << e.what() << endl;
+            // the other ranks are stuck in a collective call, there is no way to carry on with the next dataset
+            if (process_size() > 1)
+                abort_processes(-1);
+            return_val = -1;
+            if (chdir(home.c_str()) != 0)
+                break;
+        }
+    }
+    if (!options.trace_file.empty() && process_rank() == 0 && !write_probe_trace(options.trace_file))
+        cerr << "Cannot write the stage trace " << options.trace_file << endl;
+    DICe::finalize();
+    report.close();
+    if (process_rank() == 0)
+        cout << "Benchmark results appended to " << options.output_file << endl;
+    return return_val;
+}
@@ -40,494 +40,420 @@
 // @HEADER
 
 #include <DICe.h>
-#include <DICe_Parser.h>
-#include <DICe_Image.h>
-#include <DICe_ImageIO.h>
 #include <DICe_Schema.h>
-#include <DICe_Triangulation.h>
 
-
-#include <fstream>
-
-#include <Teuchos_TimeMonitor.hpp>
-#include <Teuchos_XMLParameterListHelpers.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <cstdio>
+#include <vector>
 
 #include "opencv2/opencv.hpp"
 
+#include "AllocationCounter.h"
+#include "ControlChannel.h"
 #include "SubSetData.h"
-
-#if DICE_MPI
-#  include <mpi.h>
-#endif
+#include "CorrelationSession.h"
+#include "FrameSource.h"
+#include "LivePipeline.h"
+#include "ProcessGroup.h"
+#include "ResultRing.h"
+#include "StageProbe.h"
 
 using namespace DICe::field_enums;
 using namespace DICe;
 using namespace cv;
 using namespace std;
 
-bool read_input_data_files(Teuchos::RCP<Teuchos::ParameterList> *l_input_params,
-                           Teuchos::RCP<Teuchos::ParameterList> *l_correlation_params);
-
-void run_cross_correlation(Teuchos::RCP<DICe::Schema> l_schema, Teuchos::RCP<DICe::Schema> l_stereo_schema,
-                           Teuchos::RCP<DICe::Triangulation> *l_triangulation,
-                           Teuchos::RCP<Teuchos::ParameterList> *l_input_params,
-                           Teuchos::RCP<Teuchos::ParameterList> *l_correlation_params,
-                           std::vector<std::string> image_files, std::vector<std::string> stereo_image_files);
-
-bool
-run_correlation_and_triangulation(Teuchos::RCP<DICe::Schema> *l_schema, Teuchos::RCP<DICe::Schema> *l_stereo_schema,
-                                  Teuchos::RCP<DICe::Triangulation> *l_triangulation,
-                                  Teuchos::RCP<Teuchos::ParameterList> *l_input_params,
-                                  Teuchos::RCP<Teuchos::ParameterList> *l_correlation_params, int image_it,
-                                  std::vector<std::string> image_files, std::vector<std::string> stereo_image_files);
-
-void main_stereo_3d_correlation();
-void information_extraction();
-
-typedef struct{
-    int num_frames;
-    std::string file_prefix;
-    std::string stereo_file_prefix;
-    bool is_stereo;
-    int proc_size;
-    int proc_rank;
-}MainDataStructType;
-
-Teuchos::RCP<DICe::Schema> schema;
-Teuchos::RCP<DICe::Schema> stereo_schema;
-Teuchos::RCP<DICe::Triangulation> triangulation;
-Teuchos::RCP<Teuchos::ParameterList> input_params;
-Teuchos::RCP<Teuchos::ParameterList> correlation_params;
-std::vector<std::string> image_files;
-std::vector<std::string> stereo_image_files;
-Teuchos::RCP<std::ostream> outStream;
-MainDataStructType MainDataStruct;
-/**
- * Start a whole bunch of metrics to see how long stuff takes!!
- */
-Teuchos::RCP<Teuchos::Time> total_time = Teuchos::TimeMonitor::getNewCounter("## Total Time ##");
-Teuchos::RCP<Teuchos::Time> cross_time = Teuchos::TimeMonitor::getNewCounter("Cross-correlation");
-Teuchos::RCP<Teuchos::Time> corr_time = Teuchos::TimeMonitor::getNewCounter("Correlation");
-Teuchos::RCP<Teuchos::Time> write_time = Teuchos::TimeMonitor::getNewCounter("Write Output");
 Mat frame1, frame2, data(500, 1200, CV_8UC3, Scalar(0, 0, 0));;
 
-bool read_input_data_files(Teuchos::RCP<Teuchos::ParameterList> *l_input_params,
-                           Teuchos::RCP<Teuchos::ParameterList> *l_correlation_params) {
-    /**
-     * Get all of the input parameters from the input files.
-     */
-    *l_input_params = Teuchos::rcp(new Teuchos::ParameterList());
-    Teuchos::Ptr<Teuchos::ParameterList> inputParamsPtr(l_input_params->get());
-    Teuchos::updateParametersFromXmlFile("input.xml", inputParamsPtr);
-    TEUCHOS_TEST_FOR_EXCEPTION(*l_input_params == Teuchos::null, std::runtime_error, "");
-
-    *outStream << "Input Parameters: " << std::endl;
-    (*l_input_params)->print(*outStream);
-    *outStream << "\n--- Input read successfully ---\n" << std::endl;
-
-    /**
-     * Get all of the correlation parameters from the input files.
-     */
-    bool is_error_est_run = false;
-    if ((*l_input_params)->isParameter(DICe::correlation_parameters_file)) {
-        const std::string paramsFileName = (*l_input_params)->get<std::string>(DICe::correlation_parameters_file);
-        *l_correlation_params = DICe::read_correlation_params(paramsFileName);
-        *outStream << "User specified correlation Parameters: " << std::endl;
-        (*l_correlation_params)->print(*outStream);
-        is_error_est_run = (*l_correlation_params)->get<bool>(DICe::estimate_resolution_error, false);
-        if (is_error_est_run) {
-            // force the computing of the image laplacian for the reference image:
-            (*l_correlation_params)->set(DICe::compute_laplacian_image, true);
+/* No windows: the commands come from signals or the control socket and the results go to the ring */
+static void run_headless(LivePipeline &pipeline, ControlChannel &control) {
+    CapturedFrame left_preview;
+    CapturedFrame right_preview;
+    CorrelationResult result;
+    size_t results = 0;
+    for (;;) {
+        if (pipeline.next_preview(left_preview, right_preview)) {
+            frame1 = left_preview.image;
+            frame2 = right_preview.image;
         }
-        *outStream << "\n--- Correlation parameters read successfully ---\n" << std::endl;
-    } else {
-        *outStream << "Correlation parameters not specified by user" << std::endl;
+        if (pipeline.next_result(result) && ++results % 30 == 0)
+            pipeline.print_stats(cout);
+        const ControlCommand command = control.next(5);
+        if (command == CONTROL_NONE)
+            continue;
+        cout << "Control: " << control_command_name(command) << endl;
+        if (command == CONTROL_QUIT)
+            break;
+        if (command == CONTROL_REFERENCE) {
+            if (!frame1.empty() && !frame2.empty())
+                pipeline.request_reference(frame1, frame2);
+            else
+                cout << "No frames captured yet, reference not taken" << endl;
+        }
+        if (command == CONTROL_START)
+            pipeline.set_correlating(true);
+        if (command == CONTROL_STOP)
+            pipeline.set_correlating(false);
     }
-
-    return is_error_est_run;
 }
 
-void run_cross_correlation(Teuchos::RCP<DICe::Schema> *l_schema, Teuchos::RCP<DICe::Schema> *l_stereo_schema,
-                           Teuchos::RCP<DICe::Triangulation> *l_triangulation,
-                           Teuchos::RCP<Teuchos::ParameterList> *l_input_params,
-                           Teuchos::RCP<Teuchos::ParameterList> *l_correlation_params,
-                           std::vector<std::string> image_files, std::vector<std::string> stereo_image_files) {
-    /* We know this is a stereo analysis so we just assume all is correct */
-    Teuchos::TimeMonitor cross_time_monitor(*cross_time);
-    TEUCHOS_TEST_FOR_EXCEPTION((*l_schema)->analysis_type() == GLOBAL_DIC, std::runtime_error,
-                               "Error, global stereo not enabled yet");
-    *outStream << "Processing cross correlation between left and right images" << std::endl;
-    (*l_schema)->initialize_cross_correlation(*l_triangulation,
-                                              *l_input_params); // images don't need to be loaded by here they get loaded in this routine based on the input params
-    (*l_schema)->update_extents(true);
-    (*l_schema)->set_ref_image(image_files[0]);
-    (*l_schema)->set_def_image(stereo_image_files[0]);
-    if ((*l_schema)->use_nonlinear_projection()) {
-        (*l_schema)->project_right_image_into_left_frame(*l_triangulation, false);
+int main(int argc, char *argv[]) {
+    int return_val = 0;
+    float Brightness;
+    float FrameWidth;
+    float FrameHeight;
+    int system_state = 0;
+    PipelineOptions pipeline_options;
+    bool use_device_clock = false;
+    double synthetic_skew_ms = 0.0;
+    bool use_synthetic = false;
+    string replay_dir;
+    string cross_cache_folder;
+    bool serial_stereo = false;
+    bool tracking = false;
+    bool probes = false;
+    bool async_output = false;
+    bool binary_output = false;
+    bool roi_crop = false;
+    int roi_margin = 32;
+    string image_cache_folder;
+    int image_cache_mb = 4096;
+    bool clear_image_cache = false;
+    double deadline_ms = 0.0;
+    double change_gate = 0.0;
+    int pyramid_levels = 0;
+    bool headless = false;
+    string control_socket;
+    string ring_name;
+    int ring_slots = 64;
+    string trace_file;
+
+    /*
+     * --file-handoff            write each live pair to jpeg and let DICe decode it, as before
+     * --sync-grab               latch both cameras back to back from one capture thread
+     * --sync-tolerance-ms <ms>  largest left/right timestamp difference accepted as a pair
+     * --reject-unsynced         drop pairs outside the tolerance instead of flagging them
+     * --device-clock            stamp frames with CAP_PROP_POS_MSEC when both drivers report it on the first frame
+     * --synthetic-skew-ms <ms>  no cameras, generated frames with a known right camera skew
+     * --replay-dir <dir>        no cameras, play back the *_0 / *_1 images in dir at 30 fps
+     * --cross-cache <dir>       keep cross-correlation results in dir for later runs
+     * --serial-stereo           correlate the left then the right image instead of both at once
+     * --tracking                start each frame from the last solution, feature matching only for lost subsets
+     * --probes                  per-stage latency percentiles in the periodic stats
+     * --trace <file>            also write every stage as a Chrome trace / Perfetto JSON timeline at exit
+     * --async-output            write the result files from a background thread
+     * --binary-output           append every frame to one <prefix>.dres file, read it with masters_results
+     * --roi-crop                only convert the part of each frame around the subsets for DICe
+     * --roi-margin <px>         extra border of the crop for the motion between frames, 32 by default
+     * --image-cache <dir>       with --replay-dir, keep the decoded images in dir so the next replay skips the decode
+     * --image-cache-mb <n>      size cap of the image cache, least recently used images go first, 4096 by default
+     * --clear-image-cache       empty the image cache before replaying
+     * --deadline-ms <ms>        real-time mode, cap the solver and defer low priority subsets to stay in budget
+     * --change-gate <grey>      reuse the last solution of subsets whose window changed by at most this mean
+     *                           absolute difference (8 bit grey levels) since they were last solved
+     * --pyramid-init <levels>   start the subsets from a coarse-to-fine search over this many pyramid levels,
+     *                           also in place of the feature matching reseed with --tracking
+     * --headless                no windows, SIGUSR1 starts, SIGUSR2 stops, SIGHUP re-references, SIGTERM quits
+     * --control-socket <path>   with --headless, also take start/stop/reference/quit lines on a Unix socket
+     * --ring <name>             publish every frame's subset results to the shared memory ring name,
+     *                           /masters_results by default with --headless, read it with masters_ring
+     * --ring-slots <n>          frames the ring holds before the oldest is overwritten, 64 by default
+     */
+    for (int arg_it = 1; arg_it < argc; ++arg_it) {
+        const string arg(argv[arg_it]);
+        if (arg == "--file-handoff")
+            pipeline_options.file_handoff = true;
+        else if (arg == "--sync-grab")
+            pipeline_options.synchronised_grab = true;
+        else if (arg == "--sync-tolerance-ms" && arg_it + 1 < argc)
+            pipeline_options.sync_tolerance_ms = atof(argv[++arg_it]);
+        else if (arg == "--reject-unsynced")
+            pipeline_options.reject_out_of_sync = true;
+        else if (arg == "--device-clock")
+            use_device_clock = true;
+        else if (arg == "--synthetic-skew-ms" && arg_it + 1 < argc) {
+            synthetic_skew_ms = atof(argv[++arg_it]);
+            use_synthetic = true;
+        } else if (arg == "--replay-dir" && arg_it + 1 < argc)
+            replay_dir = argv[++arg_it];
+        else if (arg == "--cross-cache" && arg_it + 1 < argc)
+            cross_cache_folder = argv[++arg_it];
+        else if (arg == "--serial-stereo")
+            serial_stereo = true;
+        else if (arg == "--tracking")
+            tracking = true;
+        else if (arg == "--probes")
+            probes = true;
+        else if (arg == "--trace" && arg_it + 1 < argc)
+            trace_file = argv[++arg_it];
+        else if (arg == "--async-output")
+            async_output = true;
+        else if (arg == "--binary-output")
+            binary_output = true;
+        else if (arg == "--roi-crop")
+            roi_crop = true;
+        else if (arg == "--roi-margin" && arg_it + 1 < argc)
+            roi_margin = atoi(argv[++arg_it]);
+        else if (arg == "--image-cache" && arg_it + 1 < argc)
+            image_cache_folder = argv[++arg_it];
+        else if (arg == "--image-cache-mb" && arg_it + 1 < argc)
+            image_cache_mb = atoi(argv[++arg_it]);
+        else if (arg == "--clear-image-cache")
+            clear_image_cache = true;
+        else if (arg == "--deadline-ms" && arg_it + 1 < argc)
+            deadline_ms = atof(argv[++arg_it]);
+        else if (arg == "--change-gate" && arg_it + 1 < argc)
+            change_gate = atof(argv[++arg_it]);
+        else if (arg == "--pyramid-init" && arg_it + 1 < argc)
+            pyramid_levels = atoi(argv[++arg_it]);
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--control-socket" && arg_it + 1 < argc)
+            control_socket = argv[++arg_it];
+        else if (arg == "--ring" && arg_it + 1 < argc)
+            ring_name = argv[++arg_it];
+        else if (arg == "--ring-slots" && arg_it + 1 < argc)
+            ring_slots = atoi(argv[++arg_it]);
     }
-    (*l_schema)->execute_cross_correlation();
-    (*l_schema)->save_cross_correlation_fields();
-    *l_stereo_schema = Teuchos::rcp(new DICe::Schema(*l_input_params, *l_correlation_params, *l_schema));
-    (*l_stereo_schema)->update_extents();
-    (*l_stereo_schema)->set_ref_image(stereo_image_files[0]);
-    assert((*l_stereo_schema) != Teuchos::null);
-    //if(stereo_schema->use_nonlinear_projection())
-    //  stereo_schema->project_right_image_into_left_frame(triangulation,true);
-    (*l_stereo_schema)->set_frame_range(0, 2);
-
-    // go ahead and set up the model coordinates field
-    (*l_schema)->execute_triangulation(*l_triangulation, *l_stereo_schema);
-}
-
-bool
-run_correlation_and_triangulation(Teuchos::RCP<DICe::Schema> *l_schema, Teuchos::RCP<DICe::Schema> *l_stereo_schema,
-                                  Teuchos::RCP<DICe::Triangulation> *l_triangulation,
-                                  Teuchos::RCP<Teuchos::ParameterList> *l_input_params,
-                                  Teuchos::RCP<Teuchos::ParameterList> *l_correlation_params, int image_it,
-                                  std::vector<std::string> image_files, std::vector<std::string> stereo_image_files) {
-    bool failed_step = false;
-    bool is_stereo = true; //This is definitely stereo
-
-    std::string file_prefix = (*l_input_params)->get<std::string>(DICe::output_prefix, "DICe_solution");
-    std::string stereo_file_prefix = (*l_input_params)->get<std::string>(DICe::output_prefix, "DICe_solution");
-    stereo_file_prefix += "_stereo";
-    const bool separate_header_file = (*l_input_params)->get<bool>(DICe::create_separate_run_info_file, false);
-
-    *outStream << "Processing frame: " << image_it << ", " << image_files[image_it]
-               << std::endl;
-    if ((*l_schema)->use_incremental_formulation() && image_it > 1) {
-        (*l_schema)->set_ref_image((*l_schema)->def_img());
+    if (headless && ring_name.empty())
+        ring_name = "/masters_results";
+
+    if (!trace_file.empty())
+        enable_probe_trace();
+    else if (probes)
+        enable_probes();
+
+    /* The session keeps the schemas alive between frames so DICe only needs to be set up once */
+    DICe::initialize(argc, argv);
+    CorrelationSession session;
+    session.set_cross_correlation_cache_folder(cross_cache_folder);
+    session.set_parallel_stereo(!serial_stereo);
+    session.set_tracking(tracking);
+    session.set_async_output(async_output);
+    session.set_output_format(binary_output ? RESULT_BINARY : RESULT_TEXT);
+    session.set_roi_crop(roi_crop, roi_margin);
+    session.set_deadline(deadline_ms);
+    session.set_change_gate(change_gate);
+    session.set_pyramid_initializer(pyramid_levels);
+    if (process_rank() != 0) {
+        // under mpirun only rank 0 has the cameras and the windows, the rest take their share of the subsets
+        session.follow();
+        DICe::finalize();
+        return return_val;
     }
-    (*l_schema)->update_extents();
-    (*l_schema)->set_def_image(image_files[image_it]);
-    if (is_stereo) {
-        if ((*l_stereo_schema)->use_incremental_formulation() && image_it > 1) {
-            (*l_stereo_schema)->set_ref_image((*l_stereo_schema)->def_img());
+
+    VideoCapture cap2;
+    VideoCapture cap1;
+    unique_ptr<FrameSource> left_source;
+    unique_ptr<FrameSource> right_source;
+    unique_ptr<ImageCache> image_cache;
+    if (!replay_dir.empty()) {
+        ReplayFrameSource *left_replay = new ReplayFrameSource(ReplayFrameSource::list_directory(replay_dir, "_0"),
+                                                               1000.0 / 30.0, true, true);
+        ReplayFrameSource *right_replay = new ReplayFrameSource(ReplayFrameSource::list_directory(replay_dir, "_1"),
+                                                                1000.0 / 30.0, true, true);
+        left_source.reset(left_replay);
+        right_source.reset(right_replay);
+        if (!image_cache_folder.empty()) {
+            image_cache.reset(new ImageCache(image_cache_folder, (size_t) image_cache_mb << 20));
+            if (clear_image_cache)
+                image_cache->clear();
+            left_replay->set_cache(image_cache.get());
+            right_replay->set_cache(image_cache.get());
         }
-        (*l_stereo_schema)->update_extents();
-        (*l_stereo_schema)->set_def_image(stereo_image_files[image_it]);
-        //if(stereo_schema->use_nonlinear_projection())
-        //  stereo_schema->project_right_image_into_left_frame(triangulation,false);
-    }
-    { // start the timer
-        Teuchos::TimeMonitor corr_time_monitor(*corr_time);
-        int_t corr_error = (*l_schema)->execute_correlation();
-        if (corr_error)
-            failed_step = true;
-        if (is_stereo) {
-            corr_error = (*l_stereo_schema)->execute_correlation();
-            if (corr_error)
-                failed_step = true;
+        if (!left_source->is_opened() || !right_source->is_opened()) {
+            std::cout << "No *_0 / *_1 images found in " << replay_dir << "\n";
+            session.release_followers();
+            DICe::finalize();
+            return -1;
         }
-        (*l_schema)->execute_triangulation(*l_triangulation, (*l_stereo_schema));
-        (*l_schema)->execute_post_processors();
-    }
-    // write the output
-    const bool no_text_output = (*l_input_params)->get<bool>(DICe::no_text_output_files, false);
-    {
-        Teuchos::TimeMonitor write_time_monitor(*write_time);
-        (*l_schema)->write_output(output_folder, file_prefix, separate_output_file_for_each_subset,
-                                  separate_header_file, no_text_output);
-        (*l_schema)->post_execution_tasks();
-        // print the timing data with or without verbose flag
-        if ((*l_input_params)->get<bool>(DICe::print_stats, false)) {
-            (*l_schema)->mesh()->print_field_stats();
+        cout << "Replaying images from " << replay_dir << endl;
+    } else if (use_synthetic) {
+        left_source.reset(new SyntheticFrameSource(640, 480, 1000.0 / 30.0));
+        right_source.reset(new SyntheticFrameSource(640, 480, 1000.0 / 30.0, synthetic_skew_ms));
+        cout << "Using synthetic frames, right camera skew " << synthetic_skew_ms << " ms" << endl;
+    } else {
+        cap2.open(0); // open the default camera
+        cap1.open(2); // open the default camera
+
+        Brightness = cap1.get(CV_CAP_PROP_BRIGHTNESS);
+        FrameWidth = cap1.get(CV_CAP_PROP_FRAME_WIDTH);
+        FrameHeight = cap1.get(CV_CAP_PROP_FRAME_HEIGHT);
+
+        cout << "====================================" << endl << endl;
+        cout << "Default Brightness -------> " << Brightness << endl;
+        cout << "Default Width      -------> " << FrameWidth << endl;
+        cout << "Default Height     -------> " << FrameHeight << endl;
+        cout << "====================================" << endl;
+
+        if (!cap1.isOpened()) {  // check if we succeeded
+            std::cout << "First camera cannot be found\n";
+            session.release_followers();
+            DICe::finalize();
+            return -1;
+        } else {
+            cout << "Camera 1 is open\n";
         }
-        //if(subset_info->conformal_area_defs!=Teuchos::null&&image_it==1){
-        //  schema->write_control_points_image("RegionOfInterest");
-        //}
-        if (is_stereo) {
-            if ((*l_input_params)->get<bool>(DICe::output_stereo_files, false)) {
-                (*l_stereo_schema)->write_output(output_folder, stereo_file_prefix,
-                                                 separate_output_file_for_each_subset, separate_header_file,
-                                                 no_text_output);
+        if (!cap2.isOpened()) {  // check if we succeeded
+            std::cout << "Second camera cannot be found\n";
+            session.release_followers();
+            DICe::finalize();
+            return -1;
+        } else {
+            cout << "Camera 2 is open\n";
+        }
+        VideoCaptureSource *left_camera = new VideoCaptureSource(cap2, use_device_clock);
+        VideoCaptureSource *right_camera = new VideoCaptureSource(cap1, use_device_clock);
+        left_source.reset(left_camera);
+        right_source.reset(right_camera);
+        if (use_device_clock) {
+            // the pair is matched on the stamps, both cameras have to be on the same clock
+            if (left_camera->device_clock() && right_camera->device_clock()) {
+                cout << "Frames are stamped with the camera clocks" << endl;
+            } else {
+                cout << "A camera does not report its clock, frames are stamped on the monotonic clock" << endl;
+                left_camera->use_monotonic_clock();
+                right_camera->use_monotonic_clock();
             }
-            (*l_stereo_schema)->post_execution_tasks();
         }
     }
-    return failed_step;
-}
-
-
-void information_extraction(){
-    std::string output_folder;
-    bool is_error_est_run;
-    int_t proc_size = 1;
-    int_t proc_rank = 0;
-
-    std::cout << "Start of process." << std::endl;
-
-    outStream = Teuchos::rcp(&std::cout, false);
-
-    if (proc_rank == 0) DEBUG_MSG("Parsing command line options");
-    bool force_exit = false;
-
-    /******* Get the input parameters */
-    is_error_est_run = read_input_data_files(&input_params, &correlation_params);
-
-    /******* Decipher the image file names (note: zero entry is the reference image) */
-    DICe::decipher_image_file_names(input_params, image_files, stereo_image_files);
-    const bool is_stereo = stereo_image_files.size() > 0;
-
-    /******* Create the list of images */
-    const int_t num_frames = image_files.size() - 1;
-    int_t first_frame_id = 0;
-    int_t image_width = 0;
-    int_t image_height = 0;
 
-    TEUCHOS_TEST_FOR_EXCEPTION(num_frames <= 0, std::runtime_error, "");
-    *outStream << "Reference image: " << image_files[0] << std::endl;
-    for (int_t i = 1; i <= num_frames; ++i) {
-        if (i == 10 && num_frames != 10) *outStream << "..." << std::endl;
-        else if (i > 10 && i < num_frames) continue;
-        else
-            *outStream << "Deformed image: " << image_files[i] << std::endl;
+    LivePipeline pipeline(*left_source, *right_source, session, pipeline_options);
+    CapturedFrame left_preview;
+    CapturedFrame right_preview;
+    CorrelationResult result;
+    SubSetData shown_subsets;
+    Mat left_display;
+    size_t results_shown = 0;
+
+    unique_ptr<ResultRingWriter> ring;
+    if (!ring_name.empty()) {
+        ring.reset(new ResultRingWriter(ring_name, ring_slots));
+        pipeline.set_publisher(ring.get());
+        cout << "Publishing results to the shared memory ring " << ring_name << endl;
     }
-    *outStream << "\n--- List of images constructed successfuly ---\n" << std::endl;
-
-    /******* Get the size of the images being used */
-    utils::read_image_dimensions(image_files[0].c_str(), image_width, image_height);
-    *outStream << "Image dimensions: " << image_width << " x " << image_height << std::endl;
-
-    /******* Where are we going to put the output information */
-    output_folder = input_params->get<std::string>(DICe::output_folder);
-    const bool separate_output_file_for_each_subset = input_params->get<bool>(
-            DICe::separate_output_file_for_each_subset, false);
-    if (separate_output_file_for_each_subset) {
-        *outStream << "Output will be written to separate output files for each subset" << std::endl;
-    } else {
-        *outStream << "Output will be written to one file per frame with all subsets included" << std::endl;
-    }
-    const bool separate_header_file = input_params->get<bool>(DICe::create_separate_run_info_file, false);
-    if (separate_header_file) {
-        *outStream
-                << "Execution information will be written to a separate file (not placed in the output headers)"
-                << std::endl;
-    }
-
-    /******* create schemas: */
-    schema = Teuchos::rcp(new DICe::Schema(input_params, correlation_params));
-    // let the schema know how many images there are in the sequence and the first frame id:
-    schema->set_frame_range(first_frame_id, num_frames);
-
-    /******* Set up the subsets */
-    *outStream << "Number of global subsets: " << schema->global_num_subsets() << std::endl;
-    list<SubSetData> *subSets = getSubSets();
-    subSets->clear();
-    for (int_t i = 0; i < schema->local_num_subsets(); ++i) {
-
-        stringstream sx;
-        stringstream sy;
-        stringstream ss;
-        sx << schema->mesh()->get_field(schema->mesh()->get_field_spec("COORDINATE_X"))->local_value(i);
-        sy << schema->mesh()->get_field(schema->mesh()->get_field_spec("COORDINATE_Y"))->local_value(i);
-        SubSetData newOne(stoi(sx.str()),
-                          stoi(sy.str()),
-                          schema->subset_dim());
-        newOne.Subset_Idx = i;
-        subSets->push_front(newOne);
-
-        if (i == 10 && schema->local_num_subsets() != 11) *outStream << "..." << std::endl;
-        else if (i > 10 && i < schema->local_num_subsets() - 1) continue;
-        else
-            *outStream << "Proc 0: subset global id: " << schema->subset_global_id(i) << " global coordinates ("
-                       << schema->local_field_value(i, DICe::field_enums::SUBSET_COORDINATES_X_FS) <<
-                       "," << schema->local_field_value(i, DICe::field_enums::SUBSET_COORDINATES_Y_FS) << ")"
-                       << std::endl;
-    }
-    *outStream << std::endl;
-
-    std::string file_prefix = input_params->get<std::string>(DICe::output_prefix, "DICe_solution");
-    std::string stereo_file_prefix = input_params->get<std::string>(DICe::output_prefix, "DICe_solution");
-    stereo_file_prefix += "_stereo";
 
-    // for backwards compatibility allow the user to specify either a calibration_parameters_file or a camera_system_file
-    // (camera_system_file is the new preferred way)
-    TEUCHOS_TEST_FOR_EXCEPTION(is_stereo && (!input_params->isParameter(DICe::calibration_parameters_file) &&
-                                             !input_params->isParameter(DICe::camera_system_file)),
-                               std::runtime_error,
-                               "Error, calibration_parameters_file or camera_system_file required for stereo");
-    TEUCHOS_TEST_FOR_EXCEPTION(input_params->isParameter(DICe::calibration_parameters_file) &&
-                               input_params->isParameter(DICe::camera_system_file),
-                               std::runtime_error,
-                               "Error, both calibration_parameters_file and camera_system_file cannot be specified");
-
-    if (input_params->isParameter(DICe::calibration_parameters_file) ||
-        input_params->isParameter(DICe::camera_system_file)) {
-        if (proc_rank == 0)
-            update_legacy_txt_cal_input(
-                    input_params); // in case an old txt format cal input file is being used it needs to have width and height added to it
-
-        const std::string cal_file_name = input_params->isParameter(DICe::calibration_parameters_file)
-                                          ? input_params->get<std::string>(DICe::calibration_parameters_file) :
-                                          input_params->get<std::string>(DICe::camera_system_file);
-        triangulation = Teuchos::rcp(new DICe::Triangulation(cal_file_name));
-        *outStream << "\n--- Calibration parameters read successfully ---\n" << std::endl;
-    } else {
-        *outStream << "Calibration parameters not specified by user" << std::endl;
-    }
-    TEUCHOS_TEST_FOR_EXCEPTION(is_stereo && triangulation == Teuchos::null, std::runtime_error,
-                               "Error, triangulation should be instantiated at this point");
-    MainDataStruct.num_frames = num_frames;
-    MainDataStruct.is_stereo = is_stereo;
-    MainDataStruct.file_prefix = file_prefix;
-    MainDataStruct.stereo_file_prefix = stereo_file_prefix;
-    MainDataStruct.proc_rank = proc_rank;
-    MainDataStruct.proc_size = proc_size;
-}
-
-
-void main_stereo_3d_correlation() {
-
-    // iterate through the images and perform the correlation:
-    bool failed_step;
-
-    for (int_t image_it = 1; image_it <= MainDataStruct.num_frames; ++image_it) {
-        failed_step = run_correlation_and_triangulation(&schema, &stereo_schema, &triangulation, &input_params,
-                                                        &correlation_params, image_it, image_files,
-                                                        stereo_image_files);
-    } // image loop
-
-    schema->write_stats(output_folder, MainDataStruct.file_prefix);
-    if (MainDataStruct.is_stereo)
-        stereo_schema->write_stats(output_folder, MainDataStruct.stereo_file_prefix);
-
-    if (failed_step)
-        *outStream << "\n--- Failed Step Occurred ---\n" << std::endl;
-    else
-        *outStream << "\n--- Successful Completion ---\n" << std::endl;
-
-    // output timing
-
-    // print the timing data with or without verbose flag
-    if (input_params->get<bool>(DICe::print_timing, false)) {
-        Teuchos::TimeMonitor::summarize(*outStream, false, true, false/*zero timers*/);
-    }
-    //  write the time output to file:
-    std::stringstream timeFileName;
-    timeFileName << output_folder << "timing." << MainDataStruct.proc_size << "." << MainDataStruct.proc_rank << ".txt";
-    std::ofstream ofs(timeFileName.str(), std::ofstream::out);
-    Teuchos::TimeMonitor::summarize(ofs, false, true, false/*zero timers*/);
-    ofs.close();
-    if (MainDataStruct.proc_rank != 0) // only keep the process zero copy of the timing results
-        std::remove(timeFileName.str().c_str());
-
-    DICe::finalize();
-}
-
-int main(int argc, char *argv[]) {
-    int return_val;
-    float Brightness;
-    float FrameWidth;
-    float FrameHeight;
-    int system_state = 0;
-
-    VideoCapture cap2(0); // open the default camera
-    VideoCapture cap1(2); // open the default camera
-
-    Brightness = cap1.get(CV_CAP_PROP_BRIGHTNESS);
-    FrameWidth = cap1.get(CV_CAP_PROP_FRAME_WIDTH);
-    FrameHeight = cap1.get(CV_CAP_PROP_FRAME_HEIGHT);
-
-    cout << "====================================" << endl << endl;
-    cout << "Default Brightness -------> " << Brightness << endl;
-    cout << "Default Width      -------> " << FrameWidth << endl;
-    cout << "Default Height     -------> " << FrameHeight << endl;
-    cout << "====================================" << endl;
-
-    if (!cap1.isOpened()) {  // check if we succeeded
-        std::cout << "First camera cannot be found\n";
-        return -1;
-    } else {
-        cout << "Camera 1 is open\n";
-    }
-    if (!cap2.isOpened()) {  // check if we succeeded
-        std::cout << "Second camera cannot be found\n";
-        return -1;
+    pipeline.start();
+    if (headless) {
+        ControlChannel control;
+        control.install_signals();
+        if (!control_socket.empty()) {
+            if (control.listen(control_socket))
+                cout << "Control socket " << control_socket << endl;
+            else
+                cout << "Cannot listen on " << control_socket << ", signals only" << endl;
+        }
+        run_headless(pipeline, control);
     } else {
-        cout << "Camera 2 is open\n";
-    }
-
-    namedWindow("Left", WINDOW_AUTOSIZE);
-    namedWindow("Right", WINDOW_AUTOSIZE);
-    for (;;) {
-        switch (system_state) {
-            case 0:
-                cap2 >> frame1; // get a new frame from camera
-                cap1 >> frame2;
-
-                imshow("Left", frame1);
-                imshow("Right", frame2);
-                break;
-            case 1:
-                cap2 >> frame1; // get a new frame from camera
-                cap1 >> frame2;
-
-                imwrite("Img_0001_0.jpeg", frame1);
-                imwrite("Img_0001_1.jpeg", frame2);
-
-                list<SubSetData> *subSets = getSubSets();
-                if (subSets->size() > 0) {
-                    for (SubSetData &theSet : (*subSets)) {
-                        Rect r = Rect(theSet.X_Coord - (theSet.Subset_Size / 2),
-                                      theSet.Y_Coord - (theSet.Subset_Size / 2),
-                                      theSet.Subset_Size, theSet.Subset_Size);
-                        rectangle(frame1, r, Scalar(255, 0, 0), 1, 8, 0);
+        namedWindow("Left", WINDOW_AUTOSIZE);
+        namedWindow("Right", WINDOW_AUTOSIZE);
+        for (;;) {
+            if (pipeline.next_preview(left_preview, right_preview)) {
+                frame1 = left_preview.image;
+                frame2 = right_preview.image;
+            }
+            switch (system_state) {
+                case 0:
+                    if (!frame1.empty())
+                        imshow("Left", frame1);
+                    if (!frame2.empty())
+                        imshow("Right", frame2);
+                    break;
+                case 1:
+                    if (pipeline.next_result(result)) {
+                        ScopedProbe render_probe(PROBE_RENDER);
+                        const uint64_t render_allocations = thread_allocation_count();
+                        const chrono::steady_clock::time_point render_start = chrono::steady_clock::now();
+                        shown_subsets = result.subsets;
+                        // the canvas is allocated once at startup and only cleared for every result
+                        data.setTo(Scalar(0, 0, 0));
+                        putText(data, "Subset 1", Point(0, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                        putText(data, "Subset 2", Point(400, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                        putText(data, "Subset 3", Point(800, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                        // short enough for the small string buffer, putText's string argument does not allocate
+                        char text[16];
+                        if (!result.in_sync) {
+                            putText(data, "OUT OF SYNC", Point(0, 480), FONT_HERSHEY_SIMPLEX, 1, Scalar(0, 0, 255));
+                            snprintf(text, sizeof(text), "%.1f ms", result.skew_ms);
+                            putText(data, text, Point(250, 480), FONT_HERSHEY_SIMPLEX, 1, Scalar(0, 0, 255));
+                        }
+                        if (deadline_ms > 0.0) {
+                            snprintf(text, sizeof(text), "budget %.0f%%", 100.0 * result.budget_used);
+                            putText(data, text, Point(0, 430), FONT_HERSHEY_SIMPLEX, 1,
+                                    result.budget_used > 1.0 ? Scalar(0, 0, 255) : Scalar(128));
+                            snprintf(text, sizeof(text), "deferred %d", (int) result.subsets_deferred);
+                            putText(data, text, Point(400, 430), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                        }
+                        if (change_gate > 0.0) {
+                            snprintf(text, sizeof(text), "carried %d", (int) result.subsets_carried);
+                            putText(data, text, Point(800, 430), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                        }
+                        // three columns fit across the data window
+                        const int text_subsets = std::min((int) shown_subsets.size(), 3);
+                        for (int subset_idx = 0; subset_idx < text_subsets; subset_idx++) {
+                            putText(data, "X:", Point(subset_idx * 400, 80), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                            snprintf(text, sizeof(text), "%g", shown_subsets.displacement_x[subset_idx]);
+                            putText(data, text, Point(subset_idx * 400 + 100, 80), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                            putText(data, "Y:", Point(subset_idx * 400, 130), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                            snprintf(text, sizeof(text), "%g", shown_subsets.displacement_y[subset_idx]);
+                            putText(data, text, Point(subset_idx * 400 + 100, 130), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                            putText(data, "Z:", Point(subset_idx * 400, 180), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                            snprintf(text, sizeof(text), "%g", shown_subsets.displacement_z[subset_idx]);
+                            putText(data, text, Point(subset_idx * 400 + 100, 180), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                        }
+                        imshow("Data", data);
+                        pipeline.record_render(
+                                chrono::duration<double, milli>(chrono::steady_clock::now() - render_start).count(),
+                                (long) (thread_allocation_count() - render_allocations), result);
+                        if (++results_shown % 30 == 0)
+                            pipeline.print_stats(cout);
                     }
-                }
-
-                imshow("Left", frame1);
-                imshow("Right", frame2);
-                imshow("Data", data);
-                DICe::initialize(argc, argv);
-                information_extraction();
-                run_cross_correlation(&schema, &stereo_schema, &triangulation, &input_params, &correlation_params, image_files,
-                                      stereo_image_files);
-                main_stereo_3d_correlation();
-                data.release();
-                data = Mat(500, 1200, CV_8UC3, Scalar(0, 0, 0));
-                putText(data, "Subset 1", Point(0, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                putText(data, "Subset 2", Point(400, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                putText(data, "Subset 3", Point(800, 30), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                for (int subset_idx = 0; subset_idx < schema->local_num_subsets(); subset_idx++) {
-
-                    stringstream sx;
-                    stringstream sy;
-                    stringstream sz;
-                    sx << schema->local_field_value(subset_idx, MODEL_DISPLACEMENT_X_FS);
-                    sy << schema->local_field_value(subset_idx, MODEL_DISPLACEMENT_Y_FS);
-                    sz << schema->local_field_value(subset_idx, MODEL_DISPLACEMENT_Z_FS);
-                    putText(data, "X:", Point(subset_idx * 400, 80), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                    putText(data, sx.str(), Point(subset_idx * 400 + 100, 80), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                    putText(data, "Y:", Point(subset_idx * 400, 130), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                    putText(data, sy.str(), Point(subset_idx * 400 + 100, 130), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                    putText(data, "Z:", Point(subset_idx * 400, 180), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
-                    putText(data, sz.str(), Point(subset_idx * 400 + 100, 180), FONT_HERSHEY_SIMPLEX, 1, Scalar(128));
+                    if (!frame1.empty()) {
+                        // the preview frames are shared with the worker, draw on a copy kept between frames
+                        frame1.copyTo(left_display);
+                        for (size_t subset_idx = 0; subset_idx < shown_subsets.size(); ++subset_idx) {
+                            // grey for a subset the deadline deferred, its solution is from an earlier frame,
+                            // dark blue for one the change gate carried over because its image did not change
+                            const Scalar colour = shown_subsets.stale_frames[subset_idx] > 0 ? Scalar(128, 128, 128)
+                                                  : shown_subsets.carried_over[subset_idx] ? Scalar(128, 0, 0)
+                                                                                           : Scalar(255, 0, 0);
+                            rectangle(left_display, shown_subsets.box(subset_idx), colour, 1, 8, 0);
+                        }
+                        imshow("Left", left_display);
+                    }
+                    if (!frame2.empty())
+                        imshow("Right", frame2);
+                    break;
+            }
+            char c = waitKey(5);
 
-//                    std::cout << "The DISPLACEMENT_X field value for subset " << subset_idx << " is "
-//                              << schema->local_field_value(subset_idx, MODEL_DISPLACEMENT_X_FS) << std::endl;
-//                    std::cout << "The DISPLACEMENT_Y field value for subset " << subset_idx << " is "
-//                              << schema->local_field_value(subset_idx, MODEL_DISPLACEMENT_Y_FS) << std::endl;
-//                    std::cout << "The DISPLACEMENT_Z field value for subset " << subset_idx << " is "
-//                              << schema->local_field_value(subset_idx, MODEL_DISPLACEMENT_Z_FS) << std::endl;
-                }
+            if (c == 'q') {
                 break;
-        }
-        char c = waitKey(5);
-
-        if (c == 'q') {
-            break;
-        }
-        if (c == 'i') {
-            imwrite("Img_0000_0.jpeg", frame1);
-            imwrite("Img_0000_1.jpeg", frame2);
-
-        }
-        if (c == 'r') {
-            system_state = 1;
+            }
+            if (c == 'i' && !frame1.empty() && !frame2.empty()) {
+                pipeline.request_reference(frame1, frame2);
+            }
+            if (c == 'r') {
+                system_state = 1;
+                pipeline.set_correlating(true);
+            }
         }
     }
 
+    pipeline.stop();
+    pipeline.print_stats(cout);
+    session.finish(pipeline.failed_step());
+    session.release_followers();
+    if (!trace_file.empty()) {
+        if (write_probe_trace(trace_file))
+            cout << "Stage trace written to " << trace_file << endl;
+        else
+            cout << "Cannot write the stage trace " << trace_file << endl;
+    }
+    DICe::finalize();
 
     return return_val;
 }
@@ -0,0 +1,145 @@
+// Reader for the binary result files written with --binary-output, e.g.
+//
+//   masters_results info results/DICe_solution.dres
+//   masters_results dump results/DICe_solution.dres 12 DISPLACEMENT_X SIGMA
+//   masters_results to-text results/DICe_solution.dres --delimiter ,
+//
+// to-text turns the file back into one <prefix>_<frame>.txt per frame for the existing tooling.
+//
+#include <DICe.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ResultFile.h"
+#include "ResultWriter.h"
+
+using namespace std;
+
+static void usage() {
+    cerr << "usage: masters_results info <file.dres>" << endl
+         << "       masters_results dump <file.dres> <frame index> [field ...]" << endl
+         << "       masters_results to-text <file.dres> [--folder <dir>] [--delimiter <d>] [--no-row-id]" << endl;
+}
+
+static int print_info(const ResultFileReader &reader) {
+    cout << "subsets " << reader.num_subsets() << endl;
+    cout << "frames " << reader.num_frames();
+    if (reader.num_frames() > 0)
+        cout << " (" << reader.frame_number(0) << " to " << reader.frame_number(reader.num_frames() - 1) << ")";
+    cout << endl << "fields";
+    for (size_t field = 0; field < reader.field_names().size(); ++field)
+        cout << " " << reader.field_names()[field];
+    cout << endl;
+    return 0;
+}
+
+static int dump_frame(const ResultFileReader &reader, int64_t frame, const vector<string> &names) {
+    if (frame < 0 || frame >= reader.num_frames()) {
+        cerr << "The file has frames 0 to " << reader.num_frames() - 1 << endl;
+        return -1;
+    }
+    vector<size_t> fields;
+    for (size_t i = 0; i < names.size(); ++i) {
+        const int field = reader.field_index(names[i]);
+        if (field < 0) {
+            cerr << "No field " << names[i] << " in the file" << endl;
+            return -1;
+        }
+        fields.push_back(field);
+    }
+    if (fields.empty())
+        for (size_t field = 0; field < reader.field_names().size(); ++field)
+            fields.push_back(field);
+
+    cout << "# frame " << reader.frame_number(frame) << endl << "SUBSET_ID";
+    for (size_t i = 0; i < fields.size(); ++i)
+        cout << " " << reader.field_names()[fields[i]];
+    cout << endl;
+    char number[32];
+    for (int64_t subset = 0; subset < reader.num_subsets(); ++subset) {
+        cout << subset;
+        for (size_t i = 0; i < fields.size(); ++i) {
+            snprintf(number, sizeof(number), "%.6e", reader.value(frame, fields[i], subset));
+            cout << " " << number;
+        }
+        cout << endl;
+    }
+    return 0;
+}
+
+static int convert_to_text(const ResultFileReader &reader, const string &file_name, string folder,
+                           const string &delimiter, bool row_ids) {
+    const size_t slash = file_name.find_last_of('/');
+    string prefix = slash == string::npos ? file_name : file_name.substr(slash + 1);
+    if (prefix.size() > 5 && prefix.compare(prefix.size() - 5, 5, ".dres") == 0)
+        prefix.erase(prefix.size() - 5);
+    if (folder.empty())
+        folder = slash == string::npos ? "" : file_name.substr(0, slash + 1);
+    else if (folder[folder.size() - 1] != '/')
+        folder += "/";
+
+    // the same formatting as the live text output, so the files are interchangeable
+    ResultWriter writer;
+    writer.set_text_layout(delimiter, row_ids);
+    const shared_ptr<const vector<string> > field_names = make_shared<const vector<string> >(reader.field_names());
+    const size_t num_values = reader.field_names().size() * reader.num_subsets();
+    for (int64_t frame = 0; frame < reader.num_frames(); ++frame) {
+        shared_ptr<ResultSnapshot> snapshot = make_shared<ResultSnapshot>();
+        snapshot->folder = folder;
+        snapshot->prefix = prefix;
+        snapshot->frame = (int_t) reader.frame_number(frame);
+        snapshot->num_subsets = reader.num_subsets();
+        snapshot->field_names = field_names;
+        const double *values = reader.column(frame, 0);
+        snapshot->values.assign(values, values + num_values);
+        writer.push(snapshot);
+    }
+    writer.flush();
+    cout << "Wrote " << writer.stats().frames_written << " frames to " << folder << prefix << "_*.txt" << endl;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage();
+        return -1;
+    }
+    const string command(argv[1]);
+    const string file_name(argv[2]);
+    ResultFileReader reader;
+    if (!reader.open(file_name)) {
+        cerr << reader.error() << endl;
+        return -1;
+    }
+
+    if (command == "info")
+        return print_info(reader);
+    if (command == "dump" && argc >= 4)
+        return dump_frame(reader, atoll(argv[3]), vector<string>(argv + 4, argv + argc));
+    if (command == "to-text") {
+        string folder;
+        string delimiter = ",";
+        bool row_ids = true;
+        for (int arg_it = 3; arg_it < argc; ++arg_it) {
+            const string arg(argv[arg_it]);
+            if (arg == "--folder" && arg_it + 1 < argc)
+                folder = argv[++arg_it];
+            else if (arg == "--delimiter" && arg_it + 1 < argc)
+                delimiter = argv[++arg_it];
+            else if (arg == "--no-row-id")
+                row_ids = false;
+            else {
+                usage();
+                return -1;
+            }
+        }
+        return convert_to_text(reader, file_name, folder, delimiter, row_ids);
+    }
+    usage();
+    return -1;
+}
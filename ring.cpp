@@ -0,0 +1,245 @@
+// Sample consumer and throughput test for the shared memory result ring of masters_v3 --ring / --headless, e.g.
+//
+//   masters_ring follow /masters_results
+//   masters_ring throughput --subsets 2000 --frames 20000 --readers 4
+//
+// follow prints a line per frame as the writer publishes it. throughput runs a writer and the readers
+// in this process against a ring of its own and reports the publish rate and what each reader saw; with
+// --rate the writer is paced like a camera and a reader that keeps up misses nothing.
+//
+#include <DICe.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ResultRing.h"
+#include "SubSetData.h"
+
+using namespace std;
+
+static void usage() {
+    cerr << "usage: masters_ring follow [<ring name>]" << endl
+         << "       masters_ring throughput [--subsets <n>] [--frames <n>] [--readers <n>] [--slots <n>]" << endl
+         << "                                    [--rate <frames/s>]" << endl;
+}
+
+static double elapsed_ms(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static int follow(const string &name) {
+    ResultRingReader reader;
+    uint64_t next = 0;
+    uint64_t missed = 0;
+    vector<double> displacement_z;
+    ResultRingView view;
+    for (;;) {
+        if (!reader.is_open() || reader.closed()) {
+            // the writer is not up yet, went away or made a bigger ring
+            if (!reader.open(name)) {
+                usleep(100000);
+                continue;
+            }
+            cout << "Following " << name << ", " << reader.slot_count() << " slots" << endl;
+            // start at the newest frame, the older ones are history
+            next = reader.published() > 0 ? reader.published() - 1 : 0;
+        }
+        const uint64_t published = reader.published();
+        if (next >= published) {
+            usleep(1000);
+            continue;
+        }
+        if (published - next > reader.slot_count()) {
+            missed += published - next - reader.slot_count();
+            next = published - reader.slot_count();
+        }
+        if (!reader.view(next, view)) {
+            // overwritten between the two looks
+            ++missed;
+            ++next;
+            continue;
+        }
+        // the view points into the segment, copy what is kept and check nothing moved underneath
+        const uint32_t num_subsets = view.num_subsets;
+        double mean_x = 0.0;
+        double mean_y = 0.0;
+        double max_sigma = 0.0;
+        int failed = 0;
+        displacement_z.assign(view.displacement_z, view.displacement_z + num_subsets);
+        for (uint32_t subset = 0; subset < num_subsets; ++subset) {
+            mean_x += view.displacement_x[subset];
+            mean_y += view.displacement_y[subset];
+            max_sigma = std::max(max_sigma, view.sigma[subset]);
+            if (view.sigma[subset] < 0.0)
+                ++failed;
+        }
+        const uint64_t frame = view.frame;
+        const double timestamp_ms = view.timestamp_ms;
+        const bool failed_step = view.failed_step;
+        if (!reader.still_valid(view)) {
+            ++missed;
+            ++next;
+            continue;
+        }
+        double mean_z = 0.0;
+        for (uint32_t subset = 0; subset < num_subsets; ++subset)
+            mean_z += displacement_z[subset];
+        if (num_subsets > 0) {
+            mean_x /= num_subsets;
+            mean_y /= num_subsets;
+            mean_z /= num_subsets;
+        }
+        char line[160];
+        snprintf(line, sizeof(line), "frame %llu t %.1f ms subsets %u mean %.4f %.4f %.4f max sigma %.4f failed %d%s",
+                 (unsigned long long) frame, timestamp_ms, num_subsets, mean_x, mean_y, mean_z, max_sigma, failed,
+                 failed_step ? " (failed step)" : "");
+        cout << line;
+        if (missed > 0)
+            cout << " missed " << missed;
+        cout << endl;
+        ++next;
+    }
+}
+
+struct ReaderCounts {
+    uint64_t read;
+    uint64_t torn;
+    uint64_t missed;
+    /* a frame that passed the sequence check with values from another frame, must stay 0 */
+    uint64_t corrupt;
+
+    ReaderCounts() : read(0), torn(0), missed(0), corrupt(0) {}
+};
+
+static void read_ring(const string &name, uint64_t frames, ReaderCounts *counts) {
+    ResultRingReader reader;
+    while (!reader.open(name))
+        this_thread::yield();
+    uint64_t next = 0;
+    ResultRingView view;
+    vector<double> copy;
+    while (next < frames) {
+        const uint64_t published = reader.published();
+        if (next >= published) {
+            this_thread::yield();
+            continue;
+        }
+        if (published - next > reader.slot_count()) {
+            counts->missed += published - next - reader.slot_count();
+            next = published - reader.slot_count();
+        }
+        if (!reader.view(next, view)) {
+            ++counts->missed;
+            ++next;
+            continue;
+        }
+        copy.assign(view.displacement_x, view.displacement_x + view.num_subsets);
+        copy.insert(copy.end(), view.sigma, view.sigma + view.num_subsets);
+        if (!reader.still_valid(view)) {
+            ++counts->torn;
+            ++next;
+            continue;
+        }
+        // the writer fills every value with the frame number
+        for (size_t i = 0; i < copy.size(); ++i)
+            if (copy[i] != (double) (scalar_t) next) {
+                ++counts->corrupt;
+                break;
+            }
+        ++counts->read;
+        ++next;
+    }
+}
+
+static int throughput(int num_subsets, uint64_t frames, int num_readers, int slots, double rate) {
+    const string name = "/masters_ring_throughput_" + to_string((long long) getpid());
+    ResultRingWriter writer(name, slots, num_subsets);
+    SubSetData subsets;
+    subsets.resize(num_subsets);
+    // create the segment before the readers look for it
+    writer.publish(subsets, 0.0, false);
+
+    vector<ReaderCounts> counts(num_readers);
+    vector<thread> readers;
+    for (int reader = 0; reader < num_readers; ++reader)
+        readers.push_back(thread(read_ring, name, frames, &counts[reader]));
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (uint64_t frame = 1; frame < frames; ++frame) {
+        const scalar_t value = (scalar_t) frame;
+        std::fill(subsets.displacement_x.begin(), subsets.displacement_x.end(), value);
+        std::fill(subsets.displacement_y.begin(), subsets.displacement_y.end(), value);
+        std::fill(subsets.displacement_z.begin(), subsets.displacement_z.end(), value);
+        std::fill(subsets.sigma.begin(), subsets.sigma.end(), value);
+        writer.publish(subsets, elapsed_ms(start), false);
+        if (rate > 0.0)
+            // paced like a camera, otherwise as fast as the writer can go
+            this_thread::sleep_until(start + chrono::microseconds((long long) (1e6 * frame / rate)));
+    }
+    const double publish_ms = elapsed_ms(start);
+    for (size_t reader = 0; reader < readers.size(); ++reader)
+        readers[reader].join();
+
+    const double frame_bytes = num_subsets * (4 * sizeof(double) + sizeof(int32_t));
+    cout << "subsets " << num_subsets << ", frames " << frames << ", slots " << slots << ", readers " << num_readers
+         << endl;
+    cout << "publish: " << publish_ms << " ms, " << 1000.0 * frames / publish_ms << " frames/s, "
+         << frames * frame_bytes / (publish_ms * 1000.0) << " MB/s" << endl;
+    int result = 0;
+    for (int reader = 0; reader < num_readers; ++reader) {
+        const ReaderCounts &c = counts[reader];
+        cout << "reader " << reader << ": read " << c.read << ", torn " << c.torn << ", missed " << c.missed
+             << ", corrupt " << c.corrupt << endl;
+        if (c.corrupt > 0)
+            result = -1;
+    }
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage();
+        return -1;
+    }
+    const string command(argv[1]);
+    if (command == "follow")
+        return follow(argc >= 3 ? argv[2] : "/masters_results");
+    if (command == "throughput") {
+        int num_subsets = 1000;
+        uint64_t frames = 100000;
+        int num_readers = 2;
+        int slots = 64;
+        double rate = 0.0;
+        for (int arg_it = 2; arg_it < argc; ++arg_it) {
+            const string arg(argv[arg_it]);
+            if (arg == "--subsets" && arg_it + 1 < argc)
+                num_subsets = atoi(argv[++arg_it]);
+            else if (arg == "--frames" && arg_it + 1 < argc)
+                frames = strtoull(argv[++arg_it], NULL, 10);
+            else if (arg == "--readers" && arg_it + 1 < argc)
+                num_readers = atoi(argv[++arg_it]);
+            else if (arg == "--slots" && arg_it + 1 < argc)
+                slots = atoi(argv[++arg_it]);
+            else if (arg == "--rate" && arg_it + 1 < argc)
+                rate = atof(argv[++arg_it]);
+            else {
+                usage();
+                return -1;
+            }
+        }
+        return throughput(std::max(num_subsets, 1), std::max(frames, (uint64_t) 2), std::max(num_readers, 1),
+                          std::max(slots, 2), rate);
+    }
+    usage();
+    return -1;
+}
@@ -0,0 +1,315 @@
+// Tests for the parts of the app that do not need a camera or a DICe schema, run by ctest, e.g.
+//
+//   masters_tests
+//   masters_tests deadline_scheduler result_ring
+//
+// With test names only those run. Every failed check is printed, the exit code is the number of failed tests.
+//
+#include <DICe.h>
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ChangeGate.h"
+#include "DeadlineScheduler.h"
+#include "FrameQueue.h"
+#include "ResultFile.h"
+#include "ResultRing.h"
+#include "SubSetData.h"
+
+using namespace std;
+
+static int failed_checks = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            cerr << __FILE__ << ":" << __LINE__ << ": " << #condition << endl; \
+            ++failed_checks; \
+        } \
+    } while (0)
+
+static bool near(double a, double b) {
+    return fabs(a - b) < 1e-9;
+}
+
+static void test_frame_queue() {
+    FrameQueue<int> queue(2);
+    int item = 0;
+    CHECK(!queue.pop(item, 0));
+    queue.push(1);
+    queue.push(2);
+    queue.push(3);
+    // full, the oldest goes
+    CHECK(queue.depth() == 2);
+    CHECK(queue.pushed() == 3);
+    CHECK(queue.dropped() == 1);
+    CHECK(queue.pop(item, 0) && item == 2);
+    CHECK(queue.try_pop(item) && item == 3);
+    CHECK(!queue.try_pop(item));
+
+    queue.push(4);
+    queue.push(5);
+    CHECK(queue.pop_latest(item, 0) && item == 5);
+    CHECK(queue.dropped() == 2);
+    CHECK(queue.depth() == 0);
+
+    queue.close();
+    queue.push(6);
+    CHECK(queue.depth() == 0);
+    CHECK(!queue.pop(item, 1000));
+}
+
+static void test_deadline_scheduler_cap() {
+    DeadlineScheduler scheduler;
+    scheduler.configure(50.0, 20, 5);
+    scheduler.reset(vector<char>(4, 0));
+    // nothing measured yet, the first frame runs in full
+    CHECK(scheduler.plan() == 20);
+    // 4 subsets of 20 iterations, one setup each: 84 units in 84 ms and 2 ms around the solve
+    scheduler.record_solve(vector<scalar_t>(4, 20), 84.0);
+    scheduler.record_frame(86.0);
+    // 48 ms left: 20 iterations predict 84 ms, 10 predict 44 ms
+    CHECK(scheduler.plan() == 10);
+    CHECK(scheduler.stats().frames_capped == 1);
+    CHECK(scheduler.stats().last_deferred == 0);
+    for (size_t i = 0; i < 4; ++i)
+        CHECK(scheduler.skip_flags()[i] == 0);
+    CHECK(scheduler.stats().frames == 1);
+    CHECK(scheduler.stats().frames_over_budget == 1);
+    CHECK(near(scheduler.stats().last_budget_used, 86.0 / 50.0));
+}
+
+static void test_deadline_scheduler_deferral() {
+    DeadlineScheduler scheduler;
+    scheduler.configure(14.0, 20, 5);
+    vector<char> priority(4, 0);
+    priority[3] = 1;
+    scheduler.reset(priority);
+    CHECK(scheduler.plan() == 20);
+    scheduler.record_solve(vector<scalar_t>(4, 20), 84.0);
+    scheduler.record_frame(86.0);
+
+    // 12 ms left fits two subsets at the minimum of 5 iterations: the priority one and then the first
+    CHECK(scheduler.plan() == 5);
+    const vector<int_t> &skip = scheduler.skip_flags();
+    CHECK(skip[0] == 0 && skip[1] == 1 && skip[2] == 1 && skip[3] == 0);
+    CHECK(scheduler.stats().last_deferred == 2);
+    CHECK(scheduler.stale_frames()[1] == 1 && scheduler.stale_frames()[0] == 0);
+
+    vector<scalar_t> iterations(4, 0);
+    iterations[0] = 20;
+    iterations[3] = 5;
+    scheduler.record_solve(iterations, 27.0);
+    scheduler.record_frame(29.0);
+
+    // the longest deferred come next, the subset solved last frame waits
+    CHECK(scheduler.plan() == 5);
+    CHECK(skip[0] == 1 && skip[1] == 0 && skip[2] == 1 && skip[3] == 0);
+    CHECK(scheduler.stale_frames()[0] == 1);
+    CHECK(scheduler.stale_frames()[1] == 0);
+    CHECK(scheduler.stale_frames()[2] == 2);
+    CHECK(scheduler.stale_frames()[3] == 0);
+    CHECK(scheduler.stats().subsets_deferred == 4);
+
+    // carried subsets are skipped without going stale
+    vector<int_t> carried(4, 0);
+    carried[2] = 1;
+    scheduler.plan(&carried);
+    CHECK(skip[2] == 1);
+    CHECK(scheduler.stale_frames()[2] == 0);
+}
+
+static void test_change_gate() {
+    ChangeGate gate;
+    gate.configure(2.0);
+    gate.reset(3, 5);
+    GateView left;
+    GateView right;
+    left.frame = cv::Mat(20, 20, CV_8U, cv::Scalar(100));
+    left.centres.push_back(cv::Point(5, 5));
+    left.centres.push_back(cv::Point(12, 12));
+    // off the edge, never carried
+    left.centres.push_back(cv::Point(1, 1));
+
+    // nothing stored yet
+    gate.plan(left, right);
+    CHECK(gate.skip_flags()[0] == 0 && gate.skip_flags()[1] == 0 && gate.skip_flags()[2] == 0);
+    gate.record(left, right, gate.skip_flags());
+
+    // a mean difference of exactly the threshold still counts as unchanged, one above it does not
+    left.frame(cv::Rect(3, 3, 5, 5)).setTo(cv::Scalar(102));
+    left.frame(cv::Rect(10, 10, 5, 5)).setTo(cv::Scalar(103));
+    gate.plan(left, right);
+    CHECK(gate.skip_flags()[0] == 1);
+    CHECK(gate.skip_flags()[1] == 0);
+    CHECK(gate.skip_flags()[2] == 0);
+    CHECK(gate.stats().last_carried == 1);
+    CHECK(gate.stats().last_solved == 2);
+    gate.record(left, right, gate.skip_flags());
+
+    // the window of a solved subset is stored again, an invalidated one is solved whatever the image
+    gate.invalidate(0);
+    gate.plan(left, right);
+    CHECK(gate.skip_flags()[0] == 0);
+    CHECK(gate.skip_flags()[1] == 1);
+
+    gate.configure(0.0);
+    CHECK(!gate.enabled());
+}
+
+static void test_result_file() {
+    char file_name[] = "/tmp/masters_tests_XXXXXX";
+    const int descriptor = mkstemp(file_name);
+    CHECK(descriptor >= 0);
+    if (descriptor < 0)
+        return;
+    close(descriptor);
+
+    vector<string> field_names;
+    field_names.push_back("DISPLACEMENT_X");
+    field_names.push_back("SIGMA");
+    {
+        ResultFileWriter writer;
+        CHECK(writer.open(file_name, field_names, 3));
+        CHECK(writer.matches(field_names, 3));
+        CHECK(!writer.matches(field_names, 4));
+        for (int frame = 0; frame < 3; ++frame) {
+            double values[6];
+            for (int i = 0; i < 6; ++i)
+                values[i] = frame * 10 + i;
+            CHECK(writer.append(frame + 1, values));
+        }
+        writer.close();
+    }
+
+    ResultFileReader reader;
+    CHECK(reader.open(file_name));
+    CHECK(reader.error().empty());
+    CHECK(reader.num_subsets() == 3);
+    CHECK(reader.num_frames() == 3);
+    CHECK(reader.field_names() == field_names);
+    CHECK(reader.field_index("SIGMA") == 1);
+    CHECK(reader.field_index("GAMMA") == -1);
+    if (reader.num_frames() == 3) {
+        CHECK(near(reader.frame_number(2), 3.0));
+        CHECK(near(reader.value(2, 1, 2), 25.0));
+        CHECK(near(reader.column(1, 0)[1], 11.0));
+    }
+    reader.close();
+
+    // cut short in the last frame, the whole frames before it are still there
+    CHECK(truncate(file_name, RESULT_HEADER_ALIGNMENT + 2 * 7 * sizeof(double) + 5) == 0);
+    CHECK(reader.open(file_name));
+    CHECK(reader.num_frames() == 2);
+    reader.close();
+
+    CHECK(truncate(file_name, 16) == 0);
+    CHECK(!reader.open(file_name));
+    CHECK(!reader.error().empty());
+    unlink(file_name);
+    CHECK(!reader.open(file_name));
+}
+
+static void test_result_ring() {
+    const string name = "/masters_tests_" + to_string(getpid());
+    ResultRingReader reader;
+    ResultRingWriter writer(name, 4);
+    // the segment only exists once something is published
+    CHECK(!reader.open(name));
+
+    SubSetData subsets;
+    subsets.resize(3);
+    for (size_t i = 0; i < subsets.size(); ++i)
+        subsets.displacement_x[i] = i + 0.5;
+    CHECK(writer.publish(subsets, 1.0, false));
+    CHECK(reader.open(name));
+    CHECK(reader.published() == 1);
+    CHECK(reader.slot_count() == 4);
+
+    ResultRingView first;
+    CHECK(reader.view(0, first));
+    CHECK(first.frame == 0);
+    CHECK(first.num_subsets == 3);
+    CHECK(!first.failed_step);
+    CHECK(near(first.displacement_x[2], 2.5));
+    CHECK(reader.still_valid(first));
+    ResultRingView view;
+    CHECK(!reader.view(1, view));
+
+    // frame 4 lands in the slot of frame 0, the view taken of it is torn
+    for (int frame = 1; frame <= 4; ++frame)
+        CHECK(writer.publish(subsets, 1.0 + frame, frame == 4));
+    CHECK(reader.published() == 5);
+    CHECK(!reader.still_valid(first));
+    CHECK(!reader.view(0, view));
+    CHECK(reader.view(4, view));
+    CHECK(view.frame == 4 && view.failed_step);
+    CHECK(reader.view(1, view) && view.frame == 1);
+    CHECK(!reader.closed());
+    reader.close();
+}
+
+static void test_subset_data() {
+    SubSetData subsets;
+    subsets.resize(3);
+    CHECK(subsets.size() == 3);
+    CHECK(subsets.ids[2] == 2);
+    subsets.x_coord[1] = 20;
+    subsets.y_coord[1] = 30;
+    subsets.sigma[1] = 0.25;
+    subsets.ids[1] = 7;
+
+    // growing keeps what is there, the new ids carry on from the old size
+    subsets.resize(5);
+    CHECK(subsets.ids.size() == 5 && subsets.displacement_z.size() == 5 && subsets.carried_over.size() == 5);
+    CHECK(subsets.ids[1] == 7 && subsets.ids[3] == 3 && subsets.ids[4] == 4);
+    CHECK(subsets.x_coord[1] == 20 && near(subsets.sigma[1], 0.25));
+    CHECK(subsets.x_coord[4] == 0 && subsets.status[4] == 0 && subsets.stale_frames[4] == 0);
+
+    subsets.subset_size = 11;
+    const cv::Rect box = subsets.box(1);
+    CHECK(box.x == 15 && box.y == 25 && box.width == 11 && box.height == 11);
+
+    subsets.clear();
+    CHECK(subsets.size() == 0 && subsets.sigma.empty() && subsets.subset_size == 0);
+}
+
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+int main(int argc, char *argv[]) {
+    const Test tests[] = {
+            {"frame_queue",                  test_frame_queue},
+            {"deadline_scheduler_cap",       test_deadline_scheduler_cap},
+            {"deadline_scheduler_deferral",  test_deadline_scheduler_deferral},
+            {"change_gate",                  test_change_gate},
+            {"result_file",                  test_result_file},
+            {"result_ring",                  test_result_ring},
+            {"subset_data",                  test_subset_data},
+    };
+    int failed_tests = 0;
+    for (size_t test_it = 0; test_it < sizeof(tests) / sizeof(tests[0]); ++test_it) {
+        bool selected = argc < 2;
+        for (int arg_it = 1; arg_it < argc; ++arg_it)
+            if (string(argv[arg_it]) == tests[test_it].name)
+                selected = true;
+        if (!selected)
+            continue;
+        const int failed_before = failed_checks;
+        tests[test_it].run();
+        const bool passed = failed_checks == failed_before;
+        cout << (passed ? "ok      " : "FAILED  ") << tests[test_it].name << endl;
+        if (!passed)
+            ++failed_tests;
+    }
+    return failed_tests;
+}